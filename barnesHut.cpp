@@ -0,0 +1,396 @@
+// ----------------------------------------------------------------------------
+// barnesHut.cpp
+//
+// Description: Barnes-Hut N-body gravity (see barnesHut.h)
+// ----------------------------------------------------------------------------
+
+#include "barnesHut.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+// Morton codes interleave 10 bits per axis: the octree is at most 10 levels deep, and bodies
+// closer than 1/1024 of the scene share a leaf whatever their number
+const static int kMortonBits = 10;
+const static uint32_t kLeafSize = 8;        // bodies below which a cell is not split
+const static int kRadixBits = 10;           // per pass of the radix sort: 3 passes over 30-bit codes
+const static uint32_t kRadixBuckets = 1u << kRadixBits;
+const static int kSubtreeLevel = 2;         // the (up to 64) cells of this level are built as parallel tasks
+const static int kStackSize = 8 * (kMortonBits + 2);
+
+// Bodies per task of the linear passes (Morton codes, sort, integration steps), a few arithmetic
+// operations per body; the force traversal of one body walks part of the tree, hence far fewer
+const static size_t kMinBodiesPerTask = 16384;
+const static size_t kMinBodiesPerForceTask = 256;
+
+// Runs fn on [0, count) split across the pool, or in one chunk without it
+template <class Function>
+static void forRange(ThreadPool *pool, size_t count, size_t minChunk, const Function &fn) {
+  if(pool)
+    pool->parallelFor(count, minChunk, fn);
+  else if(count)
+    fn(0, count, 0);
+}
+
+// Spreads the 10 low bits of v to every third bit
+static inline uint32_t spreadBits(uint32_t v) {
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v << 8)) & 0x0300F00F;
+  v = (v | (v << 4)) & 0x030C30C3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+int BarnesHutGravity::addBody(const glm::dvec3 &position, const glm::dvec3 &velocity, double mass) {
+  m_x.push_back(position.x);
+  m_y.push_back(position.y);
+  m_z.push_back(position.z);
+  m_vx.push_back(velocity.x);
+  m_vy.push_back(velocity.y);
+  m_vz.push_back(velocity.z);
+  m_ax.push_back(0.);
+  m_ay.push_back(0.);
+  m_az.push_back(0.);
+  m_mass.push_back(mass);
+  m_accelerationsValid = false;
+  return static_cast<int>(m_x.size()) - 1;
+}
+
+void BarnesHutGravity::clear() {
+  for(std::vector<double> *v : {&m_x, &m_y, &m_z, &m_vx, &m_vy, &m_vz, &m_ax, &m_ay, &m_az, &m_mass})
+    v->clear();
+  m_nodes.clear();
+  m_accelerationsValid = false;
+}
+
+void BarnesHutGravity::sortBodies(ThreadPool *pool) {
+  const size_t n = size();
+  const size_t numChunks = pool ? pool->maxChunks() : 1;
+
+  // Bounding cube of the bodies
+  const double inf = std::numeric_limits<double>::infinity();
+  std::vector<glm::dvec3> chunkMin(numChunks, glm::dvec3(inf)), chunkMax(numChunks, glm::dvec3(-inf));
+  forRange(pool, n, kMinBodiesPerTask, [&](size_t begin, size_t end, size_t chunk) {
+    glm::dvec3 lo(inf), hi(-inf);
+    for(size_t i = begin; i < end; ++i) {
+      const glm::dvec3 p(m_x[i], m_y[i], m_z[i]);
+      lo = glm::min(lo, p);
+      hi = glm::max(hi, p);
+    }
+    chunkMin[chunk] = lo;
+    chunkMax[chunk] = hi;
+  });
+  glm::dvec3 lo(inf), hi(-inf);
+  for(size_t c = 0; c < numChunks; ++c) {
+    lo = glm::min(lo, chunkMin[c]);
+    hi = glm::max(hi, chunkMax[c]);
+  }
+  const glm::dvec3 extent = hi - lo;
+  m_origin = lo;
+  m_extent = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-9)) * (1. + 1e-9); // the far faces map inside the last cell
+
+  m_codes.resize(n);
+  m_order.resize(n);
+  m_codesScratch.resize(n);
+  m_orderScratch.resize(n);
+  const double scale = (1 << kMortonBits) / m_extent;
+  const uint32_t maxCell = (1u << kMortonBits) - 1;
+  forRange(pool, n, kMinBodiesPerTask, [&](size_t begin, size_t end, size_t) {
+    for(size_t i = begin; i < end; ++i) {
+      const uint32_t cx = std::min(maxCell, static_cast<uint32_t>((m_x[i] - m_origin.x) * scale));
+      const uint32_t cy = std::min(maxCell, static_cast<uint32_t>((m_y[i] - m_origin.y) * scale));
+      const uint32_t cz = std::min(maxCell, static_cast<uint32_t>((m_z[i] - m_origin.z) * scale));
+      m_codes[i] = spreadBits(cx) << 2 | spreadBits(cy) << 1 | spreadBits(cz);
+      m_order[i] = static_cast<uint32_t>(i);
+    }
+  });
+
+  // LSD radix sort: every chunk counts its digits, then scatters its bodies after those of the same
+  // digit in earlier chunks (parallelFor cuts the same chunks for the same count), which keeps it stable
+  std::vector<uint32_t> offsets(numChunks * kRadixBuckets);
+  for(int shift = 0; shift < 3 * kMortonBits; shift += kRadixBits) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    forRange(pool, n, kMinBodiesPerTask, [&](size_t begin, size_t end, size_t chunk) {
+      uint32_t *counts = offsets.data() + chunk * kRadixBuckets;
+      for(size_t i = begin; i < end; ++i)
+        ++counts[(m_codes[i] >> shift) & (kRadixBuckets - 1)];
+    });
+    uint32_t total = 0;
+    for(uint32_t digit = 0; digit < kRadixBuckets; ++digit) {
+      for(size_t c = 0; c < numChunks; ++c) {
+        const uint32_t count = offsets[c * kRadixBuckets + digit];
+        offsets[c * kRadixBuckets + digit] = total;
+        total += count;
+      }
+    }
+    forRange(pool, n, kMinBodiesPerTask, [&](size_t begin, size_t end, size_t chunk) {
+      uint32_t *next = offsets.data() + chunk * kRadixBuckets;
+      for(size_t i = begin; i < end; ++i) {
+        const uint32_t position = next[(m_codes[i] >> shift) & (kRadixBuckets - 1)]++;
+        m_codesScratch[position] = m_codes[i];
+        m_orderScratch[position] = m_order[i];
+      }
+    });
+    m_codes.swap(m_codesScratch);
+    m_order.swap(m_orderScratch);
+  }
+
+  m_sortedX.resize(n);
+  m_sortedY.resize(n);
+  m_sortedZ.resize(n);
+  m_sortedMass.resize(n);
+  forRange(pool, n, kMinBodiesPerTask, [&](size_t begin, size_t end, size_t) {
+    for(size_t k = begin; k < end; ++k) {
+      const uint32_t body = m_order[k];
+      m_sortedX[k] = m_x[body];
+      m_sortedY[k] = m_y[body];
+      m_sortedZ[k] = m_z[body];
+      m_sortedMass[k] = m_mass[body];
+    }
+  });
+}
+
+void BarnesHutGravity::accumulateNode(std::vector<Node> &nodes, uint32_t index) const {
+  Node &node = nodes[index];
+  double x = 0., y = 0., z = 0., mass = 0.;
+  if(node.childCount == 0) {
+    for(uint32_t k = node.begin; k < node.end; ++k) {
+      x += m_sortedX[k] * m_sortedMass[k];
+      y += m_sortedY[k] * m_sortedMass[k];
+      z += m_sortedZ[k] * m_sortedMass[k];
+      mass += m_sortedMass[k];
+    }
+  } else {
+    for(uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c) {
+      x += nodes[c].x * nodes[c].mass;
+      y += nodes[c].y * nodes[c].mass;
+      z += nodes[c].z * nodes[c].mass;
+      mass += nodes[c].mass;
+    }
+  }
+  node.mass = mass;
+  const double invMass = mass > 0. ? 1. / mass : 0.;
+  node.x = x * invMass;
+  node.y = y * invMass;
+  node.z = z * invMass;
+}
+
+void BarnesHutGravity::buildNode(std::vector<Node> &nodes, uint32_t index, uint32_t begin, uint32_t end, int level, double size, int stopLevel,
+                                 std::vector<PendingSubtree> *pending) const {
+  Node &node = nodes[index];
+  node.x = node.y = node.z = node.mass = 0.;
+  node.size = size;
+  node.firstChild = node.childCount = 0;
+  node.begin = begin;
+  node.end = end;
+  if(level == stopLevel) {
+    pending->push_back({index, begin, end});
+    return;
+  }
+  if(end - begin <= kLeafSize || level == kMortonBits) {
+    accumulateNode(nodes, index);
+    return;
+  }
+
+  // The codes of the cell share their first 3*level bits: the next three pick the octant, and the
+  // bodies of each octant are contiguous
+  const int shift = 3 * (kMortonBits - 1 - level);
+  uint32_t bounds[9];
+  bounds[0] = begin;
+  for(uint32_t octant = 1; octant < 8; ++octant)
+    bounds[octant] = static_cast<uint32_t>(std::partition_point(m_codes.begin() + bounds[octant - 1], m_codes.begin() + end, [&](uint32_t code) {
+                                             return ((code >> shift) & 7) < octant;
+                                           }) - m_codes.begin());
+  bounds[8] = end;
+  uint32_t childCount = 0;
+  for(int octant = 0; octant < 8; ++octant)
+    childCount += bounds[octant + 1] > bounds[octant];
+
+  const uint32_t firstChild = static_cast<uint32_t>(nodes.size());
+  nodes.resize(nodes.size() + childCount); // invalidates node
+  nodes[index].firstChild = firstChild;
+  nodes[index].childCount = childCount;
+  uint32_t child = firstChild;
+  for(int octant = 0; octant < 8; ++octant) {
+    if(bounds[octant + 1] > bounds[octant])
+      buildNode(nodes, child++, bounds[octant], bounds[octant + 1], level + 1, size * 0.5, stopLevel, pending);
+  }
+  accumulateNode(nodes, index); // bottom-up, once the children are done
+}
+
+void BarnesHutGravity::buildTree(ThreadPool *pool) {
+  m_nodes.clear();
+  const uint32_t n = static_cast<uint32_t>(size());
+  if(n == 0)
+    return;
+
+  // Top levels on this thread, down to the cells built as tasks
+  std::vector<PendingSubtree> pending;
+  m_nodes.resize(1);
+  buildNode(m_nodes, 0, 0, n, 0, m_extent, pool ? kSubtreeLevel : -1, &pending);
+  if(pending.empty())
+    return;
+  const uint32_t topCount = static_cast<uint32_t>(m_nodes.size());
+
+  std::vector<std::vector<Node>> subtrees(pending.size());
+  const double subtreeSize = m_extent / (1 << kSubtreeLevel);
+  forRange(pool, pending.size(), 1, [&](size_t begin, size_t end, size_t) {
+    for(size_t t = begin; t < end; ++t) {
+      subtrees[t].resize(1);
+      buildNode(subtrees[t], 0, pending[t].begin, pending[t].end, kSubtreeLevel, subtreeSize, -1, nullptr);
+    }
+  });
+
+  // Splice: the root of a subtree replaces its pending cell, its other nodes are appended
+  for(size_t t = 0; t < subtrees.size(); ++t) {
+    const uint32_t base = static_cast<uint32_t>(m_nodes.size()) - 1; // local index 1 lands at base + 1
+    for(size_t j = 0; j < subtrees[t].size(); ++j) {
+      Node node = subtrees[t][j];
+      if(node.childCount)
+        node.firstChild += base;
+      if(j == 0)
+        m_nodes[pending[t].node] = node;
+      else
+        m_nodes.push_back(node);
+    }
+  }
+
+  // Moments of the top levels: children come after their parent
+  for(uint32_t i = topCount; i-- > 0;) {
+    if(m_nodes[i].childCount)
+      accumulateNode(m_nodes, i);
+  }
+}
+
+uint64_t BarnesHutGravity::accelerate(uint32_t sorted, double &ax, double &ay, double &az) const {
+  const double px = m_sortedX[sorted], py = m_sortedY[sorted], pz = m_sortedZ[sorted];
+  const double epsilon2 = m_softening * m_softening;
+  const double theta2 = m_theta * m_theta;
+  uint64_t interactions = 0;
+  ax = ay = az = 0.;
+
+  uint32_t stack[kStackSize];
+  int top = 0;
+  stack[top++] = 0;
+  while(top > 0) {
+    const Node &node = m_nodes[stack[--top]];
+    if(node.childCount == 0) {
+      for(uint32_t k = node.begin; k < node.end; ++k) {
+        if(k == sorted)
+          continue;
+        const double dx = m_sortedX[k] - px, dy = m_sortedY[k] - py, dz = m_sortedZ[k] - pz;
+        const double inverse = 1. / std::sqrt(dx * dx + dy * dy + dz * dz + epsilon2);
+        const double strength = m_sortedMass[k] * inverse * inverse * inverse;
+        ax += dx * strength;
+        ay += dy * strength;
+        az += dz * strength;
+      }
+      interactions += node.end - node.begin - (sorted >= node.begin && sorted < node.end);
+      continue;
+    }
+    const double dx = node.x - px, dy = node.y - py, dz = node.z - pz;
+    const double distance2 = dx * dx + dy * dy + dz * dz;
+    if(node.size * node.size < theta2 * distance2) { // far enough: the cell acts as a point mass
+      const double inverse = 1. / std::sqrt(distance2 + epsilon2);
+      const double strength = node.mass * inverse * inverse * inverse;
+      ax += dx * strength;
+      ay += dy * strength;
+      az += dz * strength;
+      ++interactions;
+      continue;
+    }
+    for(uint32_t c = 0; c < node.childCount; ++c)
+      stack[top++] = node.firstChild + c;
+  }
+  ax *= m_g;
+  ay *= m_g;
+  az *= m_g;
+  return interactions;
+}
+
+void BarnesHutGravity::computeAccelerations(ThreadPool *pool) {
+  const auto start = std::chrono::steady_clock::now();
+  sortBodies(pool);
+  buildTree(pool);
+  const auto built = std::chrono::steady_clock::now();
+
+  // In Morton order, so that the bodies of a task walk mostly the same cells
+  std::vector<uint64_t> interactions(pool ? pool->maxChunks() : 1, 0);
+  forRange(pool, size(), kMinBodiesPerForceTask, [&](size_t begin, size_t end, size_t chunk) {
+    uint64_t count = 0;
+    for(size_t k = begin; k < end; ++k) {
+      const uint32_t body = m_order[k];
+      count += accelerate(static_cast<uint32_t>(k), m_ax[body], m_ay[body], m_az[body]);
+    }
+    interactions[chunk] += count;
+  });
+  m_interactions = 0;
+  for(uint64_t count : interactions)
+    m_interactions += count;
+
+  const auto done = std::chrono::steady_clock::now();
+  m_buildMs = std::chrono::duration<double, std::milli>(built - start).count();
+  m_forceMs = std::chrono::duration<double, std::milli>(done - built).count();
+  m_totalInteractions += m_interactions;
+  m_totalBuildMs += m_buildMs;
+  m_totalForceMs += m_forceMs;
+  m_accelerationsValid = true;
+}
+
+void BarnesHutGravity::kick(double dt, ThreadPool *pool) {
+  forRange(pool, size(), kMinBodiesPerTask, [&](size_t begin, size_t end, size_t) {
+    for(size_t i = begin; i < end; ++i) {
+      m_vx[i] += m_ax[i] * dt;
+      m_vy[i] += m_ay[i] * dt;
+      m_vz[i] += m_az[i] * dt;
+    }
+  });
+}
+
+void BarnesHutGravity::drift(double dt, ThreadPool *pool) {
+  forRange(pool, size(), kMinBodiesPerTask, [&](size_t begin, size_t end, size_t) {
+    for(size_t i = begin; i < end; ++i) {
+      m_x[i] += m_vx[i] * dt;
+      m_y[i] += m_vy[i] * dt;
+      m_z[i] += m_vz[i] * dt;
+    }
+  });
+  m_accelerationsValid = false;
+}
+
+// Kick-drift-kick, from and to accelerations at the current positions
+void BarnesHutGravity::leapfrog(double dt, ThreadPool *pool) {
+  if(!m_accelerationsValid)
+    computeAccelerations(pool);
+  kick(0.5 * dt, pool);
+  drift(dt, pool);
+  computeAccelerations(pool);
+  kick(0.5 * dt, pool);
+}
+
+void BarnesHutGravity::step(double dt, ThreadPool *pool) {
+  switch(m_integrator) {
+  case Integrator::SymplecticEuler:
+    computeAccelerations(pool);
+    kick(dt, pool);
+    drift(dt, pool);
+    break;
+  case Integrator::Leapfrog:
+    leapfrog(dt, pool);
+    break;
+  case Integrator::Yoshida4: {
+    // Three leapfrogs, the middle one backward, cancel the third order error terms (Yoshida 1990);
+    // consecutive half kicks share their force evaluation
+    const double cbrt2 = std::cbrt(2.);
+    const double w1 = 1. / (2. - cbrt2);
+    const double w0 = -cbrt2 * w1;
+    leapfrog(w1 * dt, pool);
+    leapfrog(w0 * dt, pool);
+    leapfrog(w1 * dt, pool);
+    break;
+  }
+  }
+}
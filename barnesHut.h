@@ -0,0 +1,121 @@
+// ----------------------------------------------------------------------------
+// barnesHut.h
+//
+// Description: N-body gravity with the Barnes-Hut approximation. Every step
+//              the bodies are sorted along a Morton curve (parallel radix
+//              sort), an octree is cut from the sorted codes with its subtrees
+//              built on the thread pool and its mass moments accumulated
+//              bottom-up, and accelerations are summed across the threads,
+//              opening a cell only when it is seen under more than theta.
+// ----------------------------------------------------------------------------
+
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Symplectic integrators for BarnesHutGravity::step, by force evaluations per step: symplectic
+// Euler (1, first order), leapfrog kick-drift-kick (1, second order), Yoshida (3, fourth order)
+enum class Integrator {
+  SymplecticEuler,
+  Leapfrog,
+  Yoshida4
+};
+
+class BarnesHutGravity {
+public:
+  inline void setGravitationalConstant(double g) { m_g = g; m_accelerationsValid = false; }
+  // Cells are opened when their edge over their distance exceeds theta; 0 sums every pair exactly.
+  // Above 0.57, a cell far from its center of mass can be taken as a point by a body it contains.
+  inline void setOpeningAngle(double theta) { m_theta = theta; m_accelerationsValid = false; }
+  inline void setSoftening(double epsilon) { m_softening = epsilon; m_accelerationsValid = false; } // length added to close encounters
+  inline void setIntegrator(Integrator integrator) { m_integrator = integrator; }
+  inline Integrator getIntegrator() const { return m_integrator; }
+
+  // Adds a body and returns its index, which stays the same whatever the order of the tree
+  int addBody(const glm::dvec3 &position, const glm::dvec3 &velocity, double mass);
+  void clear();
+  inline size_t size() const { return m_x.size(); }
+
+  // Rebuilds the octree from the current positions and computes the acceleration of every body
+  void computeAccelerations(ThreadPool *pool = nullptr);
+
+  // Advances by dt with the integrator. Leapfrog and Yoshida end on a force evaluation at the new
+  // positions, which the next step starts from.
+  void step(double dt, ThreadPool *pool = nullptr);
+
+  inline glm::dvec3 getPosition(int body) const { return glm::dvec3(m_x[body], m_y[body], m_z[body]); }
+  inline glm::dvec3 getVelocity(int body) const { return glm::dvec3(m_vx[body], m_vy[body], m_vz[body]); }
+  inline glm::dvec3 getAcceleration(int body) const { return glm::dvec3(m_ax[body], m_ay[body], m_az[body]); }
+  inline void setVelocity(int body, const glm::dvec3 &v) { m_vx[body] = v.x; m_vy[body] = v.y; m_vz[body] = v.z; }
+  inline double getMass(int body) const { return m_mass[body]; }
+
+  // Statistics of the last computeAccelerations: body-body and body-cell interactions, time spent
+  // sorting and building the tree, and summing the forces
+  inline uint64_t getInteractions() const { return m_interactions; }
+  inline size_t getNodeCount() const { return m_nodes.size(); }
+  inline double getLastBuildMs() const { return m_buildMs; }
+  inline double getLastForceMs() const { return m_forceMs; }
+  // Sums over every computeAccelerations so far, for rates over several steps
+  inline uint64_t getTotalInteractions() const { return m_totalInteractions; }
+  inline double getTotalBuildMs() const { return m_totalBuildMs; }
+  inline double getTotalForceMs() const { return m_totalForceMs; }
+
+private:
+  struct Node {
+    double x, y, z, mass;   // center of mass and total mass
+    double size;            // edge of the cell
+    uint32_t firstChild;    // children are contiguous, after their parent
+    uint32_t childCount;    // 0 for a leaf
+    uint32_t begin, end;    // bodies of the cell, in Morton order
+  };
+  struct PendingSubtree {
+    uint32_t node;
+    uint32_t begin, end;
+  };
+
+  void sortBodies(ThreadPool *pool);
+  void buildTree(ThreadPool *pool);
+  void buildNode(std::vector<Node> &nodes, uint32_t node, uint32_t begin, uint32_t end, int level, double size, int stopLevel,
+                 std::vector<PendingSubtree> *pending) const;
+  void accumulateNode(std::vector<Node> &nodes, uint32_t node) const;
+  uint64_t accelerate(uint32_t sorted, double &ax, double &ay, double &az) const;
+  void kick(double dt, ThreadPool *pool);
+  void drift(double dt, ThreadPool *pool);
+  void leapfrog(double dt, ThreadPool *pool);
+
+  double m_g = 1.;
+  double m_theta = 0.5;
+  double m_softening = 0.01;
+  Integrator m_integrator = Integrator::Leapfrog;
+  bool m_accelerationsValid = false; // m_ax.. are those of the current positions
+
+  std::vector<double> m_x, m_y, m_z;
+  std::vector<double> m_vx, m_vy, m_vz;
+  std::vector<double> m_ax, m_ay, m_az;
+  std::vector<double> m_mass;
+
+  // Morton order of the last build: codes, body of each rank, and copies of the positions and
+  // masses in that order for the traversals
+  std::vector<uint32_t> m_codes, m_codesScratch;
+  std::vector<uint32_t> m_order, m_orderScratch;
+  std::vector<double> m_sortedX, m_sortedY, m_sortedZ, m_sortedMass;
+  glm::dvec3 m_origin;
+  double m_extent = 0.;
+  std::vector<Node> m_nodes; // root first
+
+  uint64_t m_interactions = 0;
+  double m_buildMs = 0.;
+  double m_forceMs = 0.;
+  uint64_t m_totalInteractions = 0;
+  double m_totalBuildMs = 0.;
+  double m_totalForceMs = 0.;
+};
+
+#endif // BARNES_HUT_H
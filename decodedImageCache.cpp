@@ -0,0 +1,232 @@
+// ----------------------------------------------------------------------------
+// decodedImageCache.cpp
+//
+// Description: On-disk cache of decoded images (see decodedImageCache.h)
+// ----------------------------------------------------------------------------
+
+#include "decodedImageCache.h"
+#include "fileUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+const static uint32_t kEntryMagic = 0x49445353; // "SSDI"
+const static uint32_t kEntryVersion = 2;
+const static int kMaxLevels = 32;
+const static size_t kLevelAlignment = 4096; // levels start on a page: mappable and aligned for any copy
+
+// Header of a cache file; the levels follow, each at its offset
+struct EntryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key; // guards against hash-named files of another key
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t numLevels;
+  uint64_t offsets[kMaxLevels];
+  uint64_t fileSize;    // up to the end of the last level
+  uint64_t payloadHash; // of the levels, see hashLevel
+};
+
+// Hash of a level, chained through hash: 8 bytes per multiply, so that checking the entries costs
+// little next to reading them
+static uint64_t hashLevel(const unsigned char *pixels, size_t size, uint64_t hash) {
+  size_t i = 0;
+  for(; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, pixels + i, 8);
+    hash = (hash ^ word) * 0x100000001b3ull;
+    hash ^= hash >> 29;
+  }
+  return hashBytes(pixels + i, size - i, hash);
+}
+
+static size_t levelBytes(int width, int height, int channels, int level) {
+  return static_cast<size_t>(std::max(1, width >> level)) * std::max(1, height >> level) * channels;
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+#if defined(_WIN32)
+bool MappedFile::open(const std::string &path) {
+  close();
+  m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(m_file == INVALID_HANDLE_VALUE) {
+    m_file = nullptr;
+    return false;
+  }
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+    close();
+    return false;
+  }
+  m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  m_data = m_mapping ? static_cast<const unsigned char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+  if(!m_data) {
+    close();
+    return false;
+  }
+  m_size = static_cast<size_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::close() {
+  if(m_data)
+    UnmapViewOfFile(m_data);
+  if(m_mapping)
+    CloseHandle(m_mapping);
+  if(m_file)
+    CloseHandle(m_file);
+  m_data = nullptr;
+  m_mapping = m_file = nullptr;
+  m_size = 0;
+}
+#else
+bool MappedFile::open(const std::string &path) {
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat fileStat;
+  if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping keeps the file
+  if(data == MAP_FAILED)
+    return false;
+  m_data = static_cast<const unsigned char *>(data);
+  m_size = static_cast<size_t>(fileStat.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if(m_data)
+    munmap(const_cast<unsigned char *>(m_data), m_size);
+  m_data = nullptr;
+  m_size = 0;
+}
+#endif
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for(size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void DecodedImageCache::init(const std::string &directory) {
+  makeDirectory(directory.c_str()); // fails harmlessly if it exists; a missing directory only makes stores fail
+  m_directory = directory;
+}
+
+uint64_t DecodedImageCache::computeKey(uint64_t sourceHash, int width, int height, int channels, int numLevels) {
+  const int32_t layout[5] = {static_cast<int32_t>(kEntryVersion), width, height, channels, numLevels};
+  return hashBytes(layout, sizeof(layout), sourceHash);
+}
+
+std::string DecodedImageCache::entryPath(uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.raw", static_cast<unsigned long long>(key));
+  return m_directory + "/" + name;
+}
+
+bool DecodedImageCache::load(uint64_t key, int width, int height, int channels, int numLevels, MappedImage &image) const {
+  if(!isEnabled() || numLevels > kMaxLevels)
+    return false;
+  std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+  if(!file->open(entryPath(key)) || file->size() < sizeof(EntryHeader))
+    return false;
+  EntryHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+  if(header.magic != kEntryMagic || header.version != kEntryVersion || header.key != key || static_cast<int>(header.width) != width ||
+     static_cast<int>(header.height) != height || static_cast<int>(header.channels) != channels || static_cast<int>(header.numLevels) != numLevels ||
+     header.fileSize != file->size())
+    return false;
+
+  image.levels.resize(numLevels);
+  image.pixels.resize(numLevels);
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for(int level = 0; level < numLevels; ++level) {
+    const size_t bytes = levelBytes(width, height, channels, level);
+    if(header.offsets[level] + bytes > file->size())
+      return false; // truncated
+    image.levels[level].width = std::max(1, width >> level);
+    image.levels[level].height = std::max(1, height >> level);
+    image.pixels[level] = file->data() + header.offsets[level];
+    hash = hashLevel(image.pixels[level], bytes, hash);
+  }
+  if(hash != header.payloadHash)
+    return false; // corrupt, e.g. written over by another run
+  image.channels = channels;
+  image.file = file;
+  return true;
+}
+
+void DecodedImageCache::store(uint64_t key, const std::vector<MipLevel> &levels, int channels) const {
+  if(!isEnabled() || levels.empty() || levels.size() > static_cast<size_t>(kMaxLevels))
+    return;
+  EntryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kEntryMagic;
+  header.version = kEntryVersion;
+  header.key = key;
+  header.width = levels[0].width;
+  header.height = levels[0].height;
+  header.channels = channels;
+  header.numLevels = static_cast<uint32_t>(levels.size());
+  size_t offset = alignUp(sizeof(header), kLevelAlignment);
+  header.payloadHash = 0xcbf29ce484222325ull;
+  for(size_t level = 0; level < levels.size(); ++level) {
+    header.offsets[level] = offset;
+    header.fileSize = offset + levels[level].pixels.size();
+    header.payloadHash = hashLevel(levels[level].pixels.data(), levels[level].pixels.size(), header.payloadHash);
+    offset = alignUp(header.fileSize, kLevelAlignment);
+  }
+
+  // Written to a temporary file of this store then moved over the entry, so that a concurrent or
+  // interrupted run never maps a partial entry; the size and hash checked by load catch the rest
+  const std::string path = entryPath(key);
+  const std::string temporary = temporaryPath(path);
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if(!file) {
+    std::cerr << "WARNING: cannot write the decoded image cache entry " << temporary << std::endl;
+    return;
+  }
+  const std::vector<unsigned char> padding(kLevelAlignment, 0);
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  size_t written = sizeof(header);
+  for(size_t level = 0; level < levels.size() && ok; ++level) {
+    const size_t gap = header.offsets[level] - written;
+    ok = std::fwrite(padding.data(), 1, gap, file) == gap && std::fwrite(levels[level].pixels.data(), 1, levels[level].pixels.size(), file) == levels[level].pixels.size();
+    written = header.offsets[level] + levels[level].pixels.size();
+  }
+  if(std::fclose(file) != 0 || !ok) {
+    std::remove(temporary.c_str());
+    return;
+  }
+  if(!replaceFile(temporary, path))
+    std::remove(temporary.c_str());
+}
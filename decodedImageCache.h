@@ -0,0 +1,71 @@
+// ----------------------------------------------------------------------------
+// decodedImageCache.h
+//
+// Description: On-disk cache of decoded images and their mip chains, keyed by
+//              a hash of the source file content. Entries are raw pixels with
+//              page-aligned levels, memory mapped on load so that warm starts
+//              copy them straight from the mapping to the GPU.
+// ----------------------------------------------------------------------------
+
+#ifndef DECODED_IMAGE_CACHE_H
+#define DECODED_IMAGE_CACHE_H
+
+#include "mipmapGenerator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+  ~MappedFile();
+  bool open(const std::string &path);
+  void close();
+  inline const unsigned char *data() const { return m_data; }
+  inline size_t size() const { return m_size; }
+
+private:
+  const unsigned char *m_data = nullptr;
+  size_t m_size = 0;
+#if defined(_WIN32)
+  void *m_file = nullptr;
+  void *m_mapping = nullptr;
+#endif
+};
+
+// FNV-1a of a buffer, chained through hash
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
+
+// Levels of a cached image, pointing into its mapping
+struct MappedImage {
+  std::shared_ptr<MappedFile> file;
+  int channels = 0;
+  std::vector<MipLevel> levels;              // sizes only, the pixels stay in the mapping
+  std::vector<const unsigned char *> pixels; // per level
+};
+
+class DecodedImageCache {
+public:
+  // Entries live in directory (created if needed). Safe to use from several threads once initialized.
+  void init(const std::string &directory);
+  inline bool isEnabled() const { return !m_directory.empty(); }
+
+  // Key of an image stored at the given size and channels, with numLevels levels, from a source
+  // file whose content hashes to sourceHash
+  static uint64_t computeKey(uint64_t sourceHash, int width, int height, int channels, int numLevels);
+
+  // Maps the entry of key; false if there is none, or it does not match.
+  bool load(uint64_t key, int width, int height, int channels, int numLevels, MappedImage &image) const;
+  // Writes the levels (tightly packed rows of channels bytes per texel) as the entry of key.
+  void store(uint64_t key, const std::vector<MipLevel> &levels, int channels) const;
+
+private:
+  std::string entryPath(uint64_t key) const;
+
+  std::string m_directory;
+};
+
+#endif // DECODED_IMAGE_CACHE_H
@@ -0,0 +1,56 @@
+// ----------------------------------------------------------------------------
+// drawList.cpp
+//
+// Description: API-agnostic draw command lists (see drawList.h)
+// ----------------------------------------------------------------------------
+
+#include "drawList.h"
+#include "threadPool.h"
+
+#include <algorithm>
+
+// Bodies per recording task: each costs a call of fill, heavier than a culling test, so chunks are
+// smaller than in frustumCulling.cpp
+const static size_t kMinBodiesPerTask = 1024;
+
+static void recordRange(const std::vector<uint32_t> &bodies, size_t begin, size_t end, const std::function<bool(uint32_t, DrawCommand &)> &fill, std::vector<DrawCommand> &list) {
+  list.clear();
+  list.reserve(end - begin);
+  DrawCommand cmd;
+  for(size_t i = begin; i < end; ++i) {
+    if(fill(bodies[i], cmd))
+      list.push_back(cmd);
+  }
+  std::stable_sort(list.begin(), list.end(), [](const DrawCommand &a, const DrawCommand &b) {
+    return a.shader != b.shader ? a.shader < b.shader : a.mesh < b.mesh; // program switches cost more than mesh switches
+  });
+}
+
+void DrawListRecorder::record(DrawPass pass, const std::vector<uint32_t> &bodies, const std::function<bool(uint32_t, DrawCommand &)> &fill, ThreadPool *pool) {
+  std::vector<std::vector<DrawCommand>> &lists = m_lists[pass];
+  if(!pool || bodies.size() < 2*kMinBodiesPerTask) {
+    lists.resize(1);
+    recordRange(bodies, 0, bodies.size(), fill, lists[0]);
+    return;
+  }
+
+  lists.resize(pool->maxChunks()); // kept across frames so that the lists keep their capacity
+  for(std::vector<DrawCommand> &list : lists)
+    list.clear();
+  pool->parallelFor(bodies.size(), kMinBodiesPerTask, [&](size_t begin, size_t end, size_t chunk) {
+    recordRange(bodies, begin, end, fill, lists[chunk]);
+  });
+}
+
+size_t DrawListRecorder::size(DrawPass pass) const {
+  size_t n = 0;
+  for(const std::vector<DrawCommand> &list : m_lists[pass])
+    n += list.size();
+  return n;
+}
+
+void DrawListRecorder::clear() {
+  for(int p = 0; p < kNumDrawPasses; ++p)
+    for(std::vector<DrawCommand> &list : m_lists[p])
+      list.clear();
+}
@@ -0,0 +1,57 @@
+// ----------------------------------------------------------------------------
+// drawList.h
+//
+// Description: API-agnostic draw command lists, recorded in parallel by the
+//              worker threads and replayed on the OpenGL thread.
+// ----------------------------------------------------------------------------
+
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class ThreadPool;
+
+// Passes are replayed in this order
+enum DrawPass {
+  kDrawPassOccluders = 0, // large bodies, drawn unconditionally
+  kDrawPassOccludees = 1, // small bodies, may be skipped by occlusion queries
+  kNumDrawPasses
+};
+
+// One draw of a body; plain data, so it can be built on any thread without a GL context
+struct DrawCommand {
+  uint32_t shader;     // shader permutation (feature mask) of the draw
+  uint32_t mesh;       // index of the geometry/material to draw
+  uint32_t body;       // index of the body (bounding sphere, occlusion query)
+  glm::mat4 transform; // model matrix
+};
+
+class DrawListRecorder {
+public:
+  // Builds the commands of a pass, one per listed body, by calling fill(body, command) on the pool
+  // threads (or inline without a pool). fill returns false to drop the body. Every thread records
+  // in its own list, sorted by shader then mesh so that consecutive draws share their state.
+  void record(DrawPass pass, const std::vector<uint32_t> &bodies, const std::function<bool(uint32_t, DrawCommand &)> &fill, ThreadPool *pool = nullptr);
+
+  // Calls fn(command) on every command of the pass, list after list in recording order.
+  template<typename F>
+  void replay(DrawPass pass, F fn) const {
+    for(const std::vector<DrawCommand> &list : m_lists[pass])
+      for(const DrawCommand &cmd : list)
+        fn(cmd);
+  }
+
+  size_t size(DrawPass pass) const;
+  void clear();
+
+private:
+  std::vector<std::vector<DrawCommand>> m_lists[kNumDrawPasses]; // per pass, one list per recording chunk
+};
+
+#endif // DRAW_LIST_H
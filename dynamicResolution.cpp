@@ -0,0 +1,127 @@
+// ----------------------------------------------------------------------------
+// dynamicResolution.cpp
+//
+// Description: Dynamic resolution scaling (see dynamicResolution.h)
+// ----------------------------------------------------------------------------
+
+#include "dynamicResolution.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+float ResolutionController::update(float frameTimeMs) {
+  State &s = m_state;
+  s.frameTimeMs = frameTimeMs;
+  s.error = glm::clamp((m_targetMs - frameTimeMs) / m_targetMs, -1.f, 1.f); // a single hitch cannot slam the scale
+
+  // Positional PI around the maximum scale; the integral only accumulates while the output is not
+  // saturated in the direction of the error (anti-windup)
+  const float unclamped = m_maxScale + m_kp * s.error + m_ki * (s.integral + s.error);
+  const bool saturatedHigh = unclamped >= m_maxScale && s.error > 0.f;
+  const bool saturatedLow = unclamped <= m_minScale && s.error < 0.f;
+  if(!saturatedHigh && !saturatedLow)
+    s.integral += s.error;
+
+  s.scale = glm::clamp(m_maxScale + m_kp * s.error + m_ki * s.integral, m_minScale, m_maxScale);
+  return s.scale;
+}
+
+void ResolutionController::reset() {
+  m_state = State();
+  m_state.scale = m_maxScale;
+}
+
+void GpuFrameTimer::init() {
+  glGenQueries(kNumQueries, m_queries);
+  std::fill(m_pending, m_pending + kNumQueries, false);
+  m_next = 0;
+}
+
+void GpuFrameTimer::release() {
+  glDeleteQueries(kNumQueries, m_queries);
+  std::fill(m_queries, m_queries + kNumQueries, 0);
+}
+
+void GpuFrameTimer::begin() {
+  if(m_pending[m_next]) { // the ring is full: this result is too old to be interesting
+    GLuint64 discarded;
+    glGetQueryObjectui64v(m_queries[m_next], GL_QUERY_RESULT, &discarded);
+    m_pending[m_next] = false;
+  }
+  glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+}
+
+void GpuFrameTimer::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+  m_pending[m_next] = true;
+  m_next = (m_next + 1) % kNumQueries;
+}
+
+bool GpuFrameTimer::latestFrameTime(float &ms) {
+  bool found = false;
+  // Oldest to newest, so that the last available result wins
+  for(int k = 0; k < kNumQueries; ++k) {
+    const int i = (m_next + k) % kNumQueries;
+    if(!m_pending[i])
+      continue;
+    GLint available = 0;
+    glGetQueryObjectiv(m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+      break; // queries complete in order
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(m_queries[i], GL_QUERY_RESULT, &ns);
+    m_pending[i] = false;
+    ms = static_cast<float>(ns) * 1e-6f;
+    found = true;
+  }
+  return found;
+}
+
+void ScaledFramebuffer::resize(int width, int height) {
+  width = std::max(width, 1);
+  height = std::max(height, 1);
+  if(m_fbo && width == m_width && height == m_height)
+    return;
+  release();
+  m_width = width;
+  m_height = height;
+
+  glGenRenderbuffers(1, &m_color);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &m_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &m_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ScaledFramebuffer::release() {
+  glDeleteFramebuffers(1, &m_fbo);
+  glDeleteRenderbuffers(1, &m_color);
+  glDeleteRenderbuffers(1, &m_depth);
+  m_fbo = m_color = m_depth = 0;
+  m_width = m_height = 0;
+}
+
+void ScaledFramebuffer::begin(float scale) {
+  m_renderWidth = std::max(1, static_cast<int>(std::lround(m_width * scale)));
+  m_renderHeight = std::max(1, static_cast<int>(std::lround(m_height * scale)));
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glViewport(0, 0, m_renderWidth, m_renderHeight);
+}
+
+void ScaledFramebuffer::resolve() {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, m_renderWidth, m_renderHeight, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, m_width, m_height);
+}
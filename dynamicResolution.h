@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------------
+// dynamicResolution.h
+//
+// Description: Dynamic resolution scaling: the scene is rendered in an offscreen
+//              framebuffer whose resolution is driven by a PI controller on the
+//              frame time, then upscaled to the window.
+// ----------------------------------------------------------------------------
+
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+// Proportional-integral controller turning the measured frame time into a resolution scale
+class ResolutionController {
+public:
+  struct State {
+    float frameTimeMs = 0.f; // last measured frame time
+    float error = 0.f;       // (target - measured) / target, positive when there is headroom
+    float integral = 0.f;    // accumulated error
+    float scale = 1.f;       // chosen scale of each side of the render target, in [minScale, maxScale]
+  };
+
+  inline void setTargetFrameTime(float ms) { m_targetMs = ms; }
+  inline float getTargetFrameTime() const { return m_targetMs; }
+  inline void setGains(float kp, float ki) { m_kp = kp; m_ki = ki; }
+  inline void setScaleRange(float minScale, float maxScale) { m_minScale = minScale; m_maxScale = maxScale; }
+  inline const State &getState() const { return m_state; }
+  inline float getScale() const { return m_state.scale; }
+
+  // Feeds one frame time measurement and returns the new scale.
+  float update(float frameTimeMs);
+  void reset();
+
+private:
+  float m_targetMs = 1000.f / 60.f;
+  float m_kp = 0.15f;
+  float m_ki = 0.05f;
+  float m_minScale = 0.35f;
+  float m_maxScale = 1.f;
+  State m_state;
+};
+
+// GPU duration of whole frames, read back a few frames late so that the CPU never waits
+class GpuFrameTimer {
+public:
+  void init();
+  void release();
+  void begin();
+  void end();
+  // Most recent available frame duration; false while no measurement is ready.
+  bool latestFrameTime(float &ms);
+
+private:
+  const static int kNumQueries = 4;
+  GLuint m_queries[kNumQueries] = {0};
+  bool m_pending[kNumQueries] = {false};
+  int m_next = 0;
+};
+
+// Offscreen color + depth target allocated at the output size and rendered at a fraction of it
+class ScaledFramebuffer {
+public:
+  void resize(int width, int height); // output (window framebuffer) size
+  void release();
+
+  // Binds the framebuffer and sets the viewport to the scaled region.
+  void begin(float scale);
+  // Upscales the rendered region to the default framebuffer with a linear filter.
+  void resolve();
+
+  inline int getRenderWidth() const { return m_renderWidth; }
+  inline int getRenderHeight() const { return m_renderHeight; }
+  inline GLuint getFramebuffer() const { return m_fbo; }
+
+private:
+  GLuint m_fbo = 0;
+  GLuint m_color = 0;
+  GLuint m_depth = 0;
+  int m_width = 0;
+  int m_height = 0;
+  int m_renderWidth = 0;
+  int m_renderHeight = 0;
+};
+
+#endif // DYNAMIC_RESOLUTION_H
@@ -0,0 +1,42 @@
+// ----------------------------------------------------------------------------
+// fileUtils.cpp
+//
+// Description: File helpers shared by the on-disk caches (see fileUtils.h)
+// ----------------------------------------------------------------------------
+
+#include "fileUtils.h"
+
+#include <atomic>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#define processId() _getpid()
+#else
+#include <unistd.h>
+#define processId() getpid()
+#endif
+
+std::string temporaryPath(const std::string &path) {
+  static std::atomic<unsigned long long> s_count{0};
+  return path + ".tmp" + std::to_string(static_cast<long long>(processId())) + "-" + std::to_string(s_count++);
+}
+
+bool isNewerThan(const std::string &path, const std::string &reference) {
+  struct stat pathStat, referenceStat;
+  return stat(path.c_str(), &pathStat) == 0 && stat(reference.c_str(), &referenceStat) == 0 && pathStat.st_mtime >= referenceStat.st_mtime;
+}
+
+bool replaceFile(const std::string &temporary, const std::string &path) {
+#if defined(_WIN32)
+  // rename fails on Windows when path exists
+  return MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,32 @@
+// ----------------------------------------------------------------------------
+// fileUtils.h
+//
+// Description: File helpers shared by the on-disk caches (program binaries,
+//              compressed textures, decoded images, tile pyramids): entries
+//              are written to a temporary file and moved over the old one.
+// ----------------------------------------------------------------------------
+
+#ifndef FILE_UTILS_H
+#define FILE_UTILS_H
+
+#include <cstddef>
+#include <string>
+
+// Offset rounded up to a multiple of alignment, for the aligned sections of the cache files
+inline size_t alignUp(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Whether path exists and was modified no earlier than reference: a derived file (cache entry, tile
+// pyramid) is only used while it is newer than its source
+bool isNewerThan(const std::string &path, const std::string &reference);
+
+// Name next to path for a temporary file of its own: unique across the threads and the processes
+// writing the same entry
+std::string temporaryPath(const std::string &path);
+
+// Moves temporary over path in one step, replacing any file there: readers see either the old file
+// or the new one, never none. Returns false (temporary left in place) on failure.
+bool replaceFile(const std::string &temporary, const std::string &path);
+
+#endif // FILE_UTILS_H
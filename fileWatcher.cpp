@@ -0,0 +1,131 @@
+// ----------------------------------------------------------------------------
+// fileWatcher.cpp
+//
+// Description: Background file watcher (see fileWatcher.h)
+// ----------------------------------------------------------------------------
+
+#include "fileWatcher.h"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// How often the thread checks for stop() (and, without inotify, for new modification times)
+const static int kWatchPeriodMs = 200;
+
+#if defined(__linux__)
+static std::string directoryOf(const std::string &path) {
+  const size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+static std::string fileNameOf(const std::string &path) {
+  const size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+#else
+static long long modificationTime(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? static_cast<long long>(info.st_mtime) : -1;
+}
+#endif
+
+FileWatcher::~FileWatcher() {
+  stop();
+}
+
+void FileWatcher::addFile(const std::string &path) {
+  m_files.push_back(path);
+}
+
+bool FileWatcher::start() {
+  stop();
+  m_stop = false;
+#if defined(__linux__)
+  // Directories are watched rather than the files: editors often save by writing a new file and
+  // renaming it over the old one, which would end a watch on the file itself
+  m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(m_inotify < 0) {
+    std::cerr << "ERROR: inotify unavailable, shaders will not be reloaded" << std::endl;
+    return false;
+  }
+  std::set<std::string> directories;
+  for(const std::string &file : m_files)
+    directories.insert(directoryOf(file));
+  for(const std::string &directory : directories) {
+    if(inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+      std::cerr << "ERROR: cannot watch " << directory << std::endl;
+  }
+#endif
+  m_thread = std::thread(&FileWatcher::watchLoop, this);
+  return true;
+}
+
+void FileWatcher::stop() {
+  if(!m_thread.joinable())
+    return;
+  m_stop = true;
+  m_thread.join();
+#if defined(__linux__)
+  close(m_inotify);
+  m_inotify = -1;
+#endif
+}
+
+bool FileWatcher::takeChanged(std::vector<std::string> &changed) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  changed.assign(m_changed.begin(), m_changed.end());
+  m_changed.clear();
+  return !changed.empty();
+}
+
+void FileWatcher::notifyChanged(const std::string &path) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_changed.insert(path);
+}
+
+void FileWatcher::watchLoop() {
+#if defined(__linux__)
+  alignas(struct inotify_event) char buffer[4096];
+  while(!m_stop) {
+    pollfd fd = {m_inotify, POLLIN, 0};
+    if(poll(&fd, 1, kWatchPeriodMs) <= 0)
+      continue;
+    ssize_t length;
+    while((length = read(m_inotify, buffer, sizeof(buffer))) > 0) {
+      for(char *p = buffer; p < buffer + length; ) {
+        const inotify_event *event = reinterpret_cast<const inotify_event *>(p);
+        p += sizeof(inotify_event) + event->len;
+        if(event->len == 0)
+          continue;
+        for(const std::string &file : m_files) { // the names of a few shader files: a linear scan is enough
+          if(fileNameOf(file) == event->name)
+            notifyChanged(file);
+        }
+      }
+    }
+  }
+#else
+  std::map<std::string, long long> times;
+  for(const std::string &file : m_files)
+    times[file] = modificationTime(file);
+  while(!m_stop) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kWatchPeriodMs));
+    for(const std::string &file : m_files) {
+      const long long time = modificationTime(file);
+      if(time != times[file]) {
+        times[file] = time;
+        notifyChanged(file);
+      }
+    }
+  }
+#endif
+}
@@ -0,0 +1,44 @@
+// ----------------------------------------------------------------------------
+// fileWatcher.h
+//
+// Description: Background thread reporting modified files: inotify on Linux,
+//              modification time polling elsewhere.
+// ----------------------------------------------------------------------------
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FileWatcher {
+public:
+  ~FileWatcher();
+
+  // Files to watch, given as paths relative to the working directory or absolute; call before start.
+  void addFile(const std::string &path);
+
+  bool start();
+  void stop();
+  inline bool isRunning() const { return m_thread.joinable(); }
+
+  // Moves the files modified since the last call into changed; returns false if there are none.
+  bool takeChanged(std::vector<std::string> &changed);
+
+private:
+  void watchLoop();
+  void notifyChanged(const std::string &path);
+
+  std::vector<std::string> m_files;
+  std::thread m_thread;
+  std::atomic<bool> m_stop{false};
+  std::mutex m_mutex;
+  std::set<std::string> m_changed; // a file saved twice before being taken is reported once
+  int m_inotify = -1;
+};
+
+#endif // FILE_WATCHER_H
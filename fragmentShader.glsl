@@ -1,29 +1,60 @@
 #version 330 core	     // Minimal GL version support expected from the GPU
+// Permutations (#define injected by the application): TEXTURED, TEXTURE_ARRAY, VIRTUAL_TEXTURE, EMISSIVE
 
 struct Material {
 	sampler2D albedoTex;
+	sampler2DArray albedoArray; // all albedo maps, one layer per body
+	int albedoLayer;
 };
 
 uniform Material material;
-uniform int texture;
 uniform vec3 camPos;
 uniform vec3 ambient;
 uniform vec3 lightning;
 
+#ifdef VIRTUAL_TEXTURE // see virtualTexture.h
+uniform sampler2D vtPhysical;     // cache of tiles with their border
+uniform usampler2D vtIndirection; // per tile and level: page x, page y, level of the closest resident tile
+uniform vec2 vtTiles;             // tiles of the finest level
+uniform float vtTileSize;
+uniform float vtBorder;
+uniform float vtPhysicalScale;    // 1 / side of the cache in texels
+uniform int vtMaxLevel;
+
+vec3 sampleVirtualTexture(vec2 uv) {
+	vec2 texel = uv * vtTiles * vtTileSize;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	int level = clamp(int(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + 0.5)), 0, vtMaxLevel);
+	ivec2 tiles = ivec2(vtTiles) >> level;
+	uvec4 entry = texelFetch(vtIndirection, clamp(ivec2(uv * vec2(tiles)), ivec2(0), tiles - 1), level);
+
+	vec2 residentTiles = vec2(ivec2(vtTiles) >> int(entry.b));
+	vec2 tile = clamp(floor(uv * residentTiles), vec2(0.0), residentTiles - 1.0);
+	vec2 inTile = uv * residentTiles - tile;
+	vec2 page = vec2(entry.rg) * (vtTileSize + 2.0 * vtBorder);
+	return textureLod(vtPhysical, (page + vtBorder + inTile * vtTileSize) * vtPhysicalScale, 0.0).rgb;
+}
+#endif
+
 in vec3 fPosition;
 in vec3 fNormal;
 in vec2 fTexCoord;
 out vec4 color;	  // Shader output: the color response attached to this fragment
 
 void main() {
-	vec3 usedColor;
-	if (texture == 1) { // If the buffer send 1, then the shader applies a texture. If not, it uses a basic color.
-		usedColor = texture(material.albedoTex, fTexCoord).rgb;
-	} else {
-		usedColor = vec3(ambient);
-	}
-	
-	
+#if defined(VIRTUAL_TEXTURE) // The texture is streamed in tiles.
+	vec3 usedColor = sampleVirtualTexture(fTexCoord);
+#elif defined(TEXTURE_ARRAY) // The texture is a layer of the texture array.
+	vec3 usedColor = texture(material.albedoArray, vec3(fTexCoord, material.albedoLayer)).rgb;
+#elif defined(TEXTURED) // The shader applies a texture. If not, it uses a basic color.
+	vec3 usedColor = texture(material.albedoTex, fTexCoord).rgb;
+#else
+	vec3 usedColor = vec3(ambient);
+#endif
+
+#ifdef EMISSIVE // Light sources are not lit
+	color = vec4(usedColor, 1.0);
+#else
 	vec3 n = normalize(fNormal);
 	vec3 l = normalize(lightning - fPosition);
 
@@ -33,4 +64,5 @@ void main() {
 	vec3 specular = 0.5 * pow(max(0, dot(v, r)), 0.8) * usedColor;
 
 	color = vec4(usedColor + diffuse + specular, 1.0); // build an RGBA from an RGB
+#endif
 }
@@ -0,0 +1,56 @@
+// ----------------------------------------------------------------------------
+// framePacer.cpp
+//
+// Description: Frame pacing (see framePacer.h)
+// ----------------------------------------------------------------------------
+
+#include "framePacer.h"
+
+#include <cmath>
+#include <thread>
+
+FramePacer::FramePacer() : m_lastActivity(Clock::now()), m_nextFrame(Clock::now()) {
+}
+
+bool FramePacer::isIdle() const {
+  return m_paused && std::chrono::duration<double>(Clock::now() - m_lastActivity).count() >= m_idleDelay;
+}
+
+void FramePacer::waitForNextFrame() {
+  if(m_targetFps <= 0.)
+    return;
+  const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_targetFps));
+  const Clock::time_point now = Clock::now();
+
+  // Frames are due on a fixed grid, so that the rate does not drift; after a long hitch the grid is
+  // restarted rather than rendering a burst of frames to catch up
+  m_nextFrame += period;
+  if(m_nextFrame < now - period)
+    m_nextFrame = now;
+  preciseSleepUntil(m_nextFrame);
+}
+
+void FramePacer::preciseSleepUntil(Clock::time_point deadline) {
+  // Sleep in 1 ms steps while the remaining time is safely above the observed sleep duration...
+  for(;;) {
+    const double remaining = std::chrono::duration<double>(deadline - Clock::now()).count();
+    const double sleepBound = m_sleepMean + 2. * std::sqrt(m_sleepVariance);
+    if(remaining <= sleepBound)
+      break;
+    const Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const double observed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Exact running statistics for the first samples, then an exponentially weighted window so
+    // that the estimate follows changes of the system load
+    if(m_sleepCount < 256)
+      ++m_sleepCount;
+    const double alpha = 1. / m_sleepCount;
+    const double delta = observed - m_sleepMean;
+    m_sleepMean += alpha * delta;
+    m_sleepVariance = (1. - alpha) * (m_sleepVariance + alpha * delta * delta);
+  }
+  // ...then spin for the last fraction of a millisecond
+  while(Clock::now() < deadline)
+    std::this_thread::yield();
+}
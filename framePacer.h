@@ -0,0 +1,54 @@
+// ----------------------------------------------------------------------------
+// framePacer.h
+//
+// Description: Frame pacing: optional frame rate cap with a precise
+//              sleep-then-spin wait, and an idle rate used while the simulation
+//              is paused and the user does nothing.
+// ----------------------------------------------------------------------------
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <chrono>
+
+class FramePacer {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  FramePacer();
+
+  inline void setTargetFps(double fps) { m_targetFps = fps; } // 0 disables the cap
+  inline double getTargetFps() const { return m_targetFps; }
+  inline void setIdleFps(double fps) { m_idleFps = fps; }
+  inline void setIdleDelay(double seconds) { m_idleDelay = seconds; }
+  inline void setPaused(bool paused) { m_paused = paused; notifyActivity(); }
+
+  // Any input or state change that must be displayed promptly leaves the idle mode.
+  inline void notifyActivity() { m_lastActivity = Clock::now(); }
+
+  // True once the simulation has been paused without any activity for the idle delay.
+  bool isIdle() const;
+
+  // Time to wait for events before the next idle frame, in seconds (meant for glfwWaitEventsTimeout).
+  inline double getIdleFrameTime() const { return 1.0 / m_idleFps; }
+
+  // Blocks until the next frame of the capped rate is due; returns immediately without a cap.
+  void waitForNextFrame();
+
+private:
+  void preciseSleepUntil(Clock::time_point deadline);
+
+  double m_targetFps = 0.;
+  double m_idleFps = 4.;
+  double m_idleDelay = 2.;
+  bool m_paused = false;
+  Clock::time_point m_lastActivity;
+  Clock::time_point m_nextFrame;
+
+  // Running mean and variance of how long sleep_for(1 ms) really takes, to know when to spin
+  double m_sleepMean = 1e-3;
+  double m_sleepVariance = 0.25e-6; // (0.5 ms)^2 until measured
+  long m_sleepCount = 1;
+};
+
+#endif // FRAME_PACER_H
@@ -0,0 +1,154 @@
+// ----------------------------------------------------------------------------
+// frustumCulling.cpp
+//
+// Description: View-frustum culling of body bounding spheres (see frustumCulling.h)
+// ----------------------------------------------------------------------------
+
+#include "frustumCulling.h"
+#include "threadPool.h"
+
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_USE_SSE
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline unsigned int countTrailingZeros(unsigned int v) { unsigned long i; _BitScanForward(&i, v); return i; }
+#else
+static inline unsigned int countTrailingZeros(unsigned int v) { return __builtin_ctz(v); }
+#endif
+
+// Spheres per task: a sphere costs six plane distances, so a chunk must be large for its task
+// to outweigh the dispatch and the packing of the slices
+const static size_t kMinSpheresPerTask = 16384;
+
+Frustum extractFrustum(const glm::mat4 &viewProj) {
+  // glm is column-major: row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+  const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+  const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+  const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+  const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+  Frustum f;
+  f.planes[0] = row3 + row0; // left
+  f.planes[1] = row3 - row0; // right
+  f.planes[2] = row3 + row1; // bottom
+  f.planes[3] = row3 - row1; // top
+  f.planes[4] = row3 + row2; // near (OpenGL clip space: -w <= z)
+  f.planes[5] = row3 - row2; // far
+  for(int i = 0; i < 6; ++i)
+    f.planes[i] /= glm::length(glm::vec3(f.planes[i])); // normalize so that the distance to the plane is metric
+  return f;
+}
+
+void BoundingSphereSoA::resize(size_t n) {
+  m_x.resize(n);
+  m_y.resize(n);
+  m_z.resize(n);
+  m_r.resize(n);
+}
+
+void BoundingSphereSoA::push_back(const glm::vec3 &center, float radius) {
+  m_x.push_back(center.x);
+  m_y.push_back(center.y);
+  m_z.push_back(center.z);
+  m_r.push_back(radius);
+}
+
+static inline bool sphereVisible(const Frustum &frustum, float x, float y, float z, float r) {
+  for(int p = 0; p < 6; ++p) {
+    const glm::vec4 &pl = frustum.planes[p];
+    if(pl.x*x + pl.y*y + pl.z*z + pl.w < -r)
+      return false;
+  }
+  return true;
+}
+
+size_t cullSpheres(const Frustum &frustum, const BoundingSphereSoA &spheres, size_t begin, size_t end, uint32_t *outIndices) {
+  const float *xs = spheres.x(), *ys = spheres.y(), *zs = spheres.z(), *rs = spheres.r();
+  size_t count = 0;
+  size_t i = begin;
+
+#if defined(__AVX__)
+  __m256 pa[6], pb[6], pc[6], pd[6];
+  for(int p = 0; p < 6; ++p) {
+    pa[p] = _mm256_set1_ps(frustum.planes[p].x);
+    pb[p] = _mm256_set1_ps(frustum.planes[p].y);
+    pc[p] = _mm256_set1_ps(frustum.planes[p].z);
+    pd[p] = _mm256_set1_ps(frustum.planes[p].w);
+  }
+  for(; i + 8 <= end; i += 8) {
+    const __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i), z = _mm256_loadu_ps(zs + i);
+    const __m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(rs + i));
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for(int p = 0; p < 6; ++p) {
+      const __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pa[p], x), _mm256_mul_ps(pb[p], y)),
+                                     _mm256_add_ps(_mm256_mul_ps(pc[p], z), pd[p]));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+    }
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(inside));
+    while(mask) {
+      outIndices[count++] = static_cast<uint32_t>(i + countTrailingZeros(mask));
+      mask &= mask - 1;
+    }
+  }
+#elif defined(FRUSTUM_USE_SSE)
+  __m128 pa[6], pb[6], pc[6], pd[6];
+  for(int p = 0; p < 6; ++p) {
+    pa[p] = _mm_set1_ps(frustum.planes[p].x);
+    pb[p] = _mm_set1_ps(frustum.planes[p].y);
+    pc[p] = _mm_set1_ps(frustum.planes[p].z);
+    pd[p] = _mm_set1_ps(frustum.planes[p].w);
+  }
+  for(; i + 4 <= end; i += 4) {
+    const __m128 x = _mm_loadu_ps(xs + i), y = _mm_loadu_ps(ys + i), z = _mm_loadu_ps(zs + i);
+    const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rs + i));
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for(int p = 0; p < 6; ++p) {
+      const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], x), _mm_mul_ps(pb[p], y)),
+                                  _mm_add_ps(_mm_mul_ps(pc[p], z), pd[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+    }
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_ps(inside));
+    while(mask) {
+      outIndices[count++] = static_cast<uint32_t>(i + countTrailingZeros(mask));
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for(; i < end; ++i) { // remainder (or everything without SIMD)
+    if(sphereVisible(frustum, xs[i], ys[i], zs[i], rs[i]))
+      outIndices[count++] = static_cast<uint32_t>(i);
+  }
+  return count;
+}
+
+void cullSpheres(const Frustum &frustum, const BoundingSphereSoA &spheres, std::vector<uint32_t> &visible, ThreadPool *pool) {
+  const size_t n = spheres.size();
+  visible.resize(n);
+  if(!pool || n < 2*kMinSpheresPerTask) {
+    visible.resize(cullSpheres(frustum, spheres, 0, n, visible.data()));
+    return;
+  }
+
+  // Each chunk compacts in place into its own slice of the output, then slices are packed in order
+  std::vector<size_t> chunkBegin(pool->maxChunks(), 0), chunkCount(pool->maxChunks(), 0);
+  pool->parallelFor(n, kMinSpheresPerTask, [&](size_t begin, size_t end, size_t chunk) {
+    chunkBegin[chunk] = begin;
+    chunkCount[chunk] = cullSpheres(frustum, spheres, begin, end, visible.data() + begin);
+  });
+
+  size_t total = 0;
+  for(size_t c = 0; c < chunkCount.size(); ++c) {
+    if(chunkCount[c] && chunkBegin[c] != total)
+      std::memmove(visible.data() + total, visible.data() + chunkBegin[c], chunkCount[c]*sizeof(uint32_t));
+    total += chunkCount[c];
+  }
+  visible.resize(total);
+}
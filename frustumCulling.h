@@ -0,0 +1,59 @@
+// ----------------------------------------------------------------------------
+// frustumCulling.h
+//
+// Description: View-frustum culling of body bounding spheres, vectorized with
+//              SSE (4 spheres per iteration) or AVX (8 spheres) when available.
+// ----------------------------------------------------------------------------
+
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Six planes (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside; normals are unit length
+struct Frustum {
+  glm::vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+// Extracts the world-space frustum planes from a view*proj matrix (Gribb & Hartmann).
+Frustum extractFrustum(const glm::mat4 &viewProj);
+
+// World-space bounding spheres stored as structure-of-arrays, for SIMD culling
+class BoundingSphereSoA {
+public:
+  void resize(size_t n);
+  inline void clear() { resize(0); }
+  inline size_t size() const { return m_x.size(); }
+
+  inline void set(size_t i, const glm::vec3 &center, float radius) {
+    m_x[i] = center.x;
+    m_y[i] = center.y;
+    m_z[i] = center.z;
+    m_r[i] = radius;
+  }
+  void push_back(const glm::vec3 &center, float radius);
+
+  inline const float *x() const { return m_x.data(); }
+  inline const float *y() const { return m_y.data(); }
+  inline const float *z() const { return m_z.data(); }
+  inline const float *r() const { return m_r.data(); }
+
+private:
+  std::vector<float> m_x, m_y, m_z, m_r;
+};
+
+// Tests spheres [begin, end) against the frustum and writes the indices of the (at least
+// partially) visible ones to outIndices, which must hold end-begin entries. Returns the count.
+size_t cullSpheres(const Frustum &frustum, const BoundingSphereSoA &spheres, size_t begin, size_t end, uint32_t *outIndices);
+
+// Culls every sphere into a compact, increasing list of visible indices. With a pool, the
+// spheres are split across its threads and the per-thread lists concatenated in order.
+void cullSpheres(const Frustum &frustum, const BoundingSphereSoA &spheres, std::vector<uint32_t> &visible, ThreadPool *pool = nullptr);
+
+#endif // FRUSTUM_CULLING_H
@@ -0,0 +1,202 @@
+// ----------------------------------------------------------------------------
+// gpuNBody.cpp
+//
+// Description: Direct-sum N-body gravity on the GPU (see gpuNBody.h)
+// ----------------------------------------------------------------------------
+
+#include "gpuNBody.h"
+
+#include <algorithm>
+
+// Not part of the GL 3.3 core profile generated by glad
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_COMPUTE_WORK_GROUP_SIZE 0x8267
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+
+bool GpuNBody::init(GLuint computeProgram, GLADloadproc loader) {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if(major < 4 || (major == 4 && minor < 3))
+    return false;
+  m_dispatchCompute = reinterpret_cast<DispatchComputeProc>(loader("glDispatchCompute"));
+  m_memoryBarrier = reinterpret_cast<MemoryBarrierProc>(loader("glMemoryBarrier"));
+  if(!m_dispatchCompute || !m_memoryBarrier || !setProgram(computeProgram))
+    return false;
+
+  glGenBuffers(2, m_positions);
+  glGenBuffers(1, &m_velocities);
+  glGenBuffers(1, &m_sizes);
+  for(Readback &readback : m_readbacks)
+    glGenBuffers(1, &readback.buffer);
+  return true;
+}
+
+bool GpuNBody::setProgram(GLuint computeProgram) {
+  GLint groupSize[3] = {0, 0, 0};
+  glGetProgramiv(computeProgram, GL_COMPUTE_WORK_GROUP_SIZE, groupSize);
+  if(glGetError() != GL_NO_ERROR || groupSize[0] <= 0)
+    return false;
+  m_groupSize = static_cast<GLuint>(groupSize[0]);
+  m_program = computeProgram;
+  m_countLocation = glGetUniformLocation(m_program, "bodyCount");
+  m_kickLocation = glGetUniformLocation(m_program, "kick");
+  m_driftLocation = glGetUniformLocation(m_program, "drift");
+  m_gravityLocation = glGetUniformLocation(m_program, "gravity");
+  m_softeningLocation = glGetUniformLocation(m_program, "softening2");
+  return true;
+}
+
+void GpuNBody::release() {
+  if(!m_program)
+    return;
+  for(Readback &readback : m_readbacks) {
+    if(readback.fence)
+      glDeleteSync(readback.fence);
+    glDeleteBuffers(1, &readback.buffer);
+    readback = Readback();
+  }
+  for(const PendingQuery &pending : m_pendingQueries) {
+    m_freeQueries.push_back(pending.start);
+    m_freeQueries.push_back(pending.end);
+  }
+  m_pendingQueries.clear();
+  if(!m_freeQueries.empty())
+    glDeleteQueries(static_cast<GLsizei>(m_freeQueries.size()), m_freeQueries.data());
+  m_freeQueries.clear();
+  glDeleteBuffers(2, m_positions);
+  glDeleteBuffers(1, &m_velocities);
+  glDeleteBuffers(1, &m_sizes);
+  m_positions[0] = m_positions[1] = m_velocities = m_sizes = 0;
+  m_program = 0; // owned by the caller
+  m_count = 0;
+}
+
+void GpuNBody::setBodies(const std::vector<glm::vec4> &positionMass, const std::vector<glm::vec3> &velocities, const std::vector<float> &sizes) {
+  m_count = positionMass.size();
+  std::vector<glm::vec4> paddedVelocities(m_count, glm::vec4(0.f)); // std430 aligns vec3 arrays to 16 bytes
+  for(size_t i = 0; i < m_count; ++i)
+    paddedVelocities[i] = glm::vec4(velocities[i], 0.f);
+
+  const GLsizeiptr bytes = static_cast<GLsizeiptr>(m_count * sizeof(glm::vec4));
+  for(int i = 0; i < 2; ++i) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_positions[i]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, positionMass.data(), GL_DYNAMIC_COPY); // both, so that the previous state is valid too
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_velocities);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, paddedVelocities.data(), GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sizes);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(m_count * sizeof(float)), sizes.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  m_current = 0;
+  m_lastDt = 0.f;
+}
+
+GLuint GpuNBody::newQuery() {
+  GLuint query;
+  if(m_freeQueries.empty()) {
+    glGenQueries(1, &query);
+  } else {
+    query = m_freeQueries.back();
+    m_freeQueries.pop_back();
+  }
+  return query;
+}
+
+void GpuNBody::step(float dt) {
+  if(!m_program || m_count == 0)
+    return;
+  const GLuint start = newQuery(), end = newQuery();
+  glQueryCounter(start, GL_TIMESTAMP);
+
+  glUseProgram(m_program);
+  glUniform1ui(m_countLocation, static_cast<GLuint>(m_count));
+  glUniform1f(m_kickLocation, 0.5f * (m_lastDt + dt)); // from the middle of the last step to the middle of this one
+  glUniform1f(m_driftLocation, dt);
+  glUniform1f(m_gravityLocation, m_g);
+  glUniform1f(m_softeningLocation, m_softening * m_softening);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_positions[m_current]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_positions[1 - m_current]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_velocities);
+  m_dispatchCompute(static_cast<GLuint>((m_count + m_groupSize - 1) / m_groupSize), 1, 1);
+  m_memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); // for the next step and the draw
+  glQueryCounter(end, GL_TIMESTAMP);
+
+  m_pendingQueries.push_back({start, end, static_cast<uint64_t>(m_count) * m_count});
+  m_current = 1 - m_current;
+  m_lastDt = dt;
+  ++m_steps;
+}
+
+void GpuNBody::bindForDraw(GLuint previousBinding, GLuint currentBinding, GLuint sizeBinding) const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, previousBinding, m_positions[1 - m_current]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, currentBinding, m_positions[m_current]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, sizeBinding, m_sizes);
+}
+
+void GpuNBody::requestReadback(size_t count) {
+  count = std::min(count, m_count);
+  Readback &readback = m_readbacks[m_nextReadback];
+  if(!m_program || count == 0 || readback.fence) // the older copy has not completed: skip this one
+    return;
+  const GLsizeiptr bytes = static_cast<GLsizeiptr>(count * sizeof(glm::vec4));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+  if(readback.count != count)
+    glBufferData(GL_COPY_WRITE_BUFFER, 2 * bytes, nullptr, GL_STREAM_READ);
+  m_memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, m_positions[1 - m_current]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytes);
+  glBindBuffer(GL_COPY_READ_BUFFER, m_positions[m_current]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, bytes, bytes);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  readback.count = count;
+  m_nextReadback = 1 - m_nextReadback;
+}
+
+bool GpuNBody::takeReadback(std::vector<glm::vec4> &previous, std::vector<glm::vec4> &current) {
+  // The newer copy first: if it completed, the older one did too
+  bool taken = false;
+  for(int age = 0; age < 2; ++age) {
+    Readback &readback = m_readbacks[(m_nextReadback + 1 + age) % 2];
+    if(!readback.fence)
+      continue;
+    if(glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+      continue;
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+    if(taken)
+      continue; // older than the one already taken
+    previous.resize(readback.count);
+    current.resize(readback.count);
+    const GLsizeiptr bytes = static_cast<GLsizeiptr>(readback.count * sizeof(glm::vec4));
+    glBindBuffer(GL_COPY_READ_BUFFER, readback.buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, previous.data());
+    glGetBufferSubData(GL_COPY_READ_BUFFER, bytes, bytes, current.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    taken = true;
+  }
+  return taken;
+}
+
+double GpuNBody::getTotalGpuMs() {
+  while(!m_pendingQueries.empty()) {
+    const PendingQuery &pending = m_pendingQueries.front();
+    GLint available = 0;
+    glGetQueryObjectiv(pending.end, GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+      break;
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(pending.start, GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(pending.end, GL_QUERY_RESULT, &end);
+    m_gpuMs += (end - start) * 1e-6;
+    m_timedInteractions += pending.interactions;
+    ++m_timedSteps;
+    m_freeQueries.push_back(pending.start);
+    m_freeQueries.push_back(pending.end);
+    m_pendingQueries.pop_front();
+  }
+  return m_gpuMs;
+}
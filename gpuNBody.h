@@ -0,0 +1,106 @@
+// ----------------------------------------------------------------------------
+// gpuNBody.h
+//
+// Description: Direct-sum N-body gravity on the GPU (GL 4.3 compute shaders).
+//              Positions and velocities live in shader storage buffers; each
+//              work group stages tiles of bodies in shared memory and sums
+//              every pair, then kicks and drifts its bodies (leapfrog). The
+//              positions are ping-ponged so that the last two states stay
+//              bound for the instanced draw, which reads them in place.
+// ----------------------------------------------------------------------------
+
+#ifndef GPU_NBODY_H
+#define GPU_NBODY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9 // not part of the GL 3.3 core profile generated by glad
+#endif
+
+class GpuNBody {
+public:
+  // Loads the GL 4.2/4.3 entry points through loader (the 3.3 glad loader lacks them). Returns false
+  // if the context is older than 4.3; computeProgram is the linked nbodyComputeShader.glsl.
+  bool init(GLuint computeProgram, GLADloadproc loader);
+  // Switches to another linked nbodyComputeShader.glsl (e.g. edited); false if it is not a compute
+  // program, the current one staying in use. The caller owns both programs.
+  bool setProgram(GLuint computeProgram);
+  void release();
+  inline bool isValid() const { return m_program != 0; }
+
+  // Uploads the bodies: positions with the mass in w, velocities, and sizes for the draw
+  void setBodies(const std::vector<glm::vec4> &positionMass, const std::vector<glm::vec3> &velocities, const std::vector<float> &sizes);
+  inline size_t size() const { return m_count; }
+  inline void setGravitationalConstant(float g) { m_g = g; }
+  inline void setSoftening(float epsilon) { m_softening = epsilon; }
+
+  // Queues a step of dt. Velocities are kept half a step ahead of the positions (leapfrog), the
+  // first kick being a half one; dt may change between steps.
+  void step(float dt);
+
+  // Binds the positions before and after the last step, and the sizes, to the given SSBO bindings
+  void bindForDraw(GLuint previousBinding, GLuint currentBinding, GLuint sizeBinding) const;
+
+  // Queues a copy of the positions (before and after the last step) of the first count bodies,
+  // readable once the GPU gets there
+  void requestReadback(size_t count);
+  // Gets the latest completed copy, without waiting. Returns false if none completed since the last call.
+  bool takeReadback(std::vector<glm::vec4> &previous, std::vector<glm::vec4> &current);
+
+  // Statistics: steps dispatched, and GPU time and pair interactions of the steps timed so far
+  inline uint64_t getSteps() const { return m_steps; }
+  double getTotalGpuMs();
+  inline uint64_t getTimedInteractions() const { return m_timedInteractions; }
+  inline uint64_t getTimedSteps() const { return m_timedSteps; }
+
+private:
+  typedef void (APIENTRYP DispatchComputeProc)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+  typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+  struct Readback {
+    GLuint buffer = 0;
+    GLsync fence = nullptr;
+    size_t count = 0;
+  };
+  struct PendingQuery {
+    GLuint start, end; // timestamps: time elapsed queries would nest in the frame timer's
+    uint64_t interactions;
+  };
+
+  GLuint newQuery();
+
+  DispatchComputeProc m_dispatchCompute = nullptr;
+  MemoryBarrierProc m_memoryBarrier = nullptr;
+
+  GLuint m_program = 0;
+  GLint m_countLocation = -1, m_kickLocation = -1, m_driftLocation = -1, m_gravityLocation = -1, m_softeningLocation = -1;
+  GLuint m_groupSize = 0;
+
+  GLuint m_positions[2] = {0, 0}; // ping-pong: m_current holds the latest positions
+  GLuint m_velocities = 0;
+  GLuint m_sizes = 0;
+  int m_current = 0;
+  size_t m_count = 0;
+  float m_g = 1.f;
+  float m_softening = 0.01f;
+  float m_lastDt = 0.f; // 0 until the first step
+
+  Readback m_readbacks[2];
+  int m_nextReadback = 0;
+
+  std::vector<GLuint> m_freeQueries;
+  std::deque<PendingQuery> m_pendingQueries;
+  uint64_t m_steps = 0;
+  double m_gpuMs = 0.;
+  uint64_t m_timedInteractions = 0;
+  uint64_t m_timedSteps = 0;
+};
+
+#endif // GPU_NBODY_H
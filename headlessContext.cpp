@@ -0,0 +1,171 @@
+// ----------------------------------------------------------------------------
+// headlessContext.cpp
+//
+// Description: OpenGL context without window nor display server (see
+//              headlessContext.h)
+// ----------------------------------------------------------------------------
+
+#include "headlessContext.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+
+// The few EGL types and constants used, from EGL/egl.h and EGL/eglext.h
+typedef int32_t EGLint;
+typedef unsigned int EGLBoolean;
+typedef unsigned int EGLenum;
+typedef void *EGLDisplay;
+typedef void *EGLConfig;
+typedef void *EGLContext;
+typedef void *EGLSurface;
+typedef void *EGLDeviceEXT;
+
+#define EGL_FALSE 0
+#define EGL_NONE 0x3038
+#define EGL_EXTENSIONS 0x3055
+#define EGL_SURFACE_TYPE 0x3033
+#define EGL_RENDERABLE_TYPE 0x3040
+#define EGL_PBUFFER_BIT 0x0001
+#define EGL_OPENGL_BIT 0x0008
+#define EGL_OPENGL_API 0x30A2
+#define EGL_CONTEXT_MAJOR_VERSION 0x3098
+#define EGL_CONTEXT_MINOR_VERSION 0x30FB
+#define EGL_CONTEXT_OPENGL_PROFILE_MASK 0x30FD
+#define EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT 0x00000001
+#define EGL_PLATFORM_DEVICE_EXT 0x313F
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+
+typedef void *(*PFNEGLGETPROCADDRESSPROC)(const char *name);
+typedef EGLint (*PFNEGLGETERRORPROC)();
+typedef const char *(*PFNEGLQUERYSTRINGPROC)(EGLDisplay display, EGLint name);
+typedef EGLDisplay (*PFNEGLGETPLATFORMDISPLAYEXTPROC)(EGLenum platform, void *nativeDisplay, const EGLint *attributes);
+typedef EGLBoolean (*PFNEGLQUERYDEVICESEXTPROC)(EGLint maxDevices, EGLDeviceEXT *devices, EGLint *numDevices);
+typedef EGLBoolean (*PFNEGLINITIALIZEPROC)(EGLDisplay display, EGLint *major, EGLint *minor);
+typedef EGLBoolean (*PFNEGLTERMINATEPROC)(EGLDisplay display);
+typedef EGLBoolean (*PFNEGLBINDAPIPROC)(EGLenum api);
+typedef EGLBoolean (*PFNEGLCHOOSECONFIGPROC)(EGLDisplay display, const EGLint *attributes, EGLConfig *configs, EGLint size, EGLint *numConfigs);
+typedef EGLContext (*PFNEGLCREATECONTEXTPROC)(EGLDisplay display, EGLConfig config, EGLContext share, const EGLint *attributes);
+typedef EGLBoolean (*PFNEGLDESTROYCONTEXTPROC)(EGLDisplay display, EGLContext context);
+typedef EGLBoolean (*PFNEGLMAKECURRENTPROC)(EGLDisplay display, EGLSurface draw, EGLSurface read, EGLContext context);
+
+static PFNEGLGETPROCADDRESSPROC s_eglGetProcAddress = nullptr;
+
+// Whether the space separated list holds name
+static bool hasExtension(const char *extensions, const char *name) {
+  if(!extensions)
+    return false;
+  const size_t length = std::strlen(name);
+  for(const char *start = extensions; (start = std::strstr(start, name)) != nullptr; start += length) {
+    if((start == extensions || start[-1] == ' ') && (start[length] == ' ' || start[length] == '\0'))
+      return true;
+  }
+  return false;
+}
+#endif
+
+HeadlessContext::~HeadlessContext() {
+  release();
+}
+
+bool HeadlessContext::create(int major, int minor) {
+  release();
+#if defined(__linux__)
+  m_library = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+  if(!m_library) {
+    std::cerr << "ERROR: libEGL.so.1 not found" << std::endl;
+    return false;
+  }
+  s_eglGetProcAddress = reinterpret_cast<PFNEGLGETPROCADDRESSPROC>(dlsym(m_library, "eglGetProcAddress"));
+  const PFNEGLGETERRORPROC getError = reinterpret_cast<PFNEGLGETERRORPROC>(dlsym(m_library, "eglGetError"));
+  const PFNEGLQUERYSTRINGPROC queryString = reinterpret_cast<PFNEGLQUERYSTRINGPROC>(dlsym(m_library, "eglQueryString"));
+  const PFNEGLINITIALIZEPROC initialize = reinterpret_cast<PFNEGLINITIALIZEPROC>(dlsym(m_library, "eglInitialize"));
+  const PFNEGLBINDAPIPROC bindApi = reinterpret_cast<PFNEGLBINDAPIPROC>(dlsym(m_library, "eglBindAPI"));
+  const PFNEGLCHOOSECONFIGPROC chooseConfig = reinterpret_cast<PFNEGLCHOOSECONFIGPROC>(dlsym(m_library, "eglChooseConfig"));
+  const PFNEGLCREATECONTEXTPROC createContext = reinterpret_cast<PFNEGLCREATECONTEXTPROC>(dlsym(m_library, "eglCreateContext"));
+  const PFNEGLMAKECURRENTPROC makeCurrent = reinterpret_cast<PFNEGLMAKECURRENTPROC>(dlsym(m_library, "eglMakeCurrent"));
+  if(!s_eglGetProcAddress || !getError || !queryString || !initialize || !bindApi || !chooseConfig || !createContext || !makeCurrent) {
+    std::cerr << "ERROR: libEGL.so.1 lacks EGL 1.4 entry points" << std::endl;
+    release();
+    return false;
+  }
+  const PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(s_eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  const PFNEGLQUERYDEVICESEXTPROC queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(s_eglGetProcAddress("eglQueryDevicesEXT"));
+
+  // Display of no window system: Mesa's surfaceless platform, else the first GPU
+  const char *clientExtensions = queryString(nullptr, EGL_EXTENSIONS);
+  if(getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+    m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, nullptr, nullptr);
+  if(!m_display && getPlatformDisplay && queryDevices && hasExtension(clientExtensions, "EGL_EXT_platform_device")) {
+    EGLDeviceEXT device = nullptr;
+    EGLint numDevices = 0;
+    if(queryDevices(1, &device, &numDevices) && numDevices > 0)
+      m_display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+  }
+  EGLint eglMajor = 0, eglMinor = 0;
+  if(!m_display || !initialize(m_display, &eglMajor, &eglMinor)) {
+    std::cerr << "ERROR: no EGL display without window system (EGL_MESA_platform_surfaceless or EGL_EXT_platform_device)" << std::endl;
+    m_display = nullptr;
+    release();
+    return false;
+  }
+  if(!hasExtension(queryString(m_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+    std::cerr << "ERROR: EGL_KHR_surfaceless_context unsupported" << std::endl;
+    release();
+    return false;
+  }
+
+  const EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config = nullptr;
+  EGLint numConfigs = 0;
+  const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, major, EGL_CONTEXT_MINOR_VERSION, minor,
+                                      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+  if(bindApi(EGL_OPENGL_API) && chooseConfig(m_display, configAttributes, &config, 1, &numConfigs) && numConfigs > 0)
+    m_context = createContext(m_display, config, nullptr, contextAttributes);
+  if(!m_context || makeCurrent(m_display, nullptr, nullptr, m_context) == EGL_FALSE) {
+    std::cerr << "ERROR: failed to create an OpenGL " << major << "." << minor << " core context on EGL (error 0x" << std::hex << getError() << std::dec << ")" << std::endl;
+    release();
+    return false;
+  }
+  return true;
+#else
+  (void)major;
+  (void)minor;
+  std::cerr << "ERROR: headless EGL contexts are only supported on Linux" << std::endl;
+  return false;
+#endif
+}
+
+void HeadlessContext::release() {
+#if defined(__linux__)
+  if(m_display) {
+    const PFNEGLMAKECURRENTPROC makeCurrent = reinterpret_cast<PFNEGLMAKECURRENTPROC>(dlsym(m_library, "eglMakeCurrent"));
+    const PFNEGLDESTROYCONTEXTPROC destroyContext = reinterpret_cast<PFNEGLDESTROYCONTEXTPROC>(dlsym(m_library, "eglDestroyContext"));
+    const PFNEGLTERMINATEPROC terminate = reinterpret_cast<PFNEGLTERMINATEPROC>(dlsym(m_library, "eglTerminate"));
+    if(m_context) {
+      makeCurrent(m_display, nullptr, nullptr, nullptr);
+      destroyContext(m_display, m_context);
+    }
+    terminate(m_display);
+  }
+  if(m_library) {
+    s_eglGetProcAddress = nullptr;
+    dlclose(m_library);
+  }
+#endif
+  m_library = nullptr;
+  m_display = nullptr;
+  m_context = nullptr;
+}
+
+void *HeadlessContext::getProcAddress(const char *name) {
+#if defined(__linux__)
+  return s_eglGetProcAddress ? s_eglGetProcAddress(name) : nullptr;
+#else
+  (void)name;
+  return nullptr;
+#endif
+}
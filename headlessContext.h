@@ -0,0 +1,38 @@
+// ----------------------------------------------------------------------------
+// headlessContext.h
+//
+// Description: OpenGL context without window nor display server, for headless
+//              rendering on machines with a GPU (or Mesa) but no X11/Wayland.
+//              The context is created on the EGL surfaceless platform
+//              (EGL_MESA_platform_surfaceless), else on the first EGL device
+//              (EGL_EXT_platform_device), and made current without any surface
+//              (EGL_KHR_surfaceless_context): everything is drawn into
+//              framebuffer objects. libEGL is loaded at run time, so the
+//              application neither links with it nor needs its headers.
+// ----------------------------------------------------------------------------
+
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <glad/glad.h>
+
+class HeadlessContext {
+public:
+  ~HeadlessContext();
+
+  // Creates a core profile context of at least the given version and makes it current. Returns
+  // false (with a message) if libEGL or one of the extensions is unavailable.
+  bool create(int major, int minor);
+  void release();
+  inline bool isValid() const { return m_context != nullptr; }
+
+  // Entry points of the current context, for gladLoadGLLoader and the other GLADloadproc users
+  static void *getProcAddress(const char *name);
+
+private:
+  void *m_library = nullptr; // libEGL handle
+  void *m_display = nullptr; // EGLDisplay
+  void *m_context = nullptr; // EGLContext
+};
+
+#endif // HEADLESS_CONTEXT_H
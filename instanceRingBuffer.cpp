@@ -0,0 +1,76 @@
+// ----------------------------------------------------------------------------
+// instanceRingBuffer.cpp
+//
+// Description: Ring of mapped segments for per-instance data (see instanceRingBuffer.h)
+// ----------------------------------------------------------------------------
+
+#include "instanceRingBuffer.h"
+
+// Segments start on this boundary, so that whole matrices can be streamed into them
+const static size_t kSegmentAlignment = 256;
+
+void InstanceRingBuffer::init(size_t segmentBytes, int numSegments) {
+  glGenBuffers(1, &m_buffer);
+  m_fences.assign(static_cast<size_t>(numSegments > 1 ? numSegments : 2), nullptr);
+  m_current = 0;
+  allocate(segmentBytes);
+}
+
+void InstanceRingBuffer::release() {
+  for(GLsync &fence : m_fences) {
+    if(fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+  glDeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+  m_segmentBytes = 0;
+}
+
+void InstanceRingBuffer::allocate(size_t segmentBytes) {
+  for(GLsync &fence : m_fences) { // orphaned with the old storage
+    if(fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+  m_segmentBytes = (segmentBytes + kSegmentAlignment - 1) / kSegmentAlignment * kSegmentAlignment;
+  glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+  glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(m_segmentBytes * m_fences.size()), nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void *InstanceRingBuffer::map(size_t bytes) {
+  if(!m_buffer || bytes == 0)
+    return nullptr;
+  if(bytes > m_segmentBytes)
+    allocate(bytes + bytes / 2);
+  m_current = (m_current + 1) % m_fences.size();
+  GLsync &fence = m_fences[m_current];
+  if(fence) {
+    if(glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      ++m_waits;
+      while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {
+      }
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+  // Unsynchronized: the fence above already guarantees the GPU no longer reads the segment
+  return glMapBufferRange(GL_ARRAY_BUFFER, static_cast<GLintptr>(m_current * m_segmentBytes), static_cast<GLsizeiptr>(bytes),
+                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+size_t InstanceRingBuffer::unmap() {
+  glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return m_current * m_segmentBytes;
+}
+
+void InstanceRingBuffer::fence() {
+  GLsync &fence = m_fences[m_current];
+  if(fence)
+    glDeleteSync(fence);
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
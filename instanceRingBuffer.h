@@ -0,0 +1,46 @@
+// ----------------------------------------------------------------------------
+// instanceRingBuffer.h
+//
+// Description: Per-instance data streamed to the GPU every frame through a
+//              ring of segments of one buffer object. A segment is mapped
+//              unsynchronized, written in place (no intermediate copy), and
+//              fenced after the draws reading it; it is only waited on when
+//              the ring comes back to it before the GPU is done with it.
+// ----------------------------------------------------------------------------
+
+#ifndef INSTANCE_RING_BUFFER_H
+#define INSTANCE_RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class InstanceRingBuffer {
+public:
+  void init(size_t segmentBytes, int numSegments = 3);
+  void release();
+
+  // Maps the next segment for writing bytes, after waiting for the GPU to be done with it (the ring
+  // grows if bytes exceed a segment). Returns nullptr if the mapping fails.
+  void *map(size_t bytes);
+  // Unmaps the segment and returns its offset in getBuffer(), to source the instance attributes from
+  size_t unmap();
+  // Fences the draws issued since unmap, which read the segment
+  void fence();
+
+  inline GLuint getBuffer() const { return m_buffer; }
+  inline uint64_t getWaits() const { return m_waits; } // maps that waited for the GPU
+
+private:
+  void allocate(size_t segmentBytes);
+
+  GLuint m_buffer = 0;
+  size_t m_segmentBytes = 0;
+  std::vector<GLsync> m_fences; // of every segment, nullptr once waited for
+  size_t m_current = 0;
+  uint64_t m_waits = 0;
+};
+
+#endif // INSTANCE_RING_BUFFER_H
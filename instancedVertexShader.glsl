@@ -0,0 +1,17 @@
+#version 330 core            // Minimal GL version support expected from the GPU
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoord;
+layout(location=3) in mat4 instanceMat; // per instance, from the instance ring buffer (locations 3 to 6)
+uniform mat4 viewMat, projMat;
+out vec3 fNormal, fPosition;
+out vec2 fTexCoord;
+
+void main() {
+        vec4 position = instanceMat * vec4(vPosition, 1.0);
+        gl_Position = projMat * viewMat * position;
+        fNormal = mat3(instanceMat) * vNormal;
+        fPosition = position.xyz;
+        fTexCoord = vTexCoord;
+}
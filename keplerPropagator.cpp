@@ -0,0 +1,252 @@
+// ----------------------------------------------------------------------------
+// keplerPropagator.cpp
+//
+// Description: Two-body propagation of elliptic orbits (see keplerPropagator.h)
+// ----------------------------------------------------------------------------
+
+#include "keplerPropagator.h"
+#include "threadPool.h"
+
+#include <chrono>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KEPLER_USE_SSE
+#endif
+
+// Bodies per task: a few Halley iterations with polynomial sin/cos each, so a task of fewer bodies
+// finishes before the pool has woken the next thread
+const static size_t kMinBodiesPerTask = 8192;
+
+// Halley iterations from Danby's starting value: at most 5, enough for 1e-13 radians up to an
+// eccentricity of 0.99 (checked over the whole range of mean anomalies). The convergence is cubic:
+// once every lane of a vector moves by less than kConvergedStep, the next step would be below
+// double precision and the iterations stop.
+const static int kHalleyIterations = 5;
+const static double kConvergedStep = 1e-7;
+
+const static double kTwoPi = 6.283185307179586476925;
+const static double kTwoOverPi = 0.636619772367581343076;
+const static double kRoundMagic = 6755399441055744.; // 1.5 * 2^52
+
+// sin and cos polynomials on [-pi/4, pi/4] (Cephes), after reduction by pi/2 split in three parts
+const static double kPiOver2Parts[3] = {1.57079632679489655800e+00, 6.12323399573676480327e-17, 2.46519032881566189191e-32};
+const static double kSinCoefficients[6] = {1.58962301576546568060e-10, -2.50507477628578072866e-8, 2.75573136213857245213e-6,
+                                           -1.98412698295895385996e-4, 8.33333333332211858878e-3, -1.66666666666666307295e-1};
+const static double kCosCoefficients[6] = {-1.13585365213876817300e-11, 2.08757008419747316778e-9, -2.75573141792967388112e-7,
+                                           2.48015872888517045348e-5, -1.38888888888730564116e-3, 4.16666666666665929218e-2};
+
+// Lane-wise double operations of propagateBodies (1 scalar, 2 SSE2 or 4 AVX lanes). Mask holds the
+// per-lane comparisons; allBelow ends the Halley iterations once every lane has converged.
+struct ScalarOps {
+  typedef double Vec;
+  typedef bool Mask;
+  const static size_t kWidth = 1;
+  static inline Vec set(double v) { return v; }
+  static inline Vec load(const double *p) { return *p; }
+  static inline void store(double *p, Vec v) { *p = v; }
+  static inline Vec add(Vec a, Vec b) { return a + b; }
+  static inline Vec sub(Vec a, Vec b) { return a - b; }
+  static inline Vec mul(Vec a, Vec b) { return a * b; }
+  static inline Vec div(Vec a, Vec b) { return a / b; }
+  static inline Vec round(Vec a) { return std::nearbyint(a); }
+  static inline Mask equal(Vec a, Vec b) { return a == b; }
+  static inline Mask greaterEqual(Vec a, Vec b) { return a >= b; }
+  static inline Mask orMask(Mask a, Mask b) { return a || b; }
+  static inline Vec select(Mask m, Vec a, Vec b) { return m ? a : b; }
+  static inline Vec negateIf(Mask m, Vec a) { return m ? -a : a; }
+  static inline bool allBelow(Vec a, double limit) { return std::fabs(a) < limit; }
+};
+
+#if defined(__AVX__)
+struct SimdOps {
+  typedef __m256d Vec;
+  typedef __m256d Mask;
+  const static size_t kWidth = 4;
+  static inline Vec set(double v) { return _mm256_set1_pd(v); }
+  static inline Vec load(const double *p) { return _mm256_loadu_pd(p); }
+  static inline void store(double *p, Vec v) { _mm256_storeu_pd(p, v); }
+  static inline Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+  static inline Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+  static inline Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+  static inline Vec div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+  static inline Vec round(Vec a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+  static inline Mask equal(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static inline Mask greaterEqual(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+  static inline Mask orMask(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+  static inline Vec select(Mask m, Vec a, Vec b) { return _mm256_blendv_pd(b, a, m); }
+  static inline Vec negateIf(Mask m, Vec a) { return _mm256_xor_pd(a, _mm256_and_pd(m, _mm256_set1_pd(-0.))); }
+  static inline bool allBelow(Vec a, double limit) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(_mm256_set1_pd(-0.), a), _mm256_set1_pd(limit), _CMP_LT_OQ)) == 0xF;
+  }
+};
+#elif defined(KEPLER_USE_SSE)
+struct SimdOps {
+  typedef __m128d Vec;
+  typedef __m128d Mask;
+  const static size_t kWidth = 2;
+  static inline Vec set(double v) { return _mm_set1_pd(v); }
+  static inline Vec load(const double *p) { return _mm_loadu_pd(p); }
+  static inline void store(double *p, Vec v) { _mm_storeu_pd(p, v); }
+  static inline Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+  static inline Vec sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+  static inline Vec mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+  static inline Vec div(Vec a, Vec b) { return _mm_div_pd(a, b); }
+  // Nearest integer for |a| < 2^51, without SSE4.1 (exact without -ffast-math, which would fold it)
+  static inline Vec round(Vec a) { return _mm_sub_pd(_mm_add_pd(a, _mm_set1_pd(kRoundMagic)), _mm_set1_pd(kRoundMagic)); }
+  static inline Mask equal(Vec a, Vec b) { return _mm_cmpeq_pd(a, b); }
+  static inline Mask greaterEqual(Vec a, Vec b) { return _mm_cmpge_pd(a, b); }
+  static inline Mask orMask(Mask a, Mask b) { return _mm_or_pd(a, b); }
+  static inline Vec select(Mask m, Vec a, Vec b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+  static inline Vec negateIf(Mask m, Vec a) { return _mm_xor_pd(a, _mm_and_pd(m, _mm_set1_pd(-0.))); }
+  static inline bool allBelow(Vec a, double limit) { return _mm_movemask_pd(_mm_cmplt_pd(_mm_andnot_pd(_mm_set1_pd(-0.), a), _mm_set1_pd(limit))) == 0x3; }
+};
+#endif
+
+template <class Ops>
+static inline typename Ops::Vec polynomial(typename Ops::Vec x, const double (&coefficients)[6]) {
+  typename Ops::Vec p = Ops::set(coefficients[0]);
+  for(int i = 1; i < 6; ++i)
+    p = Ops::add(Ops::mul(p, x), Ops::set(coefficients[i]));
+  return p;
+}
+
+// Sine and cosine of angles of a few turns at most, to about 1 ulp
+template <class Ops>
+static inline void sinCos(typename Ops::Vec x, typename Ops::Vec &s, typename Ops::Vec &c) {
+  typedef typename Ops::Vec Vec;
+  const Vec quadrant = Ops::round(Ops::mul(x, Ops::set(kTwoOverPi)));
+  Vec r = Ops::sub(x, Ops::mul(quadrant, Ops::set(kPiOver2Parts[0])));
+  r = Ops::sub(r, Ops::mul(quadrant, Ops::set(kPiOver2Parts[1])));
+  r = Ops::sub(r, Ops::mul(quadrant, Ops::set(kPiOver2Parts[2])));
+  const Vec r2 = Ops::mul(r, r);
+  const Vec sinR = Ops::add(r, Ops::mul(Ops::mul(r, r2), polynomial<Ops>(r2, kSinCoefficients)));
+  const Vec cosR = Ops::add(Ops::sub(Ops::set(1.), Ops::mul(r2, Ops::set(0.5))), Ops::mul(Ops::mul(r2, r2), polynomial<Ops>(r2, kCosCoefficients)));
+
+  // quadrant mod 4 (floor(q/4) = round(q/4 - 3/8) for integers): sin, cos = (s, c), (c, -s), (-s, -c), (-c, s)
+  const Vec q = Ops::sub(quadrant, Ops::mul(Ops::set(4.), Ops::round(Ops::sub(Ops::mul(quadrant, Ops::set(0.25)), Ops::set(0.375)))));
+  const typename Ops::Mask odd = Ops::orMask(Ops::equal(q, Ops::set(1.)), Ops::equal(q, Ops::set(3.)));
+  const typename Ops::Mask negateSin = Ops::greaterEqual(q, Ops::set(2.));
+  const typename Ops::Mask negateCos = Ops::orMask(Ops::equal(q, Ops::set(1.)), Ops::equal(q, Ops::set(2.)));
+  s = Ops::negateIf(negateSin, Ops::select(odd, cosR, sinR));
+  c = Ops::negateIf(negateCos, Ops::select(odd, sinR, cosR));
+}
+
+// Position of the bodies at offset relative to their parent
+template <class Ops>
+static inline void propagateBodies(double time, size_t i, const double *meanAnomaly, const double *meanMotion, const double *eccentricity,
+                                   const double *px, const double *py, const double *pz, const double *qx, const double *qy, const double *qz,
+                                   double *x, double *y, double *z) {
+  typedef typename Ops::Vec Vec;
+  const Vec e = Ops::load(eccentricity + i);
+
+  // Mean anomaly in [-pi, pi]: the eccentric anomaly is in the same range
+  Vec m = Ops::add(Ops::load(meanAnomaly + i), Ops::mul(Ops::load(meanMotion + i), Ops::set(time)));
+  m = Ops::sub(m, Ops::mul(Ops::set(kTwoPi), Ops::round(Ops::mul(m, Ops::set(1. / kTwoPi)))));
+
+  // Kepler's equation M = E - e sin E, from Danby's E = M + 0.85 e sign(sin M) (sign(M) on [-pi, pi])
+  const Vec starter = Ops::mul(Ops::set(0.85), e);
+  Vec anomaly = Ops::add(m, Ops::negateIf(Ops::greaterEqual(Ops::set(0.), m), starter));
+  Vec s, c;
+  for(int iteration = 0; iteration < kHalleyIterations; ++iteration) {
+    sinCos<Ops>(anomaly, s, c);
+    const Vec f = Ops::sub(Ops::sub(anomaly, Ops::mul(e, s)), m);
+    const Vec df = Ops::sub(Ops::set(1.), Ops::mul(e, c));
+    const Vec d2f = Ops::mul(e, s);
+    // Halley: E -= f f' / (f'^2 - f f'' / 2)
+    const Vec step = Ops::div(Ops::mul(f, df), Ops::sub(Ops::mul(df, df), Ops::mul(Ops::mul(f, d2f), Ops::set(0.5))));
+    anomaly = Ops::sub(anomaly, step);
+    if(Ops::allBelow(step, kConvergedStep))
+      break;
+  }
+  sinCos<Ops>(anomaly, s, c);
+
+  const Vec alongPeriapsis = Ops::sub(c, e);
+  Ops::store(x + i, Ops::add(Ops::mul(alongPeriapsis, Ops::load(px + i)), Ops::mul(s, Ops::load(qx + i))));
+  Ops::store(y + i, Ops::add(Ops::mul(alongPeriapsis, Ops::load(py + i)), Ops::mul(s, Ops::load(qy + i))));
+  Ops::store(z + i, Ops::add(Ops::mul(alongPeriapsis, Ops::load(pz + i)), Ops::mul(s, Ops::load(qz + i))));
+}
+
+int KeplerPropagator::addBody(const OrbitalElements &elements, int parent) {
+  const double cosNode = std::cos(elements.ascendingNode), sinNode = std::sin(elements.ascendingNode);
+  const double cosPeri = std::cos(elements.argumentOfPeriapsis), sinPeri = std::sin(elements.argumentOfPeriapsis);
+  const double cosIncl = std::cos(elements.inclination), sinIncl = std::sin(elements.inclination);
+  const double a = elements.semiMajorAxis;
+  const double b = a * std::sqrt(1. - elements.eccentricity * elements.eccentricity);
+
+  // Perifocal to reference frame rotation: Rz(node) Rx(inclination) Rz(periapsis) applied to x and y
+  m_periapsisX.push_back(a * (cosNode * cosPeri - sinNode * sinPeri * cosIncl));
+  m_periapsisY.push_back(a * (sinNode * cosPeri + cosNode * sinPeri * cosIncl));
+  m_periapsisZ.push_back(a * (sinPeri * sinIncl));
+  m_semiMinorX.push_back(b * (-cosNode * sinPeri - sinNode * cosPeri * cosIncl));
+  m_semiMinorY.push_back(b * (-sinNode * sinPeri + cosNode * cosPeri * cosIncl));
+  m_semiMinorZ.push_back(b * (cosPeri * sinIncl));
+  m_meanAnomaly.push_back(elements.meanAnomaly);
+  m_meanMotion.push_back(elements.meanMotion);
+  m_eccentricity.push_back(elements.eccentricity);
+
+  const int body = static_cast<int>(m_parent.size());
+  const int depth = parent == kNoParent ? 0 : m_depth[parent] + 1;
+  m_parent.push_back(parent);
+  m_depth.push_back(depth);
+  if(depth > 0) {
+    if(m_childrenByDepth.size() < static_cast<size_t>(depth))
+      m_childrenByDepth.resize(depth);
+    m_childrenByDepth[depth - 1].push_back(static_cast<uint32_t>(body));
+  }
+  m_x.push_back(0.);
+  m_y.push_back(0.);
+  m_z.push_back(0.);
+  return body;
+}
+
+void KeplerPropagator::clear() {
+  for(std::vector<double> *v : {&m_meanAnomaly, &m_meanMotion, &m_eccentricity, &m_periapsisX, &m_periapsisY, &m_periapsisZ, &m_semiMinorX, &m_semiMinorY,
+                                &m_semiMinorZ, &m_x, &m_y, &m_z})
+    v->clear();
+  m_parent.clear();
+  m_depth.clear();
+  m_childrenByDepth.clear();
+}
+
+void KeplerPropagator::propagateRange(double time, size_t begin, size_t end) {
+  size_t i = begin;
+#if defined(__AVX__) || defined(KEPLER_USE_SSE)
+  for(; i + SimdOps::kWidth <= end; i += SimdOps::kWidth)
+    propagateBodies<SimdOps>(time, i, m_meanAnomaly.data(), m_meanMotion.data(), m_eccentricity.data(), m_periapsisX.data(), m_periapsisY.data(),
+                             m_periapsisZ.data(), m_semiMinorX.data(), m_semiMinorY.data(), m_semiMinorZ.data(), m_x.data(), m_y.data(), m_z.data());
+#endif
+  for(; i < end; ++i) // remainder (or everything without SIMD)
+    propagateBodies<ScalarOps>(time, i, m_meanAnomaly.data(), m_meanMotion.data(), m_eccentricity.data(), m_periapsisX.data(), m_periapsisY.data(),
+                               m_periapsisZ.data(), m_semiMinorX.data(), m_semiMinorY.data(), m_semiMinorZ.data(), m_x.data(), m_y.data(), m_z.data());
+}
+
+void KeplerPropagator::propagate(double time, ThreadPool *pool) {
+  const auto start = std::chrono::steady_clock::now();
+  const size_t n = size();
+  if(pool)
+    pool->parallelFor(n, kMinBodiesPerTask, [&](size_t begin, size_t end, size_t) { propagateRange(time, begin, end); });
+  else
+    propagateRange(time, 0, n);
+
+  // Parent positions are final once the shallower levels are done
+  for(const std::vector<uint32_t> &children : m_childrenByDepth) {
+    const auto moveByParent = [&](size_t begin, size_t end, size_t) {
+      for(size_t k = begin; k < end; ++k) {
+        const uint32_t body = children[k];
+        const int parent = m_parent[body];
+        m_x[body] += m_x[parent];
+        m_y[body] += m_y[parent];
+        m_z[body] += m_z[parent];
+      }
+    };
+    if(pool)
+      pool->parallelFor(children.size(), kMinBodiesPerTask, moveByParent);
+    else
+      moveByParent(0, children.size(), 0);
+  }
+  m_lastPropagateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
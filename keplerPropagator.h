@@ -0,0 +1,71 @@
+// ----------------------------------------------------------------------------
+// keplerPropagator.h
+//
+// Description: Two-body (Keplerian) propagation of elliptic orbits. Orbital
+//              elements are stored as structure-of-arrays and Kepler's equation
+//              is solved for every body at once with a fixed number of Halley
+//              iterations, vectorized with SSE2 (2 bodies per iteration) or AVX
+//              (4 bodies) when available, in double precision. Orbits can be
+//              around another body (moons around planets).
+// ----------------------------------------------------------------------------
+
+#ifndef KEPLER_PROPAGATOR_H
+#define KEPLER_PROPAGATOR_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Classical elements of an elliptic orbit (angles in radians, 0 <= eccentricity < 1)
+struct OrbitalElements {
+  double semiMajorAxis = 1.;
+  double eccentricity = 0.;
+  double inclination = 0.;
+  double ascendingNode = 0.;       // longitude of the ascending node
+  double argumentOfPeriapsis = 0.;
+  double meanAnomaly = 0.;         // at time 0
+  double meanMotion = 1.;          // radians per unit of time
+};
+
+class KeplerPropagator {
+public:
+  const static int kNoParent = -1;
+
+  // Adds a body orbiting parent (an earlier body, or the origin with kNoParent) and returns its index.
+  int addBody(const OrbitalElements &elements, int parent = kNoParent);
+  void clear();
+  inline size_t size() const { return m_meanMotion.size(); }
+
+  // Computes the positions of every body at time: relative to its parent first, split across the
+  // pool, then moved by the parent positions one hierarchy level after the other.
+  void propagate(double time, ThreadPool *pool = nullptr);
+
+  // Positions of the last propagate, relative to the origin
+  inline glm::dvec3 getPosition(int body) const { return glm::dvec3(m_x[body], m_y[body], m_z[body]); }
+  inline const double *x() const { return m_x.data(); }
+  inline const double *y() const { return m_y.data(); }
+  inline const double *z() const { return m_z.data(); }
+
+  inline double getLastPropagateMs() const { return m_lastPropagateMs; }
+
+private:
+  void propagateRange(double time, size_t begin, size_t end);
+
+  // Elements, with the orientation of the orbit folded into the perifocal axes: the position is
+  // (cos E - e) * periapsis + sin E * semiMinor, E being the eccentric anomaly
+  std::vector<double> m_meanAnomaly, m_meanMotion, m_eccentricity;
+  std::vector<double> m_periapsisX, m_periapsisY, m_periapsisZ;    // semi-major axis toward the periapsis
+  std::vector<double> m_semiMinorX, m_semiMinorY, m_semiMinorZ;    // semi-minor axis, 90 degrees ahead
+  std::vector<int> m_parent;
+  std::vector<int> m_depth;
+  std::vector<std::vector<uint32_t>> m_childrenByDepth; // bodies with a parent, by hierarchy depth (from 1)
+
+  std::vector<double> m_x, m_y, m_z;
+  double m_lastPropagateMs = 0.;
+};
+
+#endif // KEPLER_PROPAGATOR_H
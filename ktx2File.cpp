@@ -0,0 +1,150 @@
+// ----------------------------------------------------------------------------
+// ktx2File.cpp
+//
+// Description: KTX 2.0 files (see ktx2File.h)
+// ----------------------------------------------------------------------------
+
+#include "ktx2File.h"
+#include "fileUtils.h"
+#include "textureCompression.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+const static unsigned char kIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+const static size_t kHeaderSize = 12 + 9*4 + 4*4 + 2*8; // identifier, header, index
+const static size_t kLevelIndexEntrySize = 3*8;
+const static size_t kBlockBytes = 8; // BC1; also the alignment of the level data
+
+// Data Format Descriptor constants (Khronos Data Format 1.3)
+const static uint8_t kDfModelBC1A = 128;
+const static uint8_t kDfPrimariesBT709 = 1;
+const static uint8_t kDfTransferLinear = 1;
+const static uint8_t kDfTransferSrgb = 2;
+
+// Fields are little-endian whatever the host
+static void put32(std::vector<unsigned char> &out, uint32_t value) {
+  for(int i = 0; i < 4; ++i)
+    out.push_back(static_cast<unsigned char>(value >> (8*i)));
+}
+
+static void put64(std::vector<unsigned char> &out, uint64_t value) {
+  for(int i = 0; i < 8; ++i)
+    out.push_back(static_cast<unsigned char>(value >> (8*i)));
+}
+
+static uint32_t get32(const unsigned char *in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+static uint64_t get64(const unsigned char *in) {
+  return get32(in) | (static_cast<uint64_t>(get32(in + 4)) << 32);
+}
+
+bool writeKtx2(const std::string &path, uint32_t vkFormat, const std::vector<MipLevel> &levels) {
+  if(levels.empty())
+    return false;
+  const uint32_t numLevels = static_cast<uint32_t>(levels.size());
+
+  // Basic descriptor block with the single sample of a BC1 block
+  std::vector<unsigned char> dfd;
+  const uint32_t descriptorBlockSize = 24 + 16;
+  put32(dfd, 4 + descriptorBlockSize);                 // dfdTotalSize
+  put32(dfd, 0);                                       // vendorId 0 (Khronos), descriptorType 0 (basic)
+  put32(dfd, 2 | (descriptorBlockSize << 16));         // versionNumber 1.3, descriptorBlockSize
+  dfd.push_back(kDfModelBC1A);
+  dfd.push_back(kDfPrimariesBT709);
+  dfd.push_back(vkFormat == kVkFormatBC1RGBSrgb ? kDfTransferSrgb : kDfTransferLinear);
+  dfd.push_back(0);                                    // flags: straight alpha
+  dfd.push_back(3); dfd.push_back(3); dfd.push_back(0); dfd.push_back(0); // texel block 4x4x1x1, minus one
+  put32(dfd, kBlockBytes);                             // bytesPlane0..3
+  put32(dfd, 0);                                       // bytesPlane4..7
+  put32(dfd, 0 | (63 << 16) | (0 << 24));              // bitOffset 0, bitLength 64 - 1, channel BC1A color
+  put32(dfd, 0);                                       // samplePosition
+  put32(dfd, 0);                                       // sampleLower
+  put32(dfd, 0xFFFFFFFF);                              // sampleUpper
+
+  const size_t dfdOffset = kHeaderSize + numLevels * kLevelIndexEntrySize;
+  std::vector<uint64_t> offsets(numLevels);
+  size_t offset = dfdOffset + dfd.size();
+  for(uint32_t i = numLevels; i-- > 0;) { // the data of the smallest level comes first
+    offset = alignUp(offset, kBlockBytes);
+    offsets[i] = offset;
+    offset += levels[i].pixels.size();
+  }
+
+  std::vector<unsigned char> header(kIdentifier, kIdentifier + sizeof(kIdentifier));
+  put32(header, vkFormat);
+  put32(header, 1);                                    // typeSize: 1 for block-compressed formats
+  put32(header, static_cast<uint32_t>(levels[0].width));
+  put32(header, static_cast<uint32_t>(levels[0].height));
+  put32(header, 0);                                    // pixelDepth
+  put32(header, 0);                                    // layerCount: not an array
+  put32(header, 1);                                    // faceCount
+  put32(header, numLevels);
+  put32(header, 0);                                    // supercompressionScheme: none
+  put32(header, static_cast<uint32_t>(dfdOffset));
+  put32(header, static_cast<uint32_t>(dfd.size()));
+  put32(header, 0); put32(header, 0);                  // no key/value data
+  put64(header, 0); put64(header, 0);                  // no supercompression global data
+  for(uint32_t i = 0; i < numLevels; ++i) {
+    put64(header, offsets[i]);
+    put64(header, levels[i].pixels.size());
+    put64(header, levels[i].pixels.size());            // uncompressedByteLength, equal without supercompression
+  }
+  header.insert(header.end(), dfd.begin(), dfd.end());
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if(!file)
+    return false;
+  bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size();
+  size_t written = header.size();
+  const unsigned char padding[kBlockBytes] = {0};
+  for(uint32_t i = numLevels; ok && i-- > 0;) {
+    ok = std::fwrite(padding, 1, offsets[i] - written, file) == offsets[i] - written &&
+         std::fwrite(levels[i].pixels.data(), 1, levels[i].pixels.size(), file) == levels[i].pixels.size();
+    written = offsets[i] + levels[i].pixels.size();
+  }
+  return std::fclose(file) == 0 && ok;
+}
+
+bool readKtx2(const std::string &path, uint32_t &vkFormat, std::vector<MipLevel> &levels) {
+  levels.clear();
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if(!file)
+    return false;
+
+  unsigned char header[kHeaderSize];
+  bool ok = std::fread(header, 1, kHeaderSize, file) == kHeaderSize && std::memcmp(header, kIdentifier, sizeof(kIdentifier)) == 0;
+  const unsigned char *fields = header + sizeof(kIdentifier);
+  const uint32_t width = ok ? get32(fields + 8) : 0;
+  const uint32_t height = ok ? get32(fields + 12) : 0;
+  const uint32_t numLevels = ok ? get32(fields + 28) : 0;
+  if(ok) {
+    vkFormat = get32(fields);
+    ok = (vkFormat == kVkFormatBC1RGBUnorm || vkFormat == kVkFormatBC1RGBSrgb) && get32(fields + 16) == 0 && get32(fields + 20) == 0 &&
+         get32(fields + 24) == 1 && get32(fields + 32) == 0 && width > 0 && height > 0 && numLevels > 0 && numLevels <= 32;
+  }
+
+  std::vector<unsigned char> levelIndex(numLevels * kLevelIndexEntrySize);
+  ok = ok && std::fread(levelIndex.data(), 1, levelIndex.size(), file) == levelIndex.size();
+  if(ok)
+    levels.resize(numLevels);
+  for(uint32_t i = 0; ok && i < numLevels; ++i) {
+    const unsigned char *entry = &levelIndex[i * kLevelIndexEntrySize];
+    MipLevel &level = levels[i];
+    level.width = std::max(1, static_cast<int>(width >> i));
+    level.height = std::max(1, static_cast<int>(height >> i));
+    const uint64_t length = get64(entry + 8);
+    ok = length == bc1Size(level.width, level.height) && std::fseek(file, static_cast<long>(get64(entry)), SEEK_SET) == 0;
+    if(ok) {
+      level.pixels.resize(length);
+      ok = std::fread(level.pixels.data(), 1, length, file) == length;
+    }
+  }
+  std::fclose(file);
+  if(!ok)
+    levels.clear();
+  return ok;
+}
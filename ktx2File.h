@@ -0,0 +1,29 @@
+// ----------------------------------------------------------------------------
+// ktx2File.h
+//
+// Description: Minimal KTX 2.0 reader and writer for block-compressed 2D
+//              textures with a mip chain (no supercompression, no key/value
+//              data), as produced by the texture compression cache.
+// ----------------------------------------------------------------------------
+
+#ifndef KTX2_FILE_H
+#define KTX2_FILE_H
+
+#include "mipmapGenerator.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Vulkan formats used in the files
+const static uint32_t kVkFormatBC1RGBUnorm = 131;
+const static uint32_t kVkFormatBC1RGBSrgb = 132;
+
+// Writes a BC1 texture: levels[i].pixels holds the blocks of level i. Returns false on I/O errors.
+bool writeKtx2(const std::string &path, uint32_t vkFormat, const std::vector<MipLevel> &levels);
+
+// Reads a texture written by writeKtx2. Returns false (and leaves levels empty) if the file is
+// missing, truncated, or of an unsupported kind.
+bool readKtx2(const std::string &path, uint32_t &vkFormat, std::vector<MipLevel> &levels);
+
+#endif // KTX2_FILE_H
@@ -25,6 +25,7 @@
 #include <glm/ext.hpp>
 
 #include <cstdlib>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -33,28 +34,166 @@
 #include <cmath>
 #include <memory>
 #include <random>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "threadPool.h"
+#include "frustumCulling.h"
+#include "occlusionCulling.h"
+#include "drawList.h"
+#include "textureArray.h"
+#include "textureLoader.h"
+#include "dynamicResolution.h"
+#include "pixelReadback.h"
+#include "videoRecorder.h"
+#include "framePacer.h"
+#include "shaderPermutations.h"
+#include "programBinaryCache.h"
+#include "fileWatcher.h"
+#include "virtualTexture.h"
+#include "keplerPropagator.h"
+#include "barnesHut.h"
+#include "simulationClock.h"
+#include "headlessContext.h"
+#include "gpuNBody.h"
+#include "sceneGraph.h"
+#include "instanceRingBuffer.h"
+#include "transformBatch.h"
+
 // constants
 const static float kSizeSun = 1;
 const static float kSizeEarth = 0.5;
 const static float kSizeMoon = 0.25;
-const static float kRadOrbitEarth = 10;
+const static float kRadOrbitEarth = 10; // semi-major axes
 const static float kRadOrbitMoon = 2;
+const static double kEccentricityEarth = 0.0167;
+const static double kEccentricityMoon = 0.0549;
+const static double kInclinationMoon = 5.145 * M_PI / 180.; // to the ecliptic
+const static float kMinOccluderRadius = 0.4; // Bodies at least this large hide the ones behind them
 
 // light source position
 const static glm::vec3 light = {0., 0., 0.};
 
-// Model transformation matrices
-glm::mat4 g_sun, g_earth, g_moon;
+// Model transformations: the orbit nodes carry the positions, the body nodes their spin and size
+SceneGraph g_scene;
+int g_sunNode = -1;
+int g_earthOrbitNode = -1; // sun -> earth orbit -> earth
+int g_earthNode = -1;
+int g_moonOrbitNode = -1;  // earth orbit -> moon orbit -> moon, unaffected by the earth's spin
+int g_moonNode = -1;
+
+// Orbits of the bodies, and of asteroids only propagated (--asteroids N) to measure the propagator
+KeplerPropagator g_orbits;
+int g_earthOrbit = -1;
+int g_moonOrbit = -1;
+size_t g_asteroidCount = 0;
+
+// N-body mode (--nbody N): the sun, earth, moon and N asteroids move under their mutual gravity
+// (Barnes-Hut) instead of following their orbits; --nbody-benchmark prints its scaling and exits
+bool g_nbodyMode = false;
+size_t g_nbodyAsteroids = 0;
+BarnesHutGravity g_gravity;
+std::vector<float> g_nbodySizes; // of every simulated body: sun, earth, moon, then the asteroids
+const static double kMassSun = 175.; // with G = 1, the earth keeps its former angular speed
+const static double kMassEarth = 75.; // heavy enough for the moon's orbit to stay stable (half its Hill radius)
+const static double kMassMoon = 0.5;
+const static double kMassAsteroid = 1e-4;
+// The N-body simulation advances by fixed steps (--physics-step S, --integrator euler|leapfrog|yoshida4),
+// rendered interpolated between the last two states. Under time warp (--warp X), the steps of a frame
+// are kept within --sim-budget MS of CPU (8 by default)
+SimulationClock g_simulationClock;
+// Steps grow at most to this many accurate steps to keep up with the warp, by integrator: half the
+// step at which the moon's orbit degrades (symplectic Euler already drifts at the accurate step)
+const static double kMaxStepFactorEuler = 1.;
+const static double kMaxStepFactorLeapfrog = 8.;
+const static double kMaxStepFactorYoshida4 = 6.;
+std::vector<glm::dvec3> g_previousPositions;
 
 // Window parameters
 GLFWwindow *g_window = nullptr;
+int g_windowWidth = 1024; // --size WxH
+int g_windowHeight = 768;
+
+// Headless mode: frames rendered offscreen and read back. --headless uses an invisible GLFW window on
+// an OSMesa context, which needs no display only when GLFW is built without window system
+// (-DHEADLESS_OSMESA=ON); --headless=egl skips GLFW for a surfaceless EGL context, on any build
+bool g_headless = false; // --headless[=osmesa|egl]
+bool g_headlessEgl = false;
+HeadlessContext g_headlessContext;
+bool g_closeRequested = false; // ends the frame loop when there is no window to close
+GLADloadproc g_glLoader = (GLADloadproc)glfwGetProcAddress; // GL entry points of the current context
+PixelReadback g_readback; // also feeds the video recorder
+uint64_t g_readbackBytes = 0;
+
+// Video export: read back frames are streamed to a Y4M file or pipe by a background thread
+std::string g_recordPath; // --record PATH ("-" for stdout, "|command" for a pipe)
+int g_recordFps = 60; // --record-fps N, also the simulation rate of the recorded frames
+Y4mRecorder g_recorder;
+
+// Frame pacing: vsync, optional frame rate cap, and a low idle rate while paused without input
+int g_swapInterval = 1; // --swap-interval N (0 disables vsync), toggled with the V key
+FramePacer g_framePacer; // --fps-cap N, --idle-fps N
+
+// Simulated time of the rendered frame, from g_simulationClock: paused with the P key, stepped with
+// the period key while paused, warped by the +/- keys (x10, x0.1) and reset to real time with backspace
+double g_simulationTime = 0.;
+
+// Frame statistics
+uint64_t g_frameIndex = 0;
+uint64_t g_maxFrames = 0; // --frames N exits after N frames, 0 runs until the window is closed
+bool g_logFps = false; // --log-fps prints the frame rate every second (always on in headless mode)
+
+// Worker threads for the CPU-side stages (culling, ...)
+std::unique_ptr<ThreadPool> g_threadPool;
+
+// Frustum culling: world-space bounding spheres of the bodies and indices of the visible ones
+BoundingSphereSoA g_bodySpheres;
+std::vector<uint32_t> g_visibleBodies;
+
+// Occlusion culling: visible bodies large enough to hide others, and the GPU queries of the small ones
+OcclusionMode g_occlusionMode = OcclusionMode::HardwareQueries;
+OcclusionQueries g_occlusionQueries;
+std::vector<uint32_t> g_occluders;
+std::vector<uint32_t> g_occludees;
+
+// Draw commands of the kept bodies, recorded by the worker threads and replayed on the GL thread
+DrawListRecorder g_drawLists;
+
+// Dynamic resolution: the scene is rendered offscreen at a scale chosen from the GPU frame time
+bool g_dynamicResolution = true; // toggled with the R key, disabled by --no-dynamic-resolution
+bool g_logResolution = false; // --log-resolution prints the controller state every second
+ResolutionController g_resolutionController;
+GpuFrameTimer g_gpuFrameTimer;
+ScaledFramebuffer g_sceneFramebuffer;
 
 // GPU objects
-GLuint g_program = 0; // A GPU program contains at least a vertex shader and a fragment shader
+GLuint g_program = 0; // A GPU program contains at least a vertex shader and a fragment shader (the active body shader permutation)
+GLuint g_proxyProgram = 0; // Draws the bounding boxes used by the occlusion queries
+
+// Uniform locations of g_program, queried once after linking
+struct ProgramUniforms {
+  GLint camPos = -1;
+  GLint ambient = -1;
+  GLint lightning = -1;
+  GLint viewMat = -1;
+  GLint projMat = -1;
+  GLint transMat = -1;
+  GLint albedoLayer = -1;
+} g_uniforms;
+
+// Body shader permutations, compiled on first use (see shaderPermutations.h)
+ShaderPermutationCache g_bodyShaders;
+ProgramUniforms g_variantUniforms[1 << kNumShaderFeatures]; // uniform locations of every permutation
+ProgramBinaryCache g_programCache; // linked programs of previous runs, disabled by --no-shader-cache
+bool g_useProgramCache = true;
+uint64_t g_programCacheKeys[1 << kNumShaderFeatures] = {}; // keys of the programs to store once linked, 0 if loaded from the cache
+double g_shaderStartTime = 0.; // when the first permutation was submitted, to report the compile time
+bool g_watchShaders = false; // --watch-shaders recompiles the body shaders when their files change
+FileWatcher g_shaderWatcher;
 
 // OpenGL identifiers
 GLuint g_vao = 0;
@@ -66,6 +205,45 @@ GLuint g_ibo = 0;
 GLuint g_earthTexID;
 GLuint g_moonTexID;
 
+// Texture array holding every albedo map (one layer per body), bound once to texture unit 1
+bool g_useTextureArray = true; // --separate-textures binds one GL_TEXTURE_2D per draw instead
+GLuint g_albedoArrayTexID = 0;
+AsyncTextureLoader g_textureLoader; // decodes the textures on the thread pool and streams them to the GPU
+size_t g_textureUploadBudget = 8 << 20; // bytes uploaded per frame at most, --texture-budget in MiB
+const static glm::vec3 kTexturePlaceholder(0.5f); // shown until the pixels of a texture are uploaded
+int g_earthTexLayer = -1;
+int g_moonTexLayer = -1;
+
+// Virtual texture of the Earth (--virtual-texture IMAGE), its tile cache bound to texture units 2 and 3
+std::string g_virtualTextureImage;
+int g_virtualTexturePages = 16; // --vt-cache-pages N: the cache holds N x N tiles
+VirtualTexture g_virtualTexture;
+GLuint g_feedbackProgram = 0; // writes the tiles needed by each pixel
+ProgramUniforms g_feedbackUniforms;
+
+// With --nbody-gpu, the N-body simulation runs as direct sums in a compute shader (GL 4.3) and the
+// asteroids are drawn instanced from its buffers; only the sun, earth and moon positions come back
+bool g_nbodyGpu = false;
+GpuNBody g_gpuNBody;
+GLuint g_nbodyComputeProgram = 0;
+GLuint g_nbodyDrawProgram = 0;
+ProgramUniforms g_nbodyDrawUniforms;
+GLint g_nbodyAlphaLocation = -1;
+GLint g_nbodyFirstBodyLocation = -1;
+std::vector<glm::vec4> g_readbackPrevious, g_readbackCurrent; // of the sun, earth and moon
+const static GLuint kNBodyPreviousBinding = 0; // SSBO bindings of nbodyVertexShader.glsl
+const static GLuint kNBodyCurrentBinding = 1;
+const static GLuint kNBodySizeBinding = 3;
+
+// On the CPU, the asteroid matrices are composed in SIMD batches straight into the instance ring
+TrsArrays g_asteroidTransforms;
+InstanceRingBuffer g_instanceRing;
+GLuint g_instanceProgram = 0;
+ProgramUniforms g_instanceUniforms;
+
+const static int kVirtualPhysicalUnit = 2;
+const static int kVirtualIndirectionUnit = 3;
+
 // All vertex positions packed in one array [x0, y0, z0, x1, y1, z1, ...]
 std::vector<float> g_vertexPositions;
 // All vertex colors packed in one array [r0, g0, b0, r1, g1, b1, ...]
@@ -146,6 +324,28 @@ private:
 };
 Camera g_camera;
 
+// Sets the uniforms shared by every draw of the frame: camera and light
+void setFrameUniforms() {
+  const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
+  const glm::mat4 projMatrix = g_camera.computeProjectionMatrix();
+  const glm::vec3 camPosition = g_camera.getPosition();
+
+  glUniform3f(g_uniforms.camPos, camPosition[0], camPosition[1], camPosition[2]); // compute the camera position vector
+  glUniform3f(g_uniforms.lightning, light[0], light[1], light[2]); // compute the ambient color matrix
+  glUniformMatrix4fv(g_uniforms.viewMat, 1, GL_FALSE, glm::value_ptr(viewMatrix)); // compute the view matrix of the camera and pass it to the GPU program
+  glUniformMatrix4fv(g_uniforms.projMat, 1, GL_FALSE, glm::value_ptr(projMatrix)); // compute the projection matrix of the camera and pass it to the GPU program
+}
+
+// Makes the body shader permutation with the given features current, and sets its frame uniforms
+// (or the fallback permutation while it is compiling)
+void activateShaderVariant(uint32_t features) {
+  const uint32_t used = g_bodyShaders.resolve(features);
+  g_program = g_bodyShaders.getProgram(used);
+  g_uniforms = g_variantUniforms[used];
+  glUseProgram(g_program);
+  setFrameUniforms();
+}
+
 // Class mesh for geometry manipulation
 class Mesh {
   public:
@@ -224,26 +424,45 @@ class Mesh {
     }
 
     void render() { // should be called in the main rendering loop
-      const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
-      const glm::mat4 projMatrix = g_camera.computeProjectionMatrix();
-      const glm::vec3 camPosition = g_camera.getPosition();
-
-      glActiveTexture(GL_TEXTURE0); // activate texture unit 0
-      glBindTexture(GL_TEXTURE_2D, m_texID);
-
-      glUniform1i(glGetUniformLocation(g_program, "texture"), textureMode); // compute the display mode of the triangles : 1 for texture, and 0 for uniform color
-      glUniform3f(glGetUniformLocation(g_program, "camPos"), camPosition[0], camPosition[1], camPosition[2]); // compute the camera position vector
-      glUniform3f(glGetUniformLocation(g_program, "ambient"), m_ambientColor[0], m_ambientColor[1], m_ambientColor[2]); // compute the ambient color matrix
-      glUniform3f(glGetUniformLocation(g_program, "lightning"), light[0], light[1], light[2]); // compute the ambient color matrix
-      glUniformMatrix4fv(glGetUniformLocation(g_program, "viewMat"), 1, GL_FALSE, glm::value_ptr(viewMatrix)); // compute the view matrix of the camera and pass it to the GPU program
-      glUniformMatrix4fv(glGetUniformLocation(g_program, "projMat"), 1, GL_FALSE, glm::value_ptr(projMatrix)); // compute the projection matrix of the camera and pass it to the GPU program
-      glUniformMatrix4fv(glGetUniformLocation(g_program, "transMat"), 1, GL_FALSE, glm::value_ptr(transformation)); // compute the transformation matrix of the mesh and pass it to the GPU program
-      
+      activateShaderVariant(getShaderFeatures());
+      bind();
+      draw(transformation);
+    }
+
+    void bind() const { // activates the geometry and material of the mesh for the following draws, with its shader permutation current
+      if (textureMode == 2) {
+        glUniform1i(g_uniforms.albedoLayer, m_texLayer); // the texture array stays bound to unit 1
+      } else if (textureMode == 1) {
+        glActiveTexture(GL_TEXTURE0); // activate texture unit 0
+        glBindTexture(GL_TEXTURE_2D, m_texID);
+      }
+
+      glUniform3f(g_uniforms.ambient, m_ambientColor[0], m_ambientColor[1], m_ambientColor[2]); // compute the ambient color matrix
 
       glBindVertexArray(m_vao);     // activate the VAO storing geometry data
+    }
+
+    void draw(const glm::mat4 &trans) const { // draws the bound mesh with the given model matrix
+      glUniformMatrix4fv(g_uniforms.transMat, 1, GL_FALSE, glm::value_ptr(trans)); // compute the transformation matrix of the mesh and pass it to the GPU program
       glDrawElements(GL_TRIANGLES, m_triangleIndices.size(), GL_UNSIGNED_INT, 0); // Call for rendering: stream the current GPU geometry through the current GPU program
     }
 
+    void setInstanceMatrices(GLuint buffer, size_t offset) const { // sources the per-instance model matrices (attributes 3 to 6) from buffer
+      glBindVertexArray(m_vao);
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+      for (GLuint column = 0; column < 4; column++) {
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), reinterpret_cast<const void *>(offset + column * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(3 + column);
+        glVertexAttribDivisor(3 + column, 1);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void drawInstanced(GLsizei instances) const { // draws instances of the mesh, placed by the current program
+      glBindVertexArray(m_vao);
+      glDrawElementsInstanced(GL_TRIANGLES, m_triangleIndices.size(), GL_UNSIGNED_INT, 0, instances);
+    }
+
     void addTriangle(std::vector<float> const &verPos) { // Properly add a triangle to the mesh
       assert (verPos.size() >= 9);
       int size = m_vertexPositions.size() / 3;
@@ -256,6 +475,9 @@ class Mesh {
       for (int i = 0; i < 9; i++) {
         m_vertexPositions.push_back(verPos[i]);
       }
+      for (int i = 0; i < 9; i += 3) {
+        m_boundingRadius = std::max(m_boundingRadius, glm::length(glm::vec3(verPos[i], verPos[i+1], verPos[i+2])));
+      }
       for (unsigned int i = 0; i < 3; i++) {
         m_triangleIndices.push_back(size + 2 - i);
         m_triangleNormals.push_back(-n[i]);
@@ -267,14 +489,50 @@ class Mesh {
       m_ambientColor = amb;
     }
 
-    void setTransformation(glm::mat4 &trans) {
+    void setTransformation(const glm::mat4 &trans) {
       transformation = trans;
     }
 
+    const glm::mat4 &getTransformation() const {
+      return transformation;
+    }
+
+    // Bounding sphere (center, radius) of the mesh in world space, for culling
+    glm::vec4 computeWorldBoundingSphere() const {
+      const float scale = std::max(glm::length(glm::vec3(transformation[0])), std::max(glm::length(glm::vec3(transformation[1])), glm::length(glm::vec3(transformation[2]))));
+      return glm::vec4(glm::vec3(transformation[3]), m_boundingRadius * scale);
+    }
+
     void setTexID(GLuint &texID) {
       m_texID = texID;
       textureMode = 1;
     }
+
+    void setTexLayer(int layer) { // uses a layer of the albedo texture array
+      m_texLayer = layer;
+      textureMode = 2;
+    }
+
+    void setVirtualTexture() { // samples g_virtualTexture, whose textures stay bound to their units
+      textureMode = 3;
+    }
+
+    bool usesVirtualTexture() const {
+      return textureMode == 3;
+    }
+
+    void setEmissive(bool emissive) { // light sources are displayed with their albedo, without shading
+      m_emissive = emissive;
+    }
+
+    uint32_t getShaderFeatures() const { // shader permutation needed to draw the mesh
+      uint32_t features = 0;
+      if (textureMode == 3) features = kShaderVirtualTexture;
+      else if (textureMode == 2) features = kShaderTextureArray;
+      else if (textureMode == 1) features = kShaderTextured;
+      if (m_emissive) features |= kShaderEmissive;
+      return features;
+    }
     
     static std::shared_ptr<Mesh> genSphere(size_t const resolution=16) { // should generate a unit sphere
       std::shared_ptr<Mesh> m = std::make_shared<Mesh>();
@@ -329,66 +587,123 @@ class Mesh {
     std::vector<float> m_triangleNormals; // Normal of all triangles (not necessary for sphere mesh)
     std::vector<float> m_vertexTexCoords; // Coordonates of the vertex in the texture map
     glm::mat4 transformation = glm::mat4(1.0); //Transformation matrix
+    float m_boundingRadius = 0.f; // Radius of the bounding sphere centered on the local origin
     GLuint m_colVbo = 0;
     GLuint m_vao = 0;
     GLuint m_posVbo = 0;
     GLuint m_normalVbo = 0;
     GLuint m_texCoordVbo = 0;
     GLuint m_texID = 0; // ID of the texture
-    GLuint textureMode = 0; // 0 if the mesh uses an ambient color, 1 if it uses a texture
+    int m_texLayer = 0; // Layer of the albedo texture array
+    GLuint textureMode = 0; // 0 if the mesh uses an ambient color, 1 if it uses a texture, 2 if it uses a texture array layer, 3 if it uses the virtual texture
+    bool m_emissive = false; // true for light sources
     // ...
   
 };
 
+// Creates the texture right away, showing a placeholder color; the image is decoded on the thread
+// pool and uploaded over the next frames by g_textureLoader
 GLuint loadTextureFromFileToGPU(const std::string &filename) {
-  int width, height, numComponents;
-  // Loading the image in CPU memory using stb_image
-  unsigned char *data = stbi_load(
-    filename.c_str(),
-    &width, &height,
-    &numComponents, // 1 for a 8 bit grey-scale image, 3 for 24bits RGB image, 4 for 32bits RGBA image
-    0);
-
-  GLuint texID; // OpenGL texture identifier
-  glGenTextures(1, &texID); // generate an OpenGL texture container
-  glBindTexture(GL_TEXTURE_2D, texID); // activate the texture
-  // Setup the texture filtering option and repeat mode; check www.opengl.org for details.
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  // Fill the GPU texture with the data stored in the CPU image
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-  // Free useless CPU memory
-  stbi_image_free(data);
-  glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
-
-  return texID;
+  return g_textureLoader.loadTexture(filename, kTexturePlaceholder);
 }
 
 // Executed each time the window is resized. Adjust the aspect ratio and the rendering viewport to the current window.
 void windowSizeCallback(GLFWwindow* window, int width, int height) {
   g_camera.setAspectRatio(static_cast<float>(width)/static_cast<float>(height));
   glViewport(0, 0, (GLint)width, (GLint)height); // Dimension of the rendering region in the window
+
+  int fbWidth, fbHeight;
+  glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+  g_sceneFramebuffer.resize(fbWidth, fbHeight); // the offscreen target follows the window
 }
 
 // Executed each time a key is entered.
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+  g_framePacer.notifyActivity();
   if(action == GLFW_PRESS && key == GLFW_KEY_W) {
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   } else if(action == GLFW_PRESS && key == GLFW_KEY_F) {
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  } else if(action == GLFW_PRESS && key == GLFW_KEY_O) {
+    // Cycle the occlusion culling mode: hardware queries -> CPU spheres -> off
+    if(g_occlusionMode == OcclusionMode::HardwareQueries) {
+      g_occlusionMode = OcclusionMode::CpuSpheres;
+      std::cout << "Occlusion culling: CPU spheres" << std::endl;
+    } else if(g_occlusionMode == OcclusionMode::CpuSpheres) {
+      g_occlusionMode = OcclusionMode::Off;
+      std::cout << "Occlusion culling: off" << std::endl;
+    } else {
+      g_occlusionMode = OcclusionMode::HardwareQueries;
+      std::cout << "Occlusion culling: hardware queries" << std::endl;
+    }
+  } else if(action == GLFW_PRESS && key == GLFW_KEY_R) {
+    g_dynamicResolution = !g_dynamicResolution;
+    g_resolutionController.reset();
+    std::cout << "Dynamic resolution: " << (g_dynamicResolution ? "on" : "off") << std::endl;
+  } else if(action == GLFW_PRESS && key == GLFW_KEY_P) {
+    g_simulationClock.setPaused(!g_simulationClock.isPaused());
+    g_framePacer.setPaused(g_simulationClock.isPaused());
+  } else if(action == GLFW_PRESS && key == GLFW_KEY_PERIOD) {
+    g_simulationClock.requestStep();
+  } else if((action == GLFW_PRESS || action == GLFW_REPEAT) && (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD)) {
+    g_simulationClock.setWarp(g_simulationClock.getWarp() * 10.);
+    std::cout << "Time warp: x" << g_simulationClock.getWarp() << std::endl;
+  } else if((action == GLFW_PRESS || action == GLFW_REPEAT) && (key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT)) {
+    g_simulationClock.setWarp(g_simulationClock.getWarp() / 10.);
+    std::cout << "Time warp: x" << g_simulationClock.getWarp() << std::endl;
+  } else if(action == GLFW_PRESS && key == GLFW_KEY_BACKSPACE) {
+    g_simulationClock.setWarp(1.);
+    std::cout << "Time warp: x1" << std::endl;
+  } else if(action == GLFW_PRESS && key == GLFW_KEY_V) {
+    g_swapInterval = g_swapInterval ? 0 : 1;
+    glfwSwapInterval(g_swapInterval);
+    std::cout << "Vsync: " << (g_swapInterval ? "on" : "off") << std::endl;
   } else if(action == GLFW_PRESS && (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)) {
     glfwSetWindowShouldClose(window, true); // Closes the application if the escape key is pressed
   }
 }
 
+// Executed on mouse and window events: only keeps the application out of its idle rate
+void cursorPosCallback(GLFWwindow*, double, double) {
+  g_framePacer.notifyActivity();
+}
+
+void mouseButtonCallback(GLFWwindow*, int, int, int) {
+  g_framePacer.notifyActivity();
+}
+
+void windowRefreshCallback(GLFWwindow*) {
+  g_framePacer.notifyActivity();
+}
+
+// Seconds since the first call, with or without GLFW
+double currentTime() {
+  static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Size of the default framebuffer, or of the requested frames without window
+void getFramebufferSize(int &width, int &height) {
+  if(g_window) {
+    glfwGetFramebufferSize(g_window, &width, &height);
+  } else {
+    width = g_windowWidth;
+    height = g_windowHeight;
+  }
+}
+
 void errorCallback(int error, const char *desc) {
   std::cout <<  "Error " << error << ": " << desc << std::endl;
 }
 
 void initGLFW() {
+  if(g_headlessEgl) { // no window system at all: GLFW stays uninitialized
+    if(!g_headlessContext.create(3, 3)) {
+      std::exit(EXIT_FAILURE);
+    }
+    g_glLoader = HeadlessContext::getProcAddress;
+    return;
+  }
   glfwSetErrorCallback(errorCallback);
 
   // Initialize GLFW, the library responsible for window management
@@ -402,11 +717,15 @@ void initGLFW() {
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+  glfwWindowHint(GLFW_RESIZABLE, g_recordPath.empty() ? GL_TRUE : GL_FALSE); // a video cannot change size
+  if(g_headless) {
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+  }
 
   // Create the window
   g_window = glfwCreateWindow(
-    1024, 768,
+    g_windowWidth, g_windowHeight,
     "Interactive 3D Applications (OpenGL) - Simple Solar System",
     nullptr, nullptr);
   if(!g_window) {
@@ -419,11 +738,17 @@ void initGLFW() {
   glfwMakeContextCurrent(g_window);
   glfwSetWindowSizeCallback(g_window, windowSizeCallback);
   glfwSetKeyCallback(g_window, keyCallback);
+  glfwSetCursorPosCallback(g_window, cursorPosCallback);
+  glfwSetMouseButtonCallback(g_window, mouseButtonCallback);
+  glfwSetWindowRefreshCallback(g_window, windowRefreshCallback);
+  if(!g_headless) {
+    glfwSwapInterval(g_swapInterval); // 1 waits for the vertical blank in glfwSwapBuffers
+  }
 }
 
 void initOpenGL() {
   // Load extensions for modern OpenGL
-  if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+  if(!gladLoadGLLoader(g_glLoader)) {
     std::cerr << "ERROR: Failed to initialize OpenGL context" << std::endl;
     glfwTerminate();
     std::exit(EXIT_FAILURE);
@@ -444,40 +769,287 @@ std::string file2String(const std::string &filename) {
   return buffer.str();
 }
 
-// Loads and compile a shader, before attaching it to a program
-void loadShader(GLuint program, GLenum type, const std::string &shaderFilename) {
+// Loads and compile a shader, before attaching it to a program. The defines ("#define NAME\n" lines)
+// are inserted after the #version line, to select a permutation of the shader. The compile status
+// is not queried here, that would wait for the compilation: checkProgram reports the errors after linking.
+void loadShader(GLuint program, GLenum type, const std::string &shaderFilename, const std::string &defines = "") {
   GLuint shader = glCreateShader(type); // Create the shader, e.g., a vertex shader to be applied to every single vertex of a mesh
-  std::string shaderSourceString = file2String(shaderFilename); // Loads the shader source from a file to a C++ string
+  std::string shaderSourceString = injectShaderDefines(file2String(shaderFilename), defines); // Loads the shader source from a file to a C++ string
   const GLchar *shaderSource = (const GLchar *)shaderSourceString.c_str(); // Interface the C++ string through a C pointer
   glShaderSource(shader, 1, &shaderSource, NULL); // load the vertex shader code
   glCompileShader(shader);
+  glAttachShader(program, shader);
+  glDeleteShader(shader); // deleted along with the program
+}
+
+// Complete info logs, whatever their length
+std::string shaderInfoLog(GLuint shader) {
+  GLint length = 0;
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+  std::string log(std::max(length, 1), '\0');
+  glGetShaderInfoLog(shader, length, NULL, &log[0]);
+  return log.c_str(); // without the terminating null
+}
+
+std::string programInfoLog(GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+  std::string log(std::max(length, 1), '\0');
+  glGetProgramInfoLog(program, length, NULL, &log[0]);
+  return log.c_str();
+}
+
+// Waits for the link of program, and prints the compile and link errors if it failed
+bool checkProgram(GLuint program, const std::string &name) {
   GLint success;
-  GLchar infoLog[512];
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-  if(!success) {
-    glGetShaderInfoLog(shader, 512, NULL, infoLog);
-    std::cout << "ERROR in compiling " << shaderFilename << "\n\t" << infoLog << std::endl;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (success) {
+    return true;
   }
-  glAttachShader(program, shader);
-  glDeleteShader(shader);
+  GLuint shaders[2];
+  GLsizei numShaders = 0;
+  glGetAttachedShaders(program, 2, &numShaders, shaders);
+  for (GLsizei i = 0; i < numShaders; i++) {
+    glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+    if (!success) {
+      std::cout << "ERROR in compiling a shader of " << name << "\n\t" << shaderInfoLog(shaders[i]) << std::endl;
+    }
+  }
+  std::cout << "ERROR in linking " << name << "\n\t" << programInfoLog(program) << std::endl;
+  return false;
 }
 
-void initGPUprogram() {
-  g_program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
-  loadShader(g_program, GL_VERTEX_SHADER, "vertexShader.glsl");
-  loadShader(g_program, GL_FRAGMENT_SHADER, "fragmentShader.glsl");
-  glLinkProgram(g_program); // The main GPU program is ready to be handle streams of polygons
+// Submits the compilation and link of the body program with the given features, without waiting
+// (loaded from the program binary cache when it holds this exact program)
+GLuint submitBodyProgram(uint32_t features, const std::string &defines) {
+  if (g_shaderStartTime == 0.) {
+    g_shaderStartTime = currentTime();
+  }
+  GLuint program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
+  const uint64_t cacheKey = g_programCache.computeKey({file2String("vertexShader.glsl"), file2String("fragmentShader.glsl"), defines});
+  g_programCacheKeys[features] = 0;
+  if (!g_programCache.load(cacheKey, program)) {
+    loadShader(program, GL_VERTEX_SHADER, "vertexShader.glsl", defines);
+    loadShader(program, GL_FRAGMENT_SHADER, "fragmentShader.glsl", defines);
+    g_programCache.setRetrievable(program);
+    glLinkProgram(program); // The main GPU program is ready to be handle streams of polygons
+    g_programCacheKeys[features] = cacheKey;
+  }
+  return program;
+}
 
-  glUseProgram(g_program);
+// Checks the linked body program, stores it in the binary cache and queries its uniform locations
+bool finishBodyProgram(uint32_t features, GLuint program) {
+  if (!checkProgram(program, "the body program with\n" + shaderFeatureDefines(features))) {
+    return false;
+  }
+  if (g_programCacheKeys[features]) {
+    g_programCache.store(g_programCacheKeys[features], program);
+  }
+
+  ProgramUniforms &uniforms = g_variantUniforms[features];
+  uniforms.camPos = glGetUniformLocation(program, "camPos");
+  uniforms.ambient = glGetUniformLocation(program, "ambient");
+  uniforms.lightning = glGetUniformLocation(program, "lightning");
+  uniforms.viewMat = glGetUniformLocation(program, "viewMat");
+  uniforms.projMat = glGetUniformLocation(program, "projMat");
+  uniforms.transMat = glGetUniformLocation(program, "transMat");
+  uniforms.albedoLayer = glGetUniformLocation(program, "material.albedoLayer");
+
+  GLint previous;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "material.albedoTex"), 0); // texture unit 0
+  glUniform1i(glGetUniformLocation(program, "material.albedoArray"), 1); // texture unit 1
+  glUseProgram(previous);
+  if (features & kShaderVirtualTexture) {
+    g_virtualTexture.setProgramUniforms(program, kVirtualPhysicalUnit, kVirtualIndirectionUnit);
+  }
+  return true;
+}
+
+void initGPUprogram() {
+  if (g_useProgramCache && !g_programCache.init("shaderCache", g_glLoader)) {
+    std::cout << "Program binaries not supported by the driver, shaders are compiled at every launch" << std::endl;
+  }
+  g_bodyShaders.enableParallelCompile(g_glLoader);
+  g_bodyShaders.setBuilder(submitBodyProgram, finishBodyProgram);
+  g_bodyShaders.setFallback(0); // plain ambient color
+  // The permutations expected by the scene compile while the textures are decoded
+  g_bodyShaders.request(0);
+  g_bodyShaders.request(kShaderEmissive);
+  g_bodyShaders.request(g_useTextureArray ? kShaderTextureArray : kShaderTextured);
   // TODO: set shader variables, textures, etc.
-  g_earthTexID = loadTextureFromFileToGPU("media/earth.jpg");
-  g_moonTexID = loadTextureFromFileToGPU("media/moon.jpg");
-  glUniform1i(glGetUniformLocation(g_program, "material.albedoTex"), 0); // texture unit 0
+  g_textureLoader.init(g_threadPool.get(), g_textureUploadBudget);
+  if (g_useTextureArray) {
+    TextureArrayBuilder albedoArray;
+    g_earthTexLayer = albedoArray.addFile("media/earth.jpg");
+    g_moonTexLayer = albedoArray.addFile("media/moon.jpg");
+    g_albedoArrayTexID = albedoArray.create(g_textureLoader.getMipmaps(), g_textureLoader.getCompression());
+    if (g_albedoArrayTexID == 0) {
+      std::cerr << "WARNING: texture array unavailable, falling back to separate textures" << std::endl;
+      g_useTextureArray = false;
+      g_earthTexLayer = g_moonTexLayer = -1;
+    }
+    for (int layer = 0; layer < static_cast<int>(albedoArray.numLayers()) && g_useTextureArray; layer++) {
+      g_textureLoader.loadLayer(g_albedoArrayTexID, layer, albedoArray.getWidth(), albedoArray.getHeight(), albedoArray.getFile(layer), kTexturePlaceholder);
+    }
+  }
+  if (!g_useTextureArray) {
+    g_earthTexID = loadTextureFromFileToGPU("media/earth.jpg");
+    g_moonTexID = loadTextureFromFileToGPU("media/moon.jpg");
+  }
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, g_albedoArrayTexID);
+  glActiveTexture(GL_TEXTURE0);
+
+  if (g_watchShaders) {
+    g_shaderWatcher.addFile("vertexShader.glsl");
+    g_shaderWatcher.addFile("fragmentShader.glsl");
+    if (g_nbodyMode) {
+      g_shaderWatcher.addFile("instancedVertexShader.glsl");
+      g_shaderWatcher.addFile("nbodyVertexShader.glsl");
+      g_shaderWatcher.addFile("nbodyComputeShader.glsl");
+    }
+    g_shaderWatcher.start();
+  }
+}
+
+void buildAsteroidPrograms();
+
+// Recompiles the body shaders when the watcher saw their files change; the new programs replace
+// the current ones from the frame where they are linked, and only if they link. The few asteroid
+// programs, which share the fragment shader, are rebuilt at once.
+void reloadChangedShaders() {
+  std::vector<std::string> changed;
+  if (!g_shaderWatcher.isRunning() || !g_shaderWatcher.takeChanged(changed)) {
+    return;
+  }
+  for (const std::string &file : changed) {
+    std::cout << "Shader changed: " << file << ", recompiling" << std::endl;
+  }
+  g_bodyShaders.reloadAll();
+  buildAsteroidPrograms();
+}
+
+void initOcclusionCulling() {
+  g_proxyProgram = glCreateProgram();
+  loadShader(g_proxyProgram, GL_VERTEX_SHADER, "proxyVertexShader.glsl");
+  loadShader(g_proxyProgram, GL_FRAGMENT_SHADER, "proxyFragmentShader.glsl");
+  glLinkProgram(g_proxyProgram);
+  checkProgram(g_proxyProgram, "the occlusion proxy program");
+  g_occlusionQueries.init(g_proxyProgram);
+}
+
+// Opens the virtual texture given by --virtual-texture (its tile pyramid is built next to the image on
+// the first run) and the program of its feedback pass
+void initVirtualTexture() {
+  if (g_virtualTextureImage.empty()) {
+    return;
+  }
+  if (!g_virtualTexture.init(g_virtualTextureImage, g_virtualTextureImage + ".vt", g_threadPool.get(), g_virtualTexturePages)) {
+    std::cerr << "WARNING: virtual texture unavailable, the Earth keeps its albedo map" << std::endl;
+    return;
+  }
+  g_feedbackProgram = glCreateProgram();
+  loadShader(g_feedbackProgram, GL_VERTEX_SHADER, "vertexShader.glsl");
+  loadShader(g_feedbackProgram, GL_FRAGMENT_SHADER, "vtFeedbackShader.glsl");
+  glLinkProgram(g_feedbackProgram);
+  checkProgram(g_feedbackProgram, "the virtual texture feedback program");
+  g_feedbackUniforms.viewMat = glGetUniformLocation(g_feedbackProgram, "viewMat");
+  g_feedbackUniforms.projMat = glGetUniformLocation(g_feedbackProgram, "projMat");
+  g_feedbackUniforms.transMat = glGetUniformLocation(g_feedbackProgram, "transMat");
+  g_virtualTexture.setProgramUniforms(g_feedbackProgram, kVirtualPhysicalUnit, kVirtualIndirectionUnit);
+  g_virtualTexture.bindTextures(kVirtualPhysicalUnit, kVirtualIndirectionUnit);
+  glActiveTexture(GL_TEXTURE0);
+  g_bodyShaders.request(kShaderVirtualTexture);
+  std::cout << "Virtual texture: " << g_virtualTexture.pageCount() << " cache pages, " << g_virtualTexture.cacheBytes() / (1024*1024) << " MiB of GPU memory" << std::endl;
+}
+
+void initDynamicResolution() {
+  int width, height;
+  getFramebufferSize(width, height);
+  g_sceneFramebuffer.resize(width, height);
+  g_gpuFrameTimer.init();
+  g_resolutionController.reset();
+}
+
+void initReadback() {
+  if (!g_headless && g_recordPath.empty()) {
+    return;
+  }
+  int width, height;
+  getFramebufferSize(width, height);
+  g_readback.init(width, height);
+  if (!g_recordPath.empty() && !g_recorder.open(g_recordPath, width, height, g_recordFps)) {
+    glfwTerminate();
+    std::exit(EXIT_FAILURE);
+  }
+  g_readback.setConsumer([](const unsigned char *pixels, int width, int height, uint64_t) {
+    g_readbackBytes += static_cast<uint64_t>(width) * height * 4;
+    if (g_recorder.isOpen()) {
+      g_recorder.pushFrame(pixels, true, g_headless); // offline renders keep every frame, interactive ones never wait for the disk
+    }
+  });
+  if (g_headless) {
+    std::cout << "Headless rendering at " << width << "x" << height << " on " << glGetString(GL_RENDERER) << std::endl;
+  }
+}
+
+void initThreadPool() {
+  g_threadPool.reset(new ThreadPool());
+}
+
+// Earth around the sun and moon around the earth at the speeds of the former circular orbits (0.5
+// and 2 rad/s), then a belt of asteroids beyond the earth
+void initOrbits(const float angV = 0.5f) {
+  OrbitalElements earth;
+  earth.semiMajorAxis = kRadOrbitEarth;
+  earth.eccentricity = kEccentricityEarth;
+  earth.meanMotion = angV;
+  g_earthOrbit = g_orbits.addBody(earth);
+
+  OrbitalElements moon;
+  moon.semiMajorAxis = kRadOrbitMoon;
+  moon.eccentricity = kEccentricityMoon;
+  moon.inclination = kInclinationMoon;
+  moon.meanMotion = 4 * angV;
+  g_moonOrbit = g_orbits.addBody(moon, g_earthOrbit);
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> unit(0., 1.);
+  for (size_t i = 0; i < g_asteroidCount; i++) {
+    OrbitalElements asteroid;
+    asteroid.semiMajorAxis = kRadOrbitEarth * (1.5 + 1.5 * unit(rng));
+    asteroid.eccentricity = 0.3 * unit(rng);
+    asteroid.inclination = 0.3 * unit(rng);
+    asteroid.ascendingNode = 2 * M_PI * unit(rng);
+    asteroid.argumentOfPeriapsis = 2 * M_PI * unit(rng);
+    asteroid.meanAnomaly = 2 * M_PI * unit(rng);
+    asteroid.meanMotion = angV * std::pow(asteroid.semiMajorAxis / kRadOrbitEarth, -1.5); // Kepler's third law
+    g_orbits.addBody(asteroid);
+  }
+}
+
+// Builds the transform hierarchy sun -> earth orbit -> {earth, moon orbit -> moon}
+void initScene() {
+  g_sunNode = g_scene.addNode();
+  g_earthOrbitNode = g_scene.addNode(g_sunNode);
+  g_earthNode = g_scene.addNode(g_earthOrbitNode);
+  g_moonOrbitNode = g_scene.addNode(g_earthOrbitNode);
+  g_moonNode = g_scene.addNode(g_moonOrbitNode);
+  g_scene.setScale(g_sunNode, glm::vec3(kSizeSun));
+  g_scene.setScale(g_earthNode, glm::vec3(kSizeEarth));
+  g_scene.setScale(g_moonNode, glm::vec3(kSizeMoon));
 }
 
 void initCamera() {
   int width, height;
-  glfwGetWindowSize(g_window, &width, &height);
+  if (g_window) {
+    glfwGetWindowSize(g_window, &width, &height);
+  } else {
+    getFramebufferSize(width, height);
+  }
   g_camera.setAspectRatio(static_cast<float>(width)/static_cast<float>(height));
 
   g_camera.setPosition(glm::vec3(0.0, 0.0, 5.0));
@@ -488,42 +1060,615 @@ void initCamera() {
 void init() {
   initGLFW();
   initOpenGL();
+  initThreadPool(); // the textures are decoded on the pool
+  initOrbits();
+  initScene();
   initGPUprogram();
+  initVirtualTexture();
   initCamera();
+  initOcclusionCulling();
+  initDynamicResolution();
+  initReadback();
 }
 
 void clear() {
-  glDeleteProgram(g_program);
-
-  glfwDestroyWindow(g_window);
+  g_textureLoader.release(); // before the pool: decodes in flight refer to the loader
+  g_virtualTexture.release(); // same for the tile reads
+  glDeleteProgram(g_feedbackProgram);
+  glDeleteTextures(1, &g_albedoArrayTexID);
+  g_threadPool.reset();
+  g_occlusionQueries.release();
+  g_gpuNBody.release();
+  glDeleteProgram(g_nbodyComputeProgram);
+  glDeleteProgram(g_nbodyDrawProgram);
+  g_instanceRing.release();
+  glDeleteProgram(g_instanceProgram);
+  g_gpuFrameTimer.release();
+  g_sceneFramebuffer.release();
+  g_readback.release();
+  g_recorder.close();
+  glDeleteProgram(g_proxyProgram);
+  g_shaderWatcher.stop();
+  g_bodyShaders.clear();
+
+  if (g_window) {
+    glfwDestroyWindow(g_window);
+  }
   glfwTerminate();
+  g_headlessContext.release();
 }
 
-// Update any accessible variable based on the current time
-void update(const float currentTimeInSec, std::shared_ptr<Mesh> &earth, std::shared_ptr<Mesh> &moon, const float angV = 0.5f) {
-  
-  float velocity = currentTimeInSec * angV; // Customisable speed of rotation
-  
-  g_earth = glm::translate(glm::mat4(1), glm::vec3(kRadOrbitEarth * cos(velocity), kRadOrbitEarth * sin(velocity), 0.));  
-  g_moon = glm::rotate(g_earth, 4 * velocity, glm::vec3(0, 0, 1));
-  g_moon = glm::translate(g_moon, glm::vec3(kRadOrbitMoon, 0., 0.));
+// Fills g_visibleBodies with the indices of the bodies intersecting the camera frustum (and, with
+// CPU occlusion culling, not hidden behind a larger body), then splits them in occluders and occludees
+void cullBodies(const std::vector<std::shared_ptr<Mesh>> &bodies) {
+  const Frustum frustum = extractFrustum(g_camera.computeProjectionMatrix() * g_camera.computeViewMatrix());
+  g_bodySpheres.resize(bodies.size());
+  g_threadPool->parallelFor(bodies.size(), 4096, [&bodies](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++) {
+      const glm::vec4 sphere = bodies[i]->computeWorldBoundingSphere();
+      g_bodySpheres.set(i, glm::vec3(sphere), sphere.w);
+    }
+  });
+  cullSpheres(frustum, g_bodySpheres, g_visibleBodies, g_threadPool.get());
+
+  g_occluders.clear();
+  g_occludees.clear();
+  for (uint32_t i : g_visibleBodies) {
+    if (g_occlusionMode != OcclusionMode::Off && g_bodySpheres.r()[i] >= kMinOccluderRadius) {
+      g_occluders.push_back(i);
+    } else {
+      g_occludees.push_back(i);
+    }
+  }
+  if (g_occlusionMode == OcclusionMode::CpuSpheres) {
+    cullOccludedSpheres(g_camera.getPosition(), g_bodySpheres, g_occluders, g_occludees);
+  }
+}
+
+// Records the draw commands of the bodies kept by cullBodies on the worker threads
+void recordDrawLists(const std::vector<std::shared_ptr<Mesh>> &bodies) {
+  const auto fill = [&bodies](uint32_t body, DrawCommand &cmd) {
+    cmd.shader = bodies[body]->getShaderFeatures();
+    cmd.mesh = body; // every body owns its mesh
+    cmd.body = body;
+    cmd.transform = bodies[body]->getTransformation();
+    return true;
+  };
+  g_drawLists.record(kDrawPassOccluders, g_occluders, fill, g_threadPool.get());
+  g_drawLists.record(kDrawPassOccludees, g_occludees, fill, g_threadPool.get());
+}
+
+// Draws the visible bodies using the virtual texture into its feedback buffer, which tells the tiles
+// and levels they need. The other visible bodies are drawn first into the depth buffer only, so that
+// the tiles they hide are neither requested nor kept resident.
+void renderVirtualTextureFeedback(const std::vector<std::shared_ptr<Mesh>> &bodies) {
+  if (!g_virtualTexture.isValid()) {
+    return;
+  }
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  g_virtualTexture.beginFeedback(viewport[2], viewport[3]);
+  g_program = g_feedbackProgram;
+  g_uniforms = g_feedbackUniforms;
+  glUseProgram(g_program);
+  setFrameUniforms();
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  for (uint32_t i : g_visibleBodies) {
+    if (!bodies[i]->usesVirtualTexture()) {
+      bodies[i]->bind();
+      bodies[i]->draw(bodies[i]->getTransformation());
+    }
+  }
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  for (uint32_t i : g_visibleBodies) {
+    if (bodies[i]->usesVirtualTexture()) {
+      bodies[i]->bind();
+      bodies[i]->draw(bodies[i]->getTransformation());
+    }
+  }
+  g_virtualTexture.endFeedback();
+}
+
+// Replays the recorded draw commands: occluders first so that their depth can hide the others
+void renderBodies(const std::vector<std::shared_ptr<Mesh>> &meshes) {
+  const bool queries = (g_occlusionMode == OcclusionMode::HardwareQueries);
+  uint32_t activeShader = UINT32_MAX;
+  uint32_t boundMesh = UINT32_MAX;
+  const auto drawCommand = [&](const DrawCommand &cmd) {
+    if (cmd.shader != activeShader) {
+      activateShaderVariant(cmd.shader);
+      activeShader = cmd.shader;
+      boundMesh = UINT32_MAX; // the material uniforms belong to the program
+    }
+    if (cmd.mesh != boundMesh) {
+      meshes[cmd.mesh]->bind();
+      boundMesh = cmd.mesh;
+    }
+    meshes[cmd.mesh]->draw(cmd.transform);
+  };
+
+  g_drawLists.replay(kDrawPassOccluders, drawCommand);
+  if (!queries) {
+    g_drawLists.replay(kDrawPassOccludees, drawCommand);
+    return;
+  }
+
+  g_occlusionQueries.resize(meshes.size());
+  g_drawLists.replay(kDrawPassOccludees, [&](const DrawCommand &cmd) {
+    g_occlusionQueries.beginConditionalRender(cmd.body); // skipped if last frame's query saw no sample
+    drawCommand(cmd);
+    g_occlusionQueries.endConditionalRender();
+  });
+  g_occlusionQueries.issueQueries(g_occludees, g_bodySpheres, g_camera.computeProjectionMatrix() * g_camera.computeViewMatrix(), g_camera.getPosition());
+}
+
+// Feeds the last GPU frame time to the resolution controller, and logs its state once per second
+void updateResolutionScale() {
+  float gpuMs;
+  if (!g_gpuFrameTimer.latestFrameTime(gpuMs) || !g_dynamicResolution) {
+    return;
+  }
+  const ResolutionController::State &state = g_resolutionController.getState();
+  g_resolutionController.update(gpuMs);
+
+  static double lastLog = 0.;
+  const double now = currentTime();
+  if (g_logResolution && now - lastLog >= 1.) {
+    lastLog = now;
+    std::cout << "Resolution: scale " << state.scale << " (" << g_sceneFramebuffer.getRenderWidth() << "x" << g_sceneFramebuffer.getRenderHeight()
+              << "), GPU frame " << state.frameTimeMs << " ms / target " << g_resolutionController.getTargetFrameTime()
+              << " ms, error " << state.error << ", integral " << state.integral << std::endl;
+  }
+}
+
+// Counts the rendered frames and prints the frame rate every second with --log-fps or in headless mode
+void reportFrameRate() {
+  static double periodStart = currentTime();
+  static uint64_t periodFrames = 0;
+  g_frameIndex++;
+  periodFrames++;
+  const double now = currentTime();
+  if ((g_logFps || g_headless) && now - periodStart >= 1.) {
+    std::cout << "FPS: " << periodFrames / (now - periodStart) << " (" << 1000. * (now - periodStart) / periodFrames << " ms/frame)";
+    if (g_headless) {
+      std::cout << ", read back " << g_readbackBytes / (1024*1024) << " MiB";
+    }
+    if (g_virtualTexture.isValid()) {
+      std::cout << ", virtual texture " << g_virtualTexture.residentCount() << "/" << g_virtualTexture.pageCount() << " pages (" << g_virtualTexture.getTilesLoaded()
+                << " tiles loaded, " << g_virtualTexture.getTilesEvicted() << " evicted, " << g_virtualTexture.pendingCount() << " pending, level bias " << g_virtualTexture.getLevelBias() << ")";
+    }
+    static double lastSimulationTime = 0.;
+    if (g_simulationClock.getWarp() != 1.) {
+      std::cout << ", warp x" << g_simulationClock.getWarp() << " (effective x" << (g_simulationTime - lastSimulationTime) / (now - periodStart)
+                << ", step " << g_simulationClock.getStep() << " s)";
+    }
+    lastSimulationTime = g_simulationTime;
+    if (g_nbodyGpu) {
+      static uint64_t lastSteps = 0, lastInteractions = 0;
+      static double lastGpuMs = 0.;
+      const double gpuMs = g_gpuNBody.getTotalGpuMs() - lastGpuMs;
+      std::cout << ", N-body " << g_gpuNBody.size() << " bodies on the GPU: " << (g_gpuNBody.getSteps() - lastSteps) / (now - periodStart) << " steps/s, "
+                << (g_gpuNBody.getTimedInteractions() - lastInteractions) / std::max(gpuMs * 1e3, 1e-3) << " M interactions/s (" << gpuMs << " ms of compute, "
+                << g_simulationClock.getDroppedTime() << " s dropped)";
+      lastSteps = g_gpuNBody.getSteps();
+      lastInteractions = g_gpuNBody.getTimedInteractions();
+      lastGpuMs = g_gpuNBody.getTotalGpuMs();
+    } else if (g_nbodyMode) {
+      // Over the period, whatever the number of steps per frame and force evaluations per step
+      static uint64_t lastSteps = 0, lastInteractions = 0;
+      static double lastBuildMs = 0., lastForceMs = 0.;
+      const double buildMs = g_gravity.getTotalBuildMs() - lastBuildMs;
+      const double forceMs = g_gravity.getTotalForceMs() - lastForceMs;
+      std::cout << ", N-body " << g_gravity.size() << " bodies: " << (g_simulationClock.getSteps() - lastSteps) / (now - periodStart) << " steps/s, "
+                << (g_gravity.getTotalInteractions() - lastInteractions) / std::max((buildMs + forceMs) * 1e3, 1e-3) << " M interactions/s ("
+                << buildMs << " ms sort and build, " << forceMs << " ms forces, " << g_simulationClock.getDroppedTime() << " s dropped)";
+      lastSteps = g_simulationClock.getSteps();
+      lastInteractions = g_gravity.getTotalInteractions();
+      lastBuildMs = g_gravity.getTotalBuildMs();
+      lastForceMs = g_gravity.getTotalForceMs();
+    }
+    if (g_asteroidCount) {
+      std::cout << ", orbits of " << g_orbits.size() << " bodies in " << g_orbits.getLastPropagateMs() << " ms";
+    }
+    std::cout << std::endl;
+    periodStart = now;
+    periodFrames = 0;
+  }
+}
+
+// Angle turned at rate (rad/s) after time, reduced in double: warped simulated times grow far beyond
+// what a float angle can resolve
+float spinAngle(const double time, const double rate) {
+  return static_cast<float>(std::fmod(time * rate, 2 * M_PI));
+}
+
+// Turns the camera around the scene with the real time of the frame, whatever the time warp (stopped
+// while the simulation is paused)
+void updateCamera(const double frameTime, const float angV = 0.5f) {
+  static double cameraTime = 0.;
+  if (!g_simulationClock.isPaused()) {
+    cameraTime += frameTime;
+  }
+  g_camera.setPosition(glm::mat3(glm::rotate(glm::mat4(1), spinAngle(cameraTime, angV), glm::vec3(0, 0, 1))) * glm::vec3(5.0, -10.0, 20.0));
+}
 
-  g_earth = glm::rotate(g_earth, glm::radians(23.5f), glm::vec3(0, 0, 1));
-  g_earth = glm::rotate(g_earth, 2 * velocity, glm::vec3(0, 0, 1));
+// Update any accessible variable based on the current time
+void update(const double currentTimeInSec, std::shared_ptr<Mesh> &sun, std::shared_ptr<Mesh> &earth, std::shared_ptr<Mesh> &moon, const float angV = 0.5f) {
 
-  g_earth = glm::scale(g_earth, glm::vec3(kSizeEarth));
-  g_moon = glm::scale(g_moon, glm::vec3(kSizeMoon));
+  g_orbits.propagate(currentTimeInSec, g_threadPool.get()); // positions in double, relative to the sun
+  const glm::dvec3 earthPosition = g_orbits.getPosition(g_earthOrbit);
+  g_scene.setTranslation(g_earthOrbitNode, glm::vec3(earthPosition));
+  g_scene.setTranslation(g_moonOrbitNode, glm::vec3(g_orbits.getPosition(g_moonOrbit) - earthPosition));
+  g_scene.setRotation(g_moonNode, glm::angleAxis(spinAngle(currentTimeInSec, 4 * angV), glm::vec3(0, 0, 1))); // same face toward the earth
+  g_scene.setRotation(g_earthNode, glm::angleAxis(glm::radians(23.5f), glm::vec3(0, 0, 1)) * glm::angleAxis(spinAngle(currentTimeInSec, 2 * angV), glm::vec3(0, 0, 1)));
+  g_scene.updateWorldMatrices();
 
   //Apply transformations
-  earth->setTransformation(g_earth);
-  moon->setTransformation(g_moon);
+  sun->setTransformation(g_scene.getWorldMatrix(g_sunNode));
+  earth->setTransformation(g_scene.getWorldMatrix(g_earthNode));
+  moon->setTransformation(g_scene.getWorldMatrix(g_moonNode));
+}
 
-  //Camera rotation
-  g_camera.setPosition(glm::mat3(glm::rotate(glm::mat4(1), velocity, glm::vec3(0, 0, 1))) * glm::vec3(5.0, -10.0, 20.0));
-  
+// Builds the N-body system (sun, earth, moon, then the asteroids) in g_gravity: circular orbits,
+// the moon's around the earth, with the total momentum removed so that the system stays in view
+void initNBody(size_t asteroids) {
+  const double sunEarth = kMassSun + kMassEarth + kMassMoon;
+  const glm::dvec3 earthVelocity(0., std::sqrt(sunEarth / kRadOrbitEarth), 0.);
+  g_gravity.addBody(glm::dvec3(0.), glm::dvec3(0.), kMassSun);
+  g_gravity.addBody(glm::dvec3(kRadOrbitEarth, 0., 0.), earthVelocity, kMassEarth);
+  g_gravity.addBody(glm::dvec3(kRadOrbitEarth + kRadOrbitMoon, 0., 0.), earthVelocity + glm::dvec3(0., std::sqrt(kMassEarth / kRadOrbitMoon), 0.), kMassMoon);
+  g_nbodySizes = {kSizeSun, kSizeEarth, kSizeMoon};
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> unit(0., 1.);
+  for (size_t i = 0; i < asteroids; i++) {
+    const double radius = kRadOrbitEarth * (1.5 + 1.5 * unit(rng));
+    const double angle = 2 * M_PI * unit(rng);
+    const glm::dvec3 position(radius * cos(angle), radius * sin(angle), 0.5 * (unit(rng) - 0.5));
+    const glm::dvec3 velocity = std::sqrt(sunEarth / radius) * glm::dvec3(-sin(angle), cos(angle), 0.05 * (unit(rng) - 0.5));
+    g_gravity.addBody(position, velocity, kMassAsteroid);
+    g_nbodySizes.push_back(static_cast<float>(0.05 + 0.07 * unit(rng)));
+  }
+
+  glm::dvec3 momentum(0.);
+  double mass = 0.;
+  for (size_t i = 0; i < g_gravity.size(); i++) {
+    momentum += g_gravity.getMass(i) * g_gravity.getVelocity(i);
+    mass += g_gravity.getMass(i);
+  }
+  for (size_t i = 0; i < g_gravity.size(); i++) {
+    g_gravity.setVelocity(i, g_gravity.getVelocity(i) - momentum / mass);
+    g_previousPositions.push_back(g_gravity.getPosition(i));
+  }
+}
+
+// Compiles and links a program from the given shader files, waiting for the result: 0 (reported)
+// if it fails
+GLuint buildProgram(GLenum firstType, const std::string &firstShader, GLenum secondType, const std::string &secondShader, const std::string &name) {
+  GLuint program = glCreateProgram();
+  loadShader(program, firstType, firstShader);
+  if (!secondShader.empty()) {
+    loadShader(program, secondType, secondShader);
+  }
+  glLinkProgram(program);
+  if (!checkProgram(program, name)) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void queryAsteroidUniforms(GLuint program, ProgramUniforms &uniforms) {
+  uniforms.camPos = glGetUniformLocation(program, "camPos");
+  uniforms.ambient = glGetUniformLocation(program, "ambient");
+  uniforms.lightning = glGetUniformLocation(program, "lightning");
+  uniforms.viewMat = glGetUniformLocation(program, "viewMat");
+  uniforms.projMat = glGetUniformLocation(program, "projMat");
+}
+
+// Builds the programs of the asteroids in use (again after an edit): the instanced draw of the CPU
+// simulation, or the compute and draw programs of the GPU one. A program that fails to build leaves
+// the current one in place.
+void buildAsteroidPrograms() {
+  if (g_instanceProgram) {
+    if (GLuint program = buildProgram(GL_VERTEX_SHADER, "instancedVertexShader.glsl", GL_FRAGMENT_SHADER, "fragmentShader.glsl", "the instanced asteroid program")) {
+      glDeleteProgram(g_instanceProgram);
+      g_instanceProgram = program;
+      queryAsteroidUniforms(g_instanceProgram, g_instanceUniforms);
+    }
+  }
+  if (g_nbodyDrawProgram) {
+    if (GLuint program = buildProgram(GL_VERTEX_SHADER, "nbodyVertexShader.glsl", GL_FRAGMENT_SHADER, "fragmentShader.glsl", "the N-body instance program")) {
+      glDeleteProgram(g_nbodyDrawProgram);
+      g_nbodyDrawProgram = program;
+      queryAsteroidUniforms(g_nbodyDrawProgram, g_nbodyDrawUniforms);
+      g_nbodyAlphaLocation = glGetUniformLocation(g_nbodyDrawProgram, "alpha");
+      g_nbodyFirstBodyLocation = glGetUniformLocation(g_nbodyDrawProgram, "firstBody");
+    }
+  }
+  if (g_nbodyComputeProgram) {
+    GLuint program = buildProgram(GL_COMPUTE_SHADER, "nbodyComputeShader.glsl", GL_NONE, "", "the N-body compute program");
+    if (program && g_gpuNBody.setProgram(program)) {
+      glDeleteProgram(g_nbodyComputeProgram);
+      g_nbodyComputeProgram = program;
+    } else {
+      glDeleteProgram(program);
+    }
+  }
+}
+
+// Moves the N-body simulation to the GPU: compute program, buffers filled from g_gravity, and the
+// program drawing the asteroids. Returns false (reported) without GL 4.3.
+bool initGpuNBody() {
+  g_nbodyComputeProgram = buildProgram(GL_COMPUTE_SHADER, "nbodyComputeShader.glsl", GL_NONE, "", "the N-body compute program");
+  if (!g_nbodyComputeProgram || !g_gpuNBody.init(g_nbodyComputeProgram, g_glLoader)) {
+    std::cerr << "WARNING: compute shaders unavailable (OpenGL " << glGetString(GL_VERSION) << "), the N-body simulation stays on the CPU" << std::endl;
+    glDeleteProgram(g_nbodyComputeProgram);
+    g_nbodyComputeProgram = 0;
+    return false;
+  }
+  g_nbodyDrawProgram = buildProgram(GL_VERTEX_SHADER, "nbodyVertexShader.glsl", GL_FRAGMENT_SHADER, "fragmentShader.glsl", "the N-body instance program");
+  queryAsteroidUniforms(g_nbodyDrawProgram, g_nbodyDrawUniforms);
+  g_nbodyAlphaLocation = glGetUniformLocation(g_nbodyDrawProgram, "alpha");
+  g_nbodyFirstBodyLocation = glGetUniformLocation(g_nbodyDrawProgram, "firstBody");
+
+  std::vector<glm::vec4> positionMass;
+  std::vector<glm::vec3> velocities;
+  for (size_t i = 0; i < g_gravity.size(); i++) {
+    positionMass.push_back(glm::vec4(glm::vec3(g_gravity.getPosition(i)), static_cast<float>(g_gravity.getMass(i))));
+    velocities.push_back(glm::vec3(g_gravity.getVelocity(i)));
+  }
+  g_gpuNBody.setBodies(positionMass, velocities, g_nbodySizes);
+  std::cout << "N-body: " << g_gpuNBody.size() << " bodies on the GPU" << std::endl;
+  return true;
+}
+
+// Prepares the instanced draw of the asteroids simulated on the CPU: their sizes, the ring their
+// matrices are written to every frame, and its program
+void initNBodyInstances(size_t firstBody) {
+  const size_t count = g_gravity.size() - firstBody;
+  g_asteroidTransforms.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    g_asteroidTransforms.sx[i] = g_asteroidTransforms.sy[i] = g_asteroidTransforms.sz[i] = g_nbodySizes[firstBody + i];
+  }
+  g_instanceRing.init(count * sizeof(glm::mat4));
+  g_instanceProgram = buildProgram(GL_VERTEX_SHADER, "instancedVertexShader.glsl", GL_FRAGMENT_SHADER, "fragmentShader.glsl", "the instanced asteroid program");
+  queryAsteroidUniforms(g_instanceProgram, g_instanceUniforms);
+}
+
+// N-body counterpart of update: advances the simulation by frameTime and places every body at its position
+void updateNBody(const double frameTime, const std::vector<std::shared_ptr<Mesh>> &bodies, const float angV = 0.5f) {
+  const int steps = g_simulationClock.advance(frameTime);
+  g_simulationTime = g_simulationClock.getRenderTime();
+  const auto stepsStart = std::chrono::steady_clock::now();
+  if (g_nbodyGpu) {
+    for (int step = 0; step < steps; step++) {
+      g_gpuNBody.step(static_cast<float>(g_simulationClock.getStep()));
+    }
+    // The steps run asynchronously: their cost is that of the last ones timed on the GPU
+    static uint64_t lastTimedSteps = 0;
+    static double lastGpuMs = 0.;
+    const double gpuMs = g_gpuNBody.getTotalGpuMs();
+    g_simulationClock.reportStepsMs(gpuMs - lastGpuMs, static_cast<int>(g_gpuNBody.getTimedSteps() - lastTimedSteps));
+    lastTimedSteps = g_gpuNBody.getTimedSteps();
+    lastGpuMs = gpuMs;
+    if (steps > 0) {
+      g_gpuNBody.requestReadback(bodies.size());
+    }
+    g_gpuNBody.takeReadback(g_readbackPrevious, g_readbackCurrent); // a frame or so behind the asteroids
+  } else {
+    for (int step = 0; step < steps; step++) {
+      if (step == steps - 1) {
+        for (size_t i = 0; i < g_gravity.size(); i++) {
+          g_previousPositions[i] = g_gravity.getPosition(i);
+        }
+      }
+      g_gravity.step(g_simulationClock.getStep(), g_threadPool.get());
+    }
+    g_simulationClock.reportStepsMs(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stepsStart).count(), steps);
+  }
+  const double alpha = g_simulationClock.getAlpha();
+  for (size_t i = 0; i < g_asteroidTransforms.size(); i++) { // CPU simulation only
+    const glm::dvec3 position = glm::mix(g_previousPositions[bodies.size() + i], g_gravity.getPosition(bodies.size() + i), alpha);
+    g_asteroidTransforms.tx[i] = static_cast<float>(position.x);
+    g_asteroidTransforms.ty[i] = static_cast<float>(position.y);
+    g_asteroidTransforms.tz[i] = static_cast<float>(position.z);
+  }
+  for (size_t i = 0; i < bodies.size(); i++) {
+    glm::dvec3 position = glm::mix(g_previousPositions[i], g_gravity.getPosition(i), alpha); // the initial one on the GPU, until read back
+    if (i < g_readbackCurrent.size()) {
+      position = glm::mix(glm::dvec3(g_readbackPrevious[i]), glm::dvec3(g_readbackCurrent[i]), alpha);
+    }
+    glm::mat4 transform = glm::translate(glm::mat4(1), glm::vec3(position));
+    if (i == 1) { // the earth keeps its tilt and spin
+      transform = glm::rotate(transform, glm::radians(23.5f), glm::vec3(0, 0, 1));
+      transform = glm::rotate(transform, spinAngle(g_simulationTime, 2 * angV), glm::vec3(0, 0, 1));
+    }
+    transform = glm::scale(transform, glm::vec3(g_nbodySizes[i]));
+    bodies[i]->setTransformation(transform);
+  }
+}
+
+// Draws the asteroids in one instanced call: on the CPU, from their matrices composed into the instance ring
+void renderNBodyInstances(const Mesh &asteroid, size_t firstBody) {
+  const size_t count = g_asteroidTransforms.size();
+  if (!g_nbodyGpu && count > 0) {
+    float *matrices = static_cast<float *>(g_instanceRing.map(count * sizeof(glm::mat4)));
+    if (!matrices) {
+      return;
+    }
+    composeTrs(g_asteroidTransforms, 0, count, matrices, true);
+    asteroid.setInstanceMatrices(g_instanceRing.getBuffer(), g_instanceRing.unmap());
+    g_uniforms = g_instanceUniforms;
+    glUseProgram(g_instanceProgram);
+    setFrameUniforms();
+    glUniform3f(g_uniforms.ambient, 0.5f, 0.45f, 0.4f);
+    asteroid.drawInstanced(static_cast<GLsizei>(count));
+    g_instanceRing.fence();
+    return;
+  }
+  // On the GPU, straight from the simulation buffers
+  if (g_gpuNBody.size() <= firstBody) {
+    return;
+  }
+  g_uniforms = g_nbodyDrawUniforms;
+  glUseProgram(g_nbodyDrawProgram);
+  setFrameUniforms();
+  glUniform3f(g_uniforms.ambient, 0.5f, 0.45f, 0.4f);
+  glUniform1f(g_nbodyAlphaLocation, static_cast<float>(g_simulationClock.getAlpha()));
+  glUniform1i(g_nbodyFirstBodyLocation, static_cast<GLint>(firstBody));
+  g_gpuNBody.bindForDraw(kNBodyPreviousBinding, kNBodyCurrentBinding, kNBodySizeBinding);
+  asteroid.drawInstanced(static_cast<GLsizei>(g_gpuNBody.size() - firstBody));
+}
+
+// Times Barnes-Hut steps of asteroid belts of growing size on growing numbers of threads
+void runNBodyBenchmark() {
+  const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::cout << "N-body benchmark (Barnes-Hut, theta 0.5), " << hardwareThreads << " hardware threads" << std::endl;
+  for (size_t n : {1000, 10000, 100000}) {
+    BarnesHutGravity gravity;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> unit(0., 1.);
+    gravity.addBody(glm::dvec3(0.), glm::dvec3(0.), kMassSun);
+    for (size_t i = 1; i < n; i++) {
+      const double radius = kRadOrbitEarth * (1.5 + 1.5 * unit(rng));
+      const double angle = 2 * M_PI * unit(rng);
+      gravity.addBody(glm::dvec3(radius * cos(angle), radius * sin(angle), 0.5 * (unit(rng) - 0.5)),
+                      std::sqrt(kMassSun / radius) * glm::dvec3(-sin(angle), cos(angle), 0.), kMassAsteroid);
+    }
+    double singleThreadMs = 0.;
+    for (unsigned int threads = 1; threads <= hardwareThreads; threads *= 2) {
+      ThreadPool pool(threads - 1); // the calling thread takes part
+      gravity.step(1e-3, &pool); // warm up
+      const int kSteps = 3;
+      double ms = 0.;
+      uint64_t interactions = 0;
+      for (int step = 0; step < kSteps; step++) {
+        gravity.step(1e-3, &pool);
+        ms += gravity.getLastBuildMs() + gravity.getLastForceMs();
+        interactions += gravity.getInteractions();
+      }
+      ms /= kSteps;
+      if (threads == 1) {
+        singleThreadMs = ms;
+      }
+      std::cout << "  N " << n << ", " << threads << " threads: " << ms << " ms/step (" << gravity.getLastBuildMs() << " ms sort and build), "
+                << interactions / kSteps / n << " interactions/body, " << interactions / kSteps / (ms * 1e3) << " M interactions/s, speedup "
+                << singleThreadMs / ms << std::endl;
+      if (threads < hardwareThreads && threads * 2 > hardwareThreads) {
+        threads = hardwareThreads / 2; // also measure every hardware thread
+      }
+    }
+  }
+}
+
+// Reads the command line options
+void parseArguments(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--no-mipmaps") {
+      g_textureLoader.setMipmaps(false);
+    } else if (arg == "--no-texture-compression") {
+      g_textureLoader.setCompression(false);
+    } else if (arg == "--no-texture-cache") {
+      g_textureLoader.setDiskCache(false);
+    } else if (arg == "--virtual-texture" && i + 1 < argc) {
+      g_virtualTextureImage = argv[++i];
+    } else if (arg == "--vt-cache-pages" && i + 1 < argc) {
+      g_virtualTexturePages = std::max(2, std::atoi(argv[++i]));
+    } else if (arg == "--texture-budget" && i + 1 < argc) {
+      g_textureUploadBudget = static_cast<size_t>(std::max(0.01, std::atof(argv[++i])) * (1 << 20));
+    } else if (arg == "--watch-shaders") {
+      g_watchShaders = true;
+    } else if (arg == "--no-shader-cache") {
+      g_useProgramCache = false;
+    } else if (arg == "--separate-textures") {
+      g_useTextureArray = false;
+    } else if (arg == "--no-dynamic-resolution") {
+      g_dynamicResolution = false;
+    } else if (arg == "--log-resolution") {
+      g_logResolution = true;
+    } else if (arg == "--headless" || arg == "--headless=osmesa") {
+      g_headless = true;
+      g_headlessEgl = false;
+    } else if (arg == "--headless=egl") {
+      g_headless = true;
+      g_headlessEgl = true;
+    } else if (arg == "--size" && i + 1 < argc) {
+      if (std::sscanf(argv[++i], "%dx%d", &g_windowWidth, &g_windowHeight) != 2 || g_windowWidth <= 0 || g_windowHeight <= 0) {
+        std::cerr << "ERROR: --size expects WIDTHxHEIGHT" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+    } else if (arg == "--frames" && i + 1 < argc) {
+      g_maxFrames = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--record" && i + 1 < argc) {
+      g_recordPath = argv[++i];
+    } else if (arg == "--record-fps" && i + 1 < argc) {
+      g_recordFps = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--swap-interval" && i + 1 < argc) {
+      g_swapInterval = std::atoi(argv[++i]);
+    } else if (arg == "--fps-cap" && i + 1 < argc) {
+      g_framePacer.setTargetFps(std::atof(argv[++i]));
+    } else if (arg == "--idle-fps" && i + 1 < argc) {
+      g_framePacer.setIdleFps(std::max(0.1, std::atof(argv[++i])));
+    } else if (arg == "--asteroids" && i + 1 < argc) {
+      g_asteroidCount = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--nbody" && i + 1 < argc) {
+      g_nbodyMode = true;
+      g_nbodyAsteroids = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--nbody-gpu") {
+      g_nbodyGpu = true;
+    } else if (arg == "--integrator" && i + 1 < argc) {
+      const std::string name = argv[++i];
+      if (name == "euler") {
+        g_gravity.setIntegrator(Integrator::SymplecticEuler);
+      } else if (name == "leapfrog") {
+        g_gravity.setIntegrator(Integrator::Leapfrog);
+      } else if (name == "yoshida4") {
+        g_gravity.setIntegrator(Integrator::Yoshida4);
+      } else {
+        std::cerr << "WARNING: unknown integrator " << name << ", expected euler, leapfrog or yoshida4" << std::endl;
+      }
+    } else if (arg == "--physics-step" && i + 1 < argc) {
+      const double step = std::max(std::atof(argv[++i]), 1e-6);
+      g_simulationClock.setStep(step);
+    } else if (arg == "--warp" && i + 1 < argc) {
+      g_simulationClock.setWarp(std::atof(argv[++i]));
+    } else if (arg == "--sim-budget" && i + 1 < argc) {
+      g_simulationClock.setBudgetMs(std::max(std::atof(argv[++i]), 0.1));
+    } else if (arg == "--nbody-benchmark") {
+      runNBodyBenchmark();
+      std::exit(EXIT_SUCCESS);
+    } else if (arg == "--log-fps") {
+      g_logFps = true;
+    } else if (arg == "--target-fps" && i + 1 < argc) {
+      g_resolutionController.setTargetFrameTime(1000.f / std::max(1.f, static_cast<float>(std::atof(argv[++i]))));
+    } else {
+      std::cerr << "WARNING: unknown option " << arg << std::endl;
+    }
+  }
+  if (g_headless) {
+    g_dynamicResolution = false; // frames are read back at the requested size
+  }
+  if (g_nbodyGpu && g_gravity.getIntegrator() != Integrator::Leapfrog) {
+    // The compute shader only implements leapfrog; the CPU fallback then integrates the same way
+    std::cerr << "WARNING: --nbody-gpu always integrates with leapfrog, --integrator ignored" << std::endl;
+    g_gravity.setIntegrator(Integrator::Leapfrog);
+  }
+  double maxStepFactor = kMaxStepFactorLeapfrog;
+  if (g_gravity.getIntegrator() == Integrator::SymplecticEuler) {
+    maxStepFactor = kMaxStepFactorEuler;
+  } else if (g_gravity.getIntegrator() == Integrator::Yoshida4) {
+    maxStepFactor = kMaxStepFactorYoshida4;
+  }
+  g_simulationClock.setMaxStep(maxStepFactor * g_simulationClock.getNominalStep()); // whatever the order of the options
+  if (g_recordPath == "-") {
+    std::cout.rdbuf(std::cerr.rdbuf()); // the standard output carries the video
+  }
 }
 
 int main(int argc, char ** argv) {
+  parseArguments(argc, argv);
   init(); // Your initialization code (user interface, OpenGL states, scene with geometry, material, lights, etc)
   std::shared_ptr<Mesh> sun = Mesh::genSphere(25);
   std::shared_ptr<Mesh> earth = Mesh::genSphere(25);
@@ -535,19 +1680,125 @@ int main(int argc, char ** argv) {
 
   // Set the colorr / textures
   sun->setAmbientColor({0.8, 0.6, 0.});
+  sun->setEmissive(true); // the sun is the light source: no shading
   earth->setAmbientColor({0.1, 1., 0.4});
-  earth->setTexID(g_earthTexID);
   moon->setAmbientColor({0., 0.4, 1.});
-  moon->setTexID(g_moonTexID);
+  if (g_useTextureArray) {
+    if (g_earthTexLayer >= 0) earth->setTexLayer(g_earthTexLayer);
+    if (g_moonTexLayer >= 0) moon->setTexLayer(g_moonTexLayer);
+  } else {
+    earth->setTexID(g_earthTexID);
+    moon->setTexID(g_moonTexID);
+  }
+  if (g_virtualTexture.isValid()) {
+    earth->setVirtualTexture();
+  }
 
-  while(!glfwWindowShouldClose(g_window)) {
+  std::vector<std::shared_ptr<Mesh>> bodies = {sun, earth, moon};
+  std::shared_ptr<Mesh> asteroid = Mesh::genSphere(6);
+  if (g_nbodyMode) {
+    asteroid->init();
+    initNBody(g_nbodyAsteroids);
+    g_nbodyGpu = g_nbodyGpu && initGpuNBody();
+    if (!g_nbodyGpu) {
+      initNBodyInstances(bodies.size());
+    }
+  }
+  for (const std::shared_ptr<Mesh> &body : bodies) {
+    g_bodyShaders.request(body->getShaderFeatures()); // bodies are drawn with the fallback until their permutation is ready
+  }
+  if (g_headless || !g_recordPath.empty()) {
+    g_bodyShaders.finishAll(); // captured frames must not show the fallback
+    g_textureLoader.finishAll(); // nor the placeholders
+  }
+  bool shadersReported = false;
+  bool texturesReported = false;
+
+  const double startTime = currentTime();
+  double lastFrameTime = startTime;
+  while(g_window ? !glfwWindowShouldClose(g_window) : !g_closeRequested) {
+    if (g_headless) {
+      g_sceneFramebuffer.begin(1.f); // Render offscreen at full size for the readback
+    } else if (g_dynamicResolution) {
+      g_sceneFramebuffer.begin(g_resolutionController.getScale()); // Render offscreen at the current scale
+    }
+    g_gpuFrameTimer.begin();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Erase the color and z buffers
-    update(static_cast<float>(glfwGetTime()), earth, moon); // Update the mesh positions
-    sun->render();
-    earth->render();
-    moon->render();
-    glfwSwapBuffers(g_window);
-    glfwPollEvents();
+    // Recorded frames are spaced by exactly 1/fps of simulated time, whatever the rendering speed
+    const double now = currentTime();
+    const double frameTime = g_recordPath.empty() ? now - lastFrameTime : 1. / g_recordFps;
+    lastFrameTime = now;
+    if (g_nbodyMode) {
+      updateNBody(frameTime, bodies); // Move the bodies under their mutual gravity
+    } else {
+      g_simulationClock.advanceExact(frameTime); // the orbits are exact at any time: no steps
+      g_simulationTime = g_simulationClock.getTime();
+      update(g_simulationTime, sun, earth, moon); // Update the mesh positions
+    }
+    updateCamera(frameTime);
+    cullBodies(bodies); // Skip the bodies outside of the camera frustum
+    recordDrawLists(bodies);
+    renderVirtualTextureFeedback(bodies);
+    renderBodies(bodies);
+    if (g_nbodyMode) {
+      renderNBodyInstances(*asteroid, bodies.size());
+    }
+    g_gpuFrameTimer.end();
+    if (g_headless) {
+      g_readback.enqueue(g_sceneFramebuffer.getFramebuffer(), g_frameIndex); // Asynchronous copy to a PBO
+      g_readback.poll(); // Consume the copies finished by now, without waiting
+    } else {
+      if (g_dynamicResolution) {
+        g_sceneFramebuffer.resolve(); // Upscale to the window
+      }
+      if (g_recorder.isOpen()) {
+        g_readback.enqueue(0, g_frameIndex); // Record the back buffer before it is swapped
+        g_readback.poll();
+      }
+    }
+    updateResolutionScale();
+    if (!g_headless) {
+      glfwSwapBuffers(g_window);
+    }
+    if (!g_headless && g_framePacer.isIdle()) {
+      glfwWaitEventsTimeout(g_framePacer.getIdleFrameTime()); // Paused and untouched: sleep until input or the next idle frame
+    } else {
+      if (g_window) {
+        glfwPollEvents();
+      }
+      g_framePacer.waitForNextFrame(); // Frame rate cap, if any
+    }
+    reportFrameRate();
+    reloadChangedShaders();
+    g_textureLoader.update(); // used from the next frame on
+    g_virtualTexture.update(); // tiles asked for by the feedback of the previous frames
+    if (!texturesReported && g_textureLoader.pendingCount() == 0) {
+      texturesReported = true;
+      std::cout << "Textures: ready " << (currentTime() - startTime) * 1000. << " ms after the first frame ("
+                << g_textureLoader.getCacheLoads() << " from the disk cache in " << g_textureLoader.getCacheLoadMs() << " ms, "
+                << g_textureLoader.getDecodes() << " decoded in " << g_textureLoader.getDecodeMs() << " ms)" << std::endl;
+    }
+    g_bodyShaders.poll();
+    if (!shadersReported && g_bodyShaders.pendingCount() == 0) {
+      shadersReported = true;
+      std::cout << "Shaders: " << g_bodyShaders.size() << " programs ready " << (currentTime() - g_shaderStartTime) * 1000. << " ms after submission ("
+                << g_programCache.getHits() << " from the binary cache)" << std::endl;
+    }
+    if (g_maxFrames && g_frameIndex >= g_maxFrames) {
+      g_closeRequested = true;
+      if (g_window) {
+        glfwSetWindowShouldClose(g_window, true);
+      }
+    }
+  }
+  g_readback.flush();
+  if (g_logFps || g_headless) {
+    const double elapsed = currentTime() - startTime;
+    std::cout << "Average FPS: " << g_frameIndex / elapsed << " over " << g_frameIndex << " frames" << std::endl;
+  }
+  if (g_recorder.isOpen()) {
+    g_recorder.close(); // Drain the queue before reporting
+    std::cerr << "Recorded " << g_recorder.getFramesWritten() << " frames to " << g_recordPath << " (" << g_recorder.getFramesDropped() << " dropped)" << std::endl;
   }
   clear();
   return EXIT_SUCCESS;
@@ -0,0 +1,171 @@
+// ----------------------------------------------------------------------------
+// mipmapGenerator.cpp
+//
+// Description: CPU mip chain generation (see mipmapGenerator.h)
+// ----------------------------------------------------------------------------
+
+#include "mipmapGenerator.h"
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAP_USE_SSE
+#endif
+
+// The chain is filtered in 12-bit linear values, 4 channels per texel (RGB is padded): the sum of a
+// 2x2 block fits in 16 bits, and two texels fill a 128-bit register
+const static int kLinearMax = 4095;
+
+struct ConversionTables {
+  uint16_t toLinear[256];
+  unsigned char fromLinear[kLinearMax + 1];
+};
+
+static ConversionTables makeTables(bool srgb) {
+  ConversionTables tables;
+  for(int i = 0; i < 256; ++i) {
+    const double c = i / 255.0;
+    const double linear = !srgb ? c : (c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+    tables.toLinear[i] = static_cast<uint16_t>(linear * kLinearMax + 0.5);
+  }
+  for(int i = 0; i <= kLinearMax; ++i) {
+    const double linear = static_cast<double>(i) / kLinearMax;
+    const double c = !srgb ? linear : (linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055);
+    tables.fromLinear[i] = static_cast<unsigned char>(c * 255 + 0.5);
+  }
+  return tables;
+}
+
+static const ConversionTables &conversionTables(bool srgb) {
+  static const ConversionTables linearTables = makeTables(false); // thread-safe initialization (C++11)
+  static const ConversionTables srgbTables = makeTables(true);
+  return srgb ? srgbTables : linearTables;
+}
+
+// Rounded averages of the 2x2 blocks of two rows of a 4-channel 12-bit image; an odd last column is
+// dropped, a width of 1 is kept
+static void downsampleRows(const uint16_t *row0, const uint16_t *row1, int width, uint16_t *out, int dstWidth) {
+  int x = 0;
+#ifdef MIPMAP_USE_SSE
+  if(width > 1) {
+    const __m128i two = _mm_set1_epi16(2);
+    for(; x + 2 <= dstWidth; x += 2) { // 4 source texels of both rows -> 2 texels
+      const __m128i a = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 8*x)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 8*x)));
+      const __m128i b = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 8*x + 8)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 8*x + 8)));
+      const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b)); // texels (0+1, 2+3)
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4*x), _mm_srli_epi16(_mm_add_epi16(sum, two), 2));
+    }
+  }
+#endif
+  for(; x < dstWidth; ++x) { // remainder (or everything without SIMD)
+    const int x0 = std::min(2*x, width - 1);
+    const int x1 = std::min(2*x + 1, width - 1);
+    for(int c = 0; c < 4; ++c)
+      out[4*x + c] = static_cast<uint16_t>((row0[4*x0 + c] + row0[4*x1 + c] + row1[4*x0 + c] + row1[4*x1 + c] + 2) >> 2);
+  }
+}
+
+template<int Channels>
+static void decodeRow(const unsigned char *texels, int width, const ConversionTables &color, const ConversionTables &alpha, uint16_t *out) {
+  for(int x = 0; x < width; ++x) {
+    out[4*x] = color.toLinear[texels[Channels*x]];
+    out[4*x + 1] = color.toLinear[texels[Channels*x + 1]];
+    out[4*x + 2] = color.toLinear[texels[Channels*x + 2]];
+    out[4*x + 3] = (Channels == 4) ? alpha.toLinear[texels[Channels*x + 3]] : 0;
+  }
+}
+
+template<int Channels>
+static void encodeLevel(const std::vector<uint16_t> &linear, const ConversionTables &color, const ConversionTables &alpha, MipLevel &level) {
+  const size_t numTexels = static_cast<size_t>(level.width) * level.height;
+  level.pixels.resize(numTexels * Channels);
+  unsigned char *out = level.pixels.data();
+  for(size_t i = 0; i < numTexels; ++i) {
+    out[Channels*i] = color.fromLinear[linear[4*i]];
+    out[Channels*i + 1] = color.fromLinear[linear[4*i + 1]];
+    out[Channels*i + 2] = color.fromLinear[linear[4*i + 2]];
+    if(Channels == 4)
+      out[Channels*i + 3] = alpha.fromLinear[linear[4*i + 3]];
+  }
+}
+
+void generateMipChain(std::vector<MipLevel> &levels, int channels, bool srgb) {
+  if(levels.empty() || (levels[0].width <= 1 && levels[0].height <= 1))
+    return;
+  const ConversionTables &color = conversionTables(srgb);
+  const ConversionTables &alpha = conversionTables(false);
+  levels.reserve(mipLevelCount(levels[0].width, levels[0].height));
+
+  // Level 1 is built from level 0 two rows at a time, so that level 0 is never converted as a whole
+  int width = levels[0].width;
+  int height = levels[0].height;
+  int nextWidth = std::max(1, width / 2);
+  int nextHeight = std::max(1, height / 2);
+  std::vector<uint16_t> linear(static_cast<size_t>(nextWidth) * nextHeight * 4), next;
+  {
+    std::vector<uint16_t> row0(static_cast<size_t>(width) * 4), row1(static_cast<size_t>(width) * 4);
+    const size_t rowBytes = static_cast<size_t>(width) * channels;
+    for(int y = 0; y < nextHeight; ++y) {
+      const unsigned char *texels0 = &levels[0].pixels[std::min(2*y, height - 1) * rowBytes];
+      const unsigned char *texels1 = &levels[0].pixels[std::min(2*y + 1, height - 1) * rowBytes];
+      if(channels == 4) {
+        decodeRow<4>(texels0, width, color, alpha, row0.data());
+        decodeRow<4>(texels1, width, color, alpha, row1.data());
+      } else {
+        decodeRow<3>(texels0, width, color, alpha, row0.data());
+        decodeRow<3>(texels1, width, color, alpha, row1.data());
+      }
+      downsampleRows(row0.data(), row1.data(), width, &linear[static_cast<size_t>(y) * nextWidth * 4], nextWidth);
+    }
+  }
+
+  for(;;) {
+    width = nextWidth;
+    height = nextHeight;
+    MipLevel level;
+    level.width = width;
+    level.height = height;
+    if(channels == 4)
+      encodeLevel<4>(linear, color, alpha, level);
+    else
+      encodeLevel<3>(linear, color, alpha, level);
+    levels.push_back(std::move(level));
+    if(width == 1 && height == 1)
+      return;
+
+    nextWidth = std::max(1, width / 2);
+    nextHeight = std::max(1, height / 2);
+    next.resize(static_cast<size_t>(nextWidth) * nextHeight * 4);
+    for(int y = 0; y < nextHeight; ++y) {
+      const uint16_t *row0 = &linear[static_cast<size_t>(std::min(2*y, height - 1)) * width * 4];
+      const uint16_t *row1 = &linear[static_cast<size_t>(std::min(2*y + 1, height - 1)) * width * 4];
+      downsampleRows(row0, row1, width, &next[static_cast<size_t>(y) * nextWidth * 4], nextWidth);
+    }
+    linear.swap(next);
+  }
+}
+
+void resampleImage(const unsigned char *src, int srcW, int srcH, int channels, std::vector<unsigned char> &dst, int dstW, int dstH) {
+  dst.resize(static_cast<size_t>(dstW) * dstH * channels);
+  const float sx = static_cast<float>(srcW) / dstW;
+  const float sy = static_cast<float>(srcH) / dstH;
+  for(int y = 0; y < dstH; ++y) {
+    const float fy = std::max(0.f, (y + 0.5f) * sy - 0.5f);
+    const int y0 = std::min(static_cast<int>(fy), srcH - 1);
+    const int y1 = std::min(y0 + 1, srcH - 1);
+    const float ty = fy - y0;
+    for(int x = 0; x < dstW; ++x) {
+      const float fx = std::max(0.f, (x + 0.5f) * sx - 0.5f);
+      const int x0 = std::min(static_cast<int>(fx), srcW - 1);
+      const int x1 = std::min(x0 + 1, srcW - 1);
+      const float tx = fx - x0;
+      for(int c = 0; c < channels; ++c) {
+        const float a = src[(static_cast<size_t>(y0)*srcW + x0)*channels + c] * (1 - tx) + src[(static_cast<size_t>(y0)*srcW + x1)*channels + c] * tx;
+        const float b = src[(static_cast<size_t>(y1)*srcW + x0)*channels + c] * (1 - tx) + src[(static_cast<size_t>(y1)*srcW + x1)*channels + c] * tx;
+        dst[(static_cast<size_t>(y)*dstW + x)*channels + c] = static_cast<unsigned char>(a * (1 - ty) + b * ty + 0.5f);
+      }
+    }
+  }
+}
@@ -0,0 +1,36 @@
+// ----------------------------------------------------------------------------
+// mipmapGenerator.h
+//
+// Description: CPU mip chain generation: 2x2 box filter in linear light (sRGB
+//              colors are decoded before filtering and encoded again after),
+//              vectorized with SSE2.
+// ----------------------------------------------------------------------------
+
+#ifndef MIPMAP_GENERATOR_H
+#define MIPMAP_GENERATOR_H
+
+#include <algorithm>
+#include <vector>
+
+struct MipLevel {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> pixels; // tightly packed 8-bit rows
+};
+
+// Number of levels of a full chain down to 1x1
+inline int mipLevelCount(int width, int height) {
+  int levels = 1;
+  for(int size = std::max(width, height); size > 1; size /= 2)
+    ++levels;
+  return levels;
+}
+
+// Bilinear resampling of a packed 8-bit image with texel centers aligned, clamped at the borders
+void resampleImage(const unsigned char *src, int srcW, int srcH, int channels, std::vector<unsigned char> &dst, int dstW, int dstH);
+
+// Appends to levels, which holds level 0, every smaller level down to 1x1. channels is 3 or 4;
+// with srgb, the color channels are sRGB encoded and averaged in linear light (alpha is linear).
+void generateMipChain(std::vector<MipLevel> &levels, int channels, bool srgb);
+
+#endif // MIPMAP_GENERATOR_H
@@ -0,0 +1,40 @@
+#version 430 core            // Compute shaders and shader storage buffers (see gpuNBody.h)
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) readonly buffer Positions { vec4 positions[]; };      // xyz, mass in w
+layout(std430, binding = 1) writeonly buffer NextPositions { vec4 nextPositions[]; };
+layout(std430, binding = 2) buffer Velocities { vec4 velocities[]; };
+
+uniform uint bodyCount;
+uniform float kick;     // time the velocities are advanced by, from the accelerations at the positions
+uniform float drift;    // time the positions are advanced by, at the new velocities
+uniform float gravity;  // gravitational constant
+uniform float softening2;
+
+shared vec4 tile[gl_WorkGroupSize.x];
+
+void main() {
+	uint body = gl_GlobalInvocationID.x;
+	vec4 self = body < bodyCount ? positions[body] : vec4(0.0);
+	vec3 acceleration = vec3(0.0);
+
+	// Every invocation of the group loads one body of the tile, then all of them sum its pairs
+	for (uint first = 0u; first < bodyCount; first += gl_WorkGroupSize.x) {
+		uint other = first + gl_LocalInvocationID.x;
+		tile[gl_LocalInvocationID.x] = other < bodyCount ? positions[other] : vec4(0.0); // no mass beyond the end
+		barrier();
+		for (uint k = 0u; k < gl_WorkGroupSize.x; k++) {
+			vec3 d = tile[k].xyz - self.xyz; // 0 for the body itself
+			float inverse = inversesqrt(dot(d, d) + softening2);
+			acceleration += (tile[k].w * inverse * inverse * inverse) * d;
+		}
+		barrier();
+	}
+
+	if (body < bodyCount) {
+		vec3 velocity = velocities[body].xyz + (gravity * kick) * acceleration;
+		velocities[body].xyz = velocity;
+		nextPositions[body] = vec4(self.xyz + drift * velocity, self.w);
+	}
+}
@@ -0,0 +1,24 @@
+#version 430 core            // Reads the bodies from the shader storage buffers of the N-body simulation
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoord;
+
+layout(std430, binding = 0) readonly buffer PreviousPositions { vec4 previousPositions[]; };
+layout(std430, binding = 1) readonly buffer Positions { vec4 positions[]; };
+layout(std430, binding = 3) readonly buffer Sizes { float sizes[]; };
+
+uniform mat4 viewMat, projMat;
+uniform int firstBody;  // of instance 0
+uniform float alpha;    // interpolation from the previous positions to the current ones
+out vec3 fNormal, fPosition;
+out vec2 fTexCoord;
+
+void main() {
+        int body = firstBody + gl_InstanceID;
+        vec3 center = mix(previousPositions[body].xyz, positions[body].xyz, alpha);
+        fPosition = center + sizes[body] * vPosition; // a sphere: scaled and translated, never rotated
+        gl_Position = projMat * viewMat * vec4(fPosition, 1.0);
+        fNormal = vNormal;
+        fTexCoord = vTexCoord;
+}
@@ -0,0 +1,156 @@
+// ----------------------------------------------------------------------------
+// occlusionCulling.cpp
+//
+// Description: Occlusion culling of hidden bodies (see occlusionCulling.h)
+// ----------------------------------------------------------------------------
+
+#include "occlusionCulling.h"
+
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// A query proxy the camera is this close to (beyond its bounding box) may be clipped by the near plane
+const static float kProxyNearMargin = 0.5f;
+
+bool sphereOccludedBySphere(const glm::vec3 &eye, const glm::vec3 &target, float targetRadius, const glm::vec3 &occluder, float occluderRadius) {
+  const glm::vec3 toOccluder = occluder - eye;
+  const glm::vec3 toTarget = target - eye;
+  const float dOccluder = glm::length(toOccluder);
+  const float dTarget = glm::length(toTarget);
+  if(dOccluder <= occluderRadius || dTarget <= targetRadius)
+    return false; // the eye is inside one of the spheres
+  if(dTarget - targetRadius < dOccluder)
+    return false; // part of the target may be in front of the occluder
+
+  // Every point in the silhouette cone of the occluder and farther than its center is hidden
+  const float alphaOccluder = std::asin(occluderRadius / dOccluder);
+  const float alphaTarget = std::asin(targetRadius / dTarget);
+  const float cosTheta = glm::clamp(glm::dot(toOccluder, toTarget) / (dOccluder * dTarget), -1.f, 1.f);
+  return std::acos(cosTheta) + alphaTarget <= alphaOccluder;
+}
+
+void cullOccludedSpheres(const glm::vec3 &eye, const BoundingSphereSoA &spheres, const std::vector<uint32_t> &occluders, std::vector<uint32_t> &visible) {
+  if(occluders.empty())
+    return;
+  const float *xs = spheres.x(), *ys = spheres.y(), *zs = spheres.z(), *rs = spheres.r();
+  size_t kept = 0;
+  for(size_t v = 0; v < visible.size(); ++v) {
+    const uint32_t i = visible[v];
+    const glm::vec3 target(xs[i], ys[i], zs[i]);
+    bool hidden = false;
+    for(size_t o = 0; o < occluders.size() && !hidden; ++o) {
+      const uint32_t j = occluders[o];
+      if(j != i && rs[j] > rs[i])
+        hidden = sphereOccludedBySphere(eye, target, rs[i], glm::vec3(xs[j], ys[j], zs[j]), rs[j]);
+    }
+    if(!hidden)
+      visible[kept++] = i;
+  }
+  visible.resize(kept);
+}
+
+void OcclusionQueries::init(GLuint proxyProgram) {
+  m_program = proxyProgram;
+  m_mvpLocation = glGetUniformLocation(m_program, "mvp");
+
+  // Cube [-1, 1]^3 enclosing the unit bounding sphere, counter-clockwise faces seen from outside
+  const GLfloat vertices[] = {
+    -1, -1, -1,   1, -1, -1,  -1,  1, -1,   1,  1, -1,
+    -1, -1,  1,   1, -1,  1,  -1,  1,  1,   1,  1,  1 };
+  const GLuint indices[] = {
+    4, 5, 7,  4, 7, 6,   // +z
+    0, 2, 3,  0, 3, 1,   // -z
+    1, 3, 7,  1, 7, 5,   // +x
+    0, 4, 6,  0, 6, 2,   // -x
+    2, 6, 7,  2, 7, 3,   // +y
+    0, 1, 5,  0, 5, 4 }; // -y
+
+  glGenVertexArrays(1, &m_vao);
+  glBindVertexArray(m_vao);
+  glGenBuffers(1, &m_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), 0);
+  glEnableVertexAttribArray(0);
+  glGenBuffers(1, &m_ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+  glBindVertexArray(0);
+}
+
+void OcclusionQueries::release() {
+  for(int f = 0; f < 2; ++f) {
+    if(!m_queries[f].empty())
+      glDeleteQueries(static_cast<GLsizei>(m_queries[f].size()), m_queries[f].data());
+    m_queries[f].clear();
+    m_issued[f].clear();
+  }
+  glDeleteBuffers(1, &m_vbo);
+  glDeleteBuffers(1, &m_ibo);
+  glDeleteVertexArrays(1, &m_vao);
+  m_vao = m_vbo = m_ibo = 0;
+}
+
+void OcclusionQueries::resize(size_t numBodies) {
+  for(int f = 0; f < 2; ++f) {
+    const size_t old = m_queries[f].size();
+    if(numBodies == old)
+      continue;
+    if(numBodies < old) {
+      glDeleteQueries(static_cast<GLsizei>(old - numBodies), m_queries[f].data() + numBodies);
+      m_queries[f].resize(numBodies);
+    } else {
+      m_queries[f].resize(numBodies);
+      glGenQueries(static_cast<GLsizei>(numBodies - old), m_queries[f].data() + old);
+    }
+    m_issued[f].assign(numBodies, 0);
+  }
+}
+
+void OcclusionQueries::beginConditionalRender(size_t body) {
+  const int previous = 1 - m_current;
+  m_conditionActive = body < m_issued[previous].size() && m_issued[previous][body];
+  if(m_conditionActive)
+    glBeginConditionalRender(m_queries[previous][body], GL_QUERY_NO_WAIT); // draws anyway if the result is not ready
+}
+
+void OcclusionQueries::endConditionalRender() {
+  if(m_conditionActive)
+    glEndConditionalRender();
+  m_conditionActive = false;
+}
+
+void OcclusionQueries::issueQueries(const std::vector<uint32_t> &bodies, const BoundingSphereSoA &spheres, const glm::mat4 &viewProj, const glm::vec3 &eye) {
+  std::vector<char> &issued = m_issued[m_current];
+  std::fill(issued.begin(), issued.end(), 0);
+
+  GLint previousProgram = 0;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+  glUseProgram(m_program);
+  glBindVertexArray(m_vao);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+
+  const float *xs = spheres.x(), *ys = spheres.y(), *zs = spheres.z(), *rs = spheres.r();
+  for(uint32_t i : bodies) {
+    if(i >= issued.size())
+      continue;
+    const glm::vec3 center(xs[i], ys[i], zs[i]);
+    if(glm::length(eye - center) <= rs[i]*std::sqrt(3.f) + kProxyNearMargin)
+      continue; // the camera is in or next to the box: no query, the body stays visible
+    const glm::mat4 mvp = glm::scale(glm::translate(viewProj, center), glm::vec3(rs[i]));
+    glUniformMatrix4fv(m_mvpLocation, 1, GL_FALSE, glm::value_ptr(mvp));
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, m_queries[m_current][i]);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    issued[i] = 1;
+  }
+
+  glDepthMask(GL_TRUE);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glBindVertexArray(0);
+  glUseProgram(static_cast<GLuint>(previousProgram));
+  m_current = 1 - m_current;
+}
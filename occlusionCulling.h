@@ -0,0 +1,65 @@
+// ----------------------------------------------------------------------------
+// occlusionCulling.h
+//
+// Description: Occlusion culling of the bodies hidden behind large ones, either
+//              on the GPU (occlusion queries + conditional rendering, using the
+//              previous frame's results) or on the CPU (analytic sphere-sphere test).
+// ----------------------------------------------------------------------------
+
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frustumCulling.h"
+
+enum class OcclusionMode {
+  Off,
+  HardwareQueries,
+  CpuSpheres
+};
+
+// True if the sphere (target, targetRadius) is entirely hidden from eye by the opaque sphere
+// (occluder, occluderRadius): it lies in the occluder's silhouette cone and behind its center.
+bool sphereOccludedBySphere(const glm::vec3 &eye, const glm::vec3 &target, float targetRadius, const glm::vec3 &occluder, float occluderRadius);
+
+// Removes from visible the spheres hidden behind one of the occluder spheres (a sphere never
+// occludes itself). The relative order of the remaining indices is kept.
+void cullOccludedSpheres(const glm::vec3 &eye, const BoundingSphereSoA &spheres, const std::vector<uint32_t> &occluders, std::vector<uint32_t> &visible);
+
+// Hardware occlusion queries on the bounding boxes of the bodies. The queries issued in frame N
+// drive the conditional rendering of frame N+1 in GL_QUERY_NO_WAIT mode, so the CPU never waits
+// for a result and a body whose result is not ready yet is simply drawn.
+class OcclusionQueries {
+public:
+  // proxyProgram draws a unit cube transformed by the "mvp" uniform without any shading.
+  void init(GLuint proxyProgram);
+  void release();
+  void resize(size_t numBodies);
+
+  // Wrap the draw of a body; no-op if no query was issued for it in the previous frame.
+  void beginConditionalRender(size_t body);
+  void endConditionalRender();
+
+  // Issues one query per listed body by drawing its bounding box against the current depth
+  // buffer (color and depth writes disabled), then flips to the next frame.
+  void issueQueries(const std::vector<uint32_t> &bodies, const BoundingSphereSoA &spheres, const glm::mat4 &viewProj, const glm::vec3 &eye);
+
+private:
+  GLuint m_program = 0;
+  GLint m_mvpLocation = -1;
+  GLuint m_vao = 0;
+  GLuint m_vbo = 0;
+  GLuint m_ibo = 0;
+  std::vector<GLuint> m_queries[2]; // ping-pong: one set written this frame, one read from last frame
+  std::vector<char> m_issued[2];    // whether the query of a body was issued in that frame
+  bool m_conditionActive = false;
+  int m_current = 0;
+};
+
+#endif // OCCLUSION_CULLING_H
@@ -0,0 +1,177 @@
+// ----------------------------------------------------------------------------
+// parallelJpeg.cpp
+//
+// Description: Multithreaded decoding of large baseline JPEGs (see parallelJpeg.h)
+// ----------------------------------------------------------------------------
+
+#include "parallelJpeg.h"
+#include "threadPool.h"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+// Images from this size up are worth a warning when they cannot be split
+const static size_t kLargeImageTexels = 4096 * 4096;
+
+// Where a JPEG can be cut: the headers, up to the end of its only scan header, are repeated in
+// front of every band (with the frame height patched), then the entropy coded data of the band
+const static size_t kNoOffset = ~size_t(0);
+struct JpegLayout {
+  int width = 0;
+  int height = 0;
+  int mcuWidth = 0;        // texels covered by a minimum coded unit
+  int mcuHeight = 0;
+  int restartInterval = 0; // MCUs between restart markers, 0 without
+  size_t heightField = kNoOffset; // of the frame header
+  size_t headerEnd = 0;           // start of the entropy coded data
+  size_t scanEnd = 0;             // end marker of the entropy coded data
+  std::vector<size_t> restarts;   // restart markers in the entropy coded data
+};
+
+static int readU16(const unsigned char *bytes) {
+  return bytes[0] << 8 | bytes[1];
+}
+
+static size_t greatestCommonDivisor(size_t a, size_t b) {
+  while(b) {
+    const size_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+// False if the data is not a baseline (or extended sequential) Huffman coded JPEG of a single
+// interleaved scan
+static bool parseJpeg(const unsigned char *data, size_t size, JpegLayout &layout) {
+  if(size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return false;
+  int components = 0, maxH = 1, maxV = 1;
+  size_t pos = 2;
+  for(;;) {
+    if(pos + 4 > size || data[pos] != 0xFF)
+      return false;
+    const unsigned char marker = data[pos + 1];
+    if(marker == 0xFF) { // fill byte
+      ++pos;
+      continue;
+    }
+    const size_t length = readU16(data + pos + 2);
+    if(length < 2 || pos + 2 + length > size)
+      return false;
+    const unsigned char *segment = data + pos + 4;
+    if(marker == 0xC0 || marker == 0xC1) {
+      if(length < 8)
+        return false;
+      layout.heightField = pos + 5;
+      layout.height = readU16(segment + 1);
+      layout.width = readU16(segment + 3);
+      components = segment[5];
+      if(layout.height == 0 || length < 8 + 3 * static_cast<size_t>(components))
+        return false; // height given by a DNL marker after the scan: not supported
+      for(int c = 0; c < components; ++c) {
+        maxH = std::max(maxH, segment[7 + 3 * c] >> 4);
+        maxV = std::max(maxV, segment[7 + 3 * c] & 15);
+      }
+    } else if(marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      return false; // progressive, lossless or arithmetic coded
+    } else if(marker == 0xDD) {
+      if(length < 4)
+        return false;
+      layout.restartInterval = readU16(segment);
+    } else if(marker == 0xDA) {
+      if(layout.heightField == kNoOffset || segment[0] != components)
+        return false; // the components come in several scans
+      layout.headerEnd = pos + 2 + length;
+      break;
+    }
+    pos += 2 + length;
+  }
+
+  // Entropy coded data: 0xFF bytes are followed by a stuffed 0, a restart marker or the end
+  for(pos = layout.headerEnd; pos + 1 < size; ++pos) {
+    if(data[pos] != 0xFF || data[pos + 1] == 0xFF)
+      continue;
+    const unsigned char marker = data[++pos];
+    if(marker >= 0xD0 && marker <= 0xD7)
+      layout.restarts.push_back(pos - 1);
+    else if(marker != 0) {
+      layout.scanEnd = pos - 1;
+      break;
+    }
+  }
+  if(layout.scanEnd == 0 || data[pos] != 0xD9)
+    return false; // another scan follows, or the data is truncated
+
+  // A single component scan codes blocks one by one, whatever its sampling factors
+  layout.mcuWidth = components == 1 ? 8 : 8 * maxH;
+  layout.mcuHeight = components == 1 ? 8 : 8 * maxV;
+  return true;
+}
+
+bool decodeJpegParallel(const unsigned char *data, size_t size, int channels, ThreadPool *pool, std::vector<unsigned char> &pixels, int &width,
+                        int &height) {
+  JpegLayout layout;
+  if(!pool || !parseJpeg(data, size, layout))
+    return false;
+  const size_t mcusX = (layout.width + layout.mcuWidth - 1) / layout.mcuWidth;
+  const size_t mcusY = (layout.height + layout.mcuHeight - 1) / layout.mcuHeight;
+  const size_t interval = layout.restartInterval;
+  if(interval == 0 || layout.restarts.size() + 1 != (mcusX * mcusY + interval - 1) / interval) {
+    if(static_cast<size_t>(layout.width) * layout.height >= kLargeImageTexels)
+      std::cerr << "WARNING: JPEG of " << layout.width << "x" << layout.height
+                << " without restart markers, decoded on one thread (add them with jpegtran -restart 1)" << std::endl;
+    return false;
+  }
+
+  // Bands start where a restart interval starts on a new MCU row
+  const size_t intervalsPerBand = mcusX / greatestCommonDivisor(mcusX, interval);
+  const size_t rowsPerBand = intervalsPerBand * interval / mcusX;
+  const size_t numBands = (mcusY + rowsPerBand - 1) / rowsPerBand;
+  if(numBands < 2)
+    return false;
+
+  width = layout.width;
+  height = layout.height;
+  const size_t rowBytes = static_cast<size_t>(width) * channels;
+  pixels.resize(rowBytes * height);
+  // Vertically subsampled chroma is interpolated from the chroma rows above and below: when bands are
+  // small enough for it to be cheap, pieces are decoded with a band of context on either side, which
+  // is dropped, so that their rows match a whole decode
+  const bool context = layout.mcuHeight > 8 && numBands >= 8 * pool->maxChunks();
+  std::atomic<bool> failed(false);
+  // Contiguous bands of a chunk are decoded as one piece: one decoder setup per thread
+  pool->parallelFor(numBands, 1, [&](size_t begin, size_t end, size_t) {
+    const size_t pieceBegin = context && begin > 0 ? begin - 1 : begin;
+    const size_t pieceEnd = context && end < numBands ? end + 1 : end;
+    const int pieceFirstRow = static_cast<int>(pieceBegin * rowsPerBand * layout.mcuHeight);
+    const int pieceLastRow = std::min(height, static_cast<int>(pieceEnd * rowsPerBand * layout.mcuHeight));
+    const int firstRow = static_cast<int>(begin * rowsPerBand * layout.mcuHeight);
+    const int lastRow = std::min(height, static_cast<int>(end * rowsPerBand * layout.mcuHeight));
+    const size_t first = pieceBegin == 0 ? layout.headerEnd : layout.restarts[pieceBegin * intervalsPerBand - 1] + 2;
+    const size_t last = pieceEnd == numBands ? layout.scanEnd : layout.restarts[pieceEnd * intervalsPerBand - 1];
+
+    std::vector<unsigned char> piece;
+    piece.reserve(layout.headerEnd + last - first + 2);
+    piece.insert(piece.end(), data, data + layout.headerEnd);
+    piece[layout.heightField] = static_cast<unsigned char>((pieceLastRow - pieceFirstRow) >> 8);
+    piece[layout.heightField + 1] = static_cast<unsigned char>(pieceLastRow - pieceFirstRow);
+    piece.insert(piece.end(), data + first, data + last);
+    piece.push_back(0xFF);
+    piece.push_back(0xD9); // end of image
+
+    int pieceWidth, pieceHeight, numComponents;
+    unsigned char *decoded = stbi_load_from_memory(piece.data(), static_cast<int>(piece.size()), &pieceWidth, &pieceHeight, &numComponents, channels);
+    if(decoded && pieceWidth == width && pieceHeight == pieceLastRow - pieceFirstRow)
+      std::memcpy(pixels.data() + firstRow * rowBytes, decoded + (firstRow - pieceFirstRow) * rowBytes, (lastRow - firstRow) * rowBytes);
+    else if(!failed.exchange(true))
+      std::cerr << "ERROR: Failed to decode the rows " << pieceFirstRow << " to " << pieceLastRow << " of a JPEG: "
+                << (decoded ? "unexpected size" : stbi_failure_reason()) << std::endl;
+    stbi_image_free(decoded);
+  });
+  return !failed;
+}
@@ -0,0 +1,26 @@
+// ----------------------------------------------------------------------------
+// parallelJpeg.h
+//
+// Description: Multithreaded decoding of large baseline JPEGs. The entropy
+//              coded data restarts at every restart marker, so the image is
+//              cut at the markers falling on MCU row boundaries into bands
+//              that are decoded as separate JPEGs on the thread pool, straight
+//              into their rows of one image. Images without restart markers
+//              get them, losslessly, from: jpegtran -restart 1 in.jpg > out.jpg
+// ----------------------------------------------------------------------------
+
+#ifndef PARALLEL_JPEG_H
+#define PARALLEL_JPEG_H
+
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+
+// Decodes a JPEG in bands on pool into pixels (rows of width texels of channels bytes). Returns false
+// if the data cannot be split (not a single scan baseline JPEG, or without restart markers, which is
+// only reported for large images) or a band fails to decode (reported): the caller then decodes it whole.
+bool decodeJpegParallel(const unsigned char *data, size_t size, int channels, ThreadPool *pool, std::vector<unsigned char> &pixels, int &width,
+                        int &height);
+
+#endif // PARALLEL_JPEG_H
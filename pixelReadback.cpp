@@ -0,0 +1,91 @@
+// ----------------------------------------------------------------------------
+// pixelReadback.cpp
+//
+// Description: Asynchronous framebuffer readback (see pixelReadback.h)
+// ----------------------------------------------------------------------------
+
+#include "pixelReadback.h"
+
+#include <algorithm>
+
+void PixelReadback::init(int width, int height, int numBuffers) {
+  release();
+  m_width = width;
+  m_height = height;
+  m_slots.resize(std::max(numBuffers, 1));
+  const GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * 4;
+  for(Slot &slot : m_slots) {
+    glGenBuffers(1, &slot.pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_oldest = 0;
+  m_pending = 0;
+}
+
+void PixelReadback::release() {
+  for(Slot &slot : m_slots) {
+    if(slot.fence)
+      glDeleteSync(slot.fence);
+    glDeleteBuffers(1, &slot.pbo);
+  }
+  m_slots.clear();
+  m_oldest = 0;
+  m_pending = 0;
+}
+
+void PixelReadback::enqueue(GLuint framebuffer, uint64_t frame) {
+  if(m_slots.empty())
+    return;
+  if(m_pending == m_slots.size())
+    consumeOldest(true); // the ring is full: the consumer is slower than the renderer
+
+  Slot &slot = m_slots[(m_oldest + m_pending) % m_slots.size()];
+  GLint previousRead = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, 0); // returns immediately: the copy targets the PBO
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(previousRead));
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.frame = frame;
+  ++m_pending;
+}
+
+void PixelReadback::poll() {
+  while(m_pending > 0 && consumeOldest(false)) {
+  }
+}
+
+void PixelReadback::flush() {
+  while(m_pending > 0)
+    consumeOldest(true);
+}
+
+bool PixelReadback::consumeOldest(bool wait) {
+  Slot &slot = m_slots[m_oldest];
+  const GLuint64 timeout = wait ? 1000000000ull : 0; // 1s when waiting
+  const GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+  if(status == GL_TIMEOUT_EXPIRED && !wait)
+    return false;
+
+  glDeleteSync(slot.fence);
+  slot.fence = nullptr;
+  if(status != GL_WAIT_FAILED && m_consumer) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    const GLsizeiptr size = static_cast<GLsizeiptr>(m_width) * m_height * 4;
+    const unsigned char *pixels = static_cast<const unsigned char *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+    if(pixels)
+      m_consumer(pixels, m_width, m_height, slot.frame);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  m_oldest = (m_oldest + 1) % m_slots.size();
+  --m_pending;
+  return true;
+}
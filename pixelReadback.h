@@ -0,0 +1,54 @@
+// ----------------------------------------------------------------------------
+// pixelReadback.h
+//
+// Description: Asynchronous framebuffer readback through a ring of pixel buffer
+//              objects, so that glReadPixels never stalls the CPU.
+// ----------------------------------------------------------------------------
+
+#ifndef PIXEL_READBACK_H
+#define PIXEL_READBACK_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class PixelReadback {
+public:
+  // pixels are RGBA8 rows, bottom row first (OpenGL order), valid only during the call
+  typedef std::function<void(const unsigned char *pixels, int width, int height, uint64_t frame)> Consumer;
+
+  void init(int width, int height, int numBuffers = 3);
+  void release();
+  inline void setConsumer(const Consumer &consumer) { m_consumer = consumer; }
+  inline int getWidth() const { return m_width; }
+  inline int getHeight() const { return m_height; }
+
+  // Starts copying the (0, 0, width, height) region of the color attachment 0 of framebuffer into
+  // the next PBO. If that PBO still holds an unconsumed frame, it is consumed first (waiting for it).
+  void enqueue(GLuint framebuffer, uint64_t frame);
+
+  // Consumes the frames whose copy has completed, oldest first, without waiting.
+  void poll();
+  // Waits for and consumes every pending frame (e.g., before exiting).
+  void flush();
+
+private:
+  struct Slot {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    uint64_t frame = 0;
+  };
+  bool consumeOldest(bool wait);
+
+  std::vector<Slot> m_slots;
+  size_t m_oldest = 0;  // oldest pending slot
+  size_t m_pending = 0; // number of slots holding a frame
+  int m_width = 0;
+  int m_height = 0;
+  Consumer m_consumer;
+};
+
+#endif // PIXEL_READBACK_H
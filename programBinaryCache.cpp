@@ -0,0 +1,169 @@
+// ----------------------------------------------------------------------------
+// programBinaryCache.cpp
+//
+// Description: On-disk cache of linked GPU programs (see programBinaryCache.h)
+// ----------------------------------------------------------------------------
+
+#include "programBinaryCache.h"
+#include "fileUtils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+// Not part of the GL 3.3 core profile generated by glad
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+const static uint32_t kEntryMagic = 0x42505353; // "SSPB"
+const static uint32_t kEntryVersion = 1;
+
+// Header of a cache file, followed by the binary
+struct EntryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;    // guards against hash-named files of another key
+  uint32_t format; // binary format returned by the driver
+  uint32_t length; // binary size in bytes
+};
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for(size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static uint64_t hashString(const std::string &s, uint64_t hash) {
+  const uint64_t size = s.size(); // the length separates consecutive strings: ("ab","c") != ("a","bc")
+  hash = fnv1a(&size, sizeof(size), hash);
+  return fnv1a(s.data(), s.size(), hash);
+}
+
+static std::string glString(GLenum name) {
+  const GLubyte *s = glGetString(name);
+  return s ? reinterpret_cast<const char *>(s) : "";
+}
+
+bool ProgramBinaryCache::init(const std::string &directory, GLADloadproc loader) {
+  m_enabled = false;
+  m_getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(loader("glGetProgramBinary"));
+  m_programBinary = reinterpret_cast<ProgramBinaryProc>(loader("glProgramBinary"));
+  m_programParameteri = reinterpret_cast<ProgramParameteriProc>(loader("glProgramParameteri"));
+  if(!m_getProgramBinary || !m_programBinary || !m_programParameteri)
+    return false;
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  if(glGetError() != GL_NO_ERROR || numFormats <= 0)
+    return false;
+
+  makeDirectory(directory.c_str()); // fails harmlessly if it exists; a missing directory only makes stores fail
+  m_directory = directory;
+  m_driverHash = 0xcbf29ce484222325ull;
+  m_driverHash = hashString(glString(GL_VENDOR), m_driverHash);
+  m_driverHash = hashString(glString(GL_RENDERER), m_driverHash);
+  m_driverHash = hashString(glString(GL_VERSION), m_driverHash);
+  m_enabled = true;
+  return true;
+}
+
+uint64_t ProgramBinaryCache::computeKey(const std::vector<std::string> &sources) const {
+  uint64_t hash = m_driverHash;
+  hash = fnv1a(&kEntryVersion, sizeof(kEntryVersion), hash);
+  for(const std::string &source : sources)
+    hash = hashString(source, hash);
+  return hash;
+}
+
+void ProgramBinaryCache::setRetrievable(GLuint program) const {
+  if(m_enabled)
+    m_programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+std::string ProgramBinaryCache::entryPath(uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+  return m_directory + "/" + name;
+}
+
+bool ProgramBinaryCache::load(uint64_t key, GLuint program) {
+  if(!m_enabled)
+    return false;
+  const std::string path = entryPath(key);
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if(!file) {
+    ++m_misses;
+    return false;
+  }
+
+  EntryHeader header;
+  std::vector<char> binary;
+  bool valid = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == kEntryMagic && header.version == kEntryVersion && header.key == key && header.length > 0;
+  if(valid) {
+    binary.resize(header.length);
+    valid = std::fread(binary.data(), 1, binary.size(), file) == binary.size();
+  }
+  std::fclose(file);
+
+  GLint linked = GL_FALSE;
+  if(valid) {
+    m_programBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  }
+  if(!linked) { // truncated file, or a binary the driver no longer accepts: drop it, the caller links from source
+    std::remove(path.c_str());
+    ++m_misses;
+    return false;
+  }
+  ++m_hits;
+  return true;
+}
+
+void ProgramBinaryCache::store(uint64_t key, GLuint program) {
+  if(!m_enabled)
+    return;
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if(length <= 0)
+    return;
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  GLsizei written = 0;
+  m_getProgramBinary(program, length, &written, &format, binary.data());
+  if(written <= 0)
+    return;
+
+  // Written to a temporary file then renamed, so that a concurrent or interrupted run never reads a partial entry
+  const std::string path = entryPath(key);
+  const std::string temporary = temporaryPath(path);
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if(!file) {
+    std::cerr << "WARNING: cannot write the program cache entry " << temporary << std::endl;
+    return;
+  }
+  EntryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kEntryMagic;
+  header.version = kEntryVersion;
+  header.key = key;
+  header.format = format;
+  header.length = static_cast<uint32_t>(written);
+  const bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 && std::fwrite(binary.data(), 1, written, file) == static_cast<size_t>(written);
+  if(std::fclose(file) != 0 || !ok) {
+    std::remove(temporary.c_str());
+    return;
+  }
+  if(!replaceFile(temporary, path))
+    std::remove(temporary.c_str());
+}
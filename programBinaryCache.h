@@ -0,0 +1,60 @@
+// ----------------------------------------------------------------------------
+// programBinaryCache.h
+//
+// Description: On-disk cache of linked GPU programs (glGetProgramBinary),
+//              keyed by a hash of the shader sources, the defines and the GL
+//              driver, so that later runs skip compiling and linking.
+// ----------------------------------------------------------------------------
+
+#ifndef PROGRAM_BINARY_CACHE_H
+#define PROGRAM_BINARY_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ProgramBinaryCache {
+public:
+  // Loads the GL 4.1 / ARB_get_program_binary entry points through loader (the 3.3 glad loader
+  // lacks them) and prepares the cache directory. Returns false, leaving the cache disabled, if the
+  // driver supports no binary format.
+  bool init(const std::string &directory, GLADloadproc loader);
+  inline bool isEnabled() const { return m_enabled; }
+
+  // Key of a program: FNV-1a hash of its sources and defines, and of the GL vendor, renderer and
+  // version, so that a driver update invalidates every entry.
+  uint64_t computeKey(const std::vector<std::string> &sources) const;
+
+  // Marks a program, before linking it, as meant to be stored.
+  void setRetrievable(GLuint program) const;
+
+  // Loads the cached binary of key into program (created but without shaders). Returns false if
+  // there is no entry, or if the driver rejects it, in which case the entry is deleted.
+  bool load(uint64_t key, GLuint program);
+
+  // Stores a successfully linked program under key.
+  void store(uint64_t key, GLuint program);
+
+  inline unsigned getHits() const { return m_hits; }
+  inline unsigned getMisses() const { return m_misses; }
+
+private:
+  std::string entryPath(uint64_t key) const;
+
+  typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+  typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+  typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+  bool m_enabled = false;
+  std::string m_directory;
+  uint64_t m_driverHash = 0;
+  unsigned m_hits = 0;
+  unsigned m_misses = 0;
+  GetProgramBinaryProc m_getProgramBinary = nullptr;
+  ProgramBinaryProc m_programBinary = nullptr;
+  ProgramParameteriProc m_programParameteri = nullptr;
+};
+
+#endif // PROGRAM_BINARY_CACHE_H
@@ -0,0 +1,7 @@
+#version 330 core	     // Minimal GL version support expected from the GPU
+
+out vec4 color;	  // Color writes are disabled while the proxies are drawn
+
+void main() {
+	color = vec4(1.0);
+}
@@ -0,0 +1,8 @@
+#version 330 core            // Minimal GL version support expected from the GPU
+
+layout(location=0) in vec3 vPosition;
+uniform mat4 mvp;
+
+void main() {
+        gl_Position = mvp * vec4(vPosition, 1.0); // bounding box of a body, only rasterized for occlusion queries
+}
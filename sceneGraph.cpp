@@ -0,0 +1,57 @@
+// ----------------------------------------------------------------------------
+// sceneGraph.cpp
+//
+// Description: Flat transform hierarchy with dirty propagation (see sceneGraph.h)
+// ----------------------------------------------------------------------------
+
+#include "sceneGraph.h"
+
+int SceneGraph::addNode(int parent) {
+  const int node = static_cast<int>(m_parent.size());
+  if(parent >= node) // a later parent would break the order
+    parent = kNoParent;
+  m_parent.push_back(parent);
+  m_trs.resize(m_parent.size());
+  m_local.push_back(glm::mat4(1.f));
+  m_world.push_back(glm::mat4(1.f));
+  m_dirty.push_back(1);
+  m_updated.push_back(0);
+  m_firstDirty = std::min(m_firstDirty, static_cast<size_t>(node));
+  return node;
+}
+
+void SceneGraph::clear() {
+  m_parent.clear();
+  m_trs.clear();
+  m_local.clear();
+  m_world.clear();
+  m_dirty.clear();
+  m_updated.clear();
+  m_firstDirty = 0;
+}
+
+void SceneGraph::updateWorldMatrices() {
+  m_lastUpdateCount = 0;
+  if(m_firstDirty >= size())
+    return;
+  ++m_pass;
+  // Parents come first: when a node is reached, its parent's world matrix is final for this pass
+  size_t composedEnd = m_firstDirty; // local matrices are up to date before this node
+  for(size_t i = m_firstDirty; i < size(); ++i) {
+    const int parent = m_parent[i];
+    const bool parentUpdated = parent != kNoParent && m_updated[parent] == m_pass;
+    if(!m_dirty[i] && !parentUpdated)
+      continue;
+    if(m_dirty[i] && i >= composedEnd) {
+      composedEnd = i + 1;
+      while(composedEnd < size() && m_dirty[composedEnd])
+        ++composedEnd;
+      composeTrs(m_trs, i, composedEnd, &m_local[i][0][0]);
+    }
+    m_world[i] = parent == kNoParent ? m_local[i] : m_world[parent] * m_local[i];
+    m_dirty[i] = 0;
+    m_updated[i] = m_pass;
+    ++m_lastUpdateCount;
+  }
+  m_firstDirty = size();
+}
@@ -0,0 +1,81 @@
+// ----------------------------------------------------------------------------
+// sceneGraph.h
+//
+// Description: Transform hierarchy stored as a flat array of nodes in
+//              topological order (every parent before its children), each
+//              with its local translation, rotation and scale and a cached
+//              world matrix. Changing a node marks it dirty; one linear pass
+//              then recomputes the dirty nodes and their descendants only,
+//              starting from the first dirty node. The local matrices of runs
+//              of dirty nodes are composed in SIMD batches (transformBatch.h).
+// ----------------------------------------------------------------------------
+
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transformBatch.h"
+
+class SceneGraph {
+public:
+  const static int kNoParent = -1;
+
+  // Adds a node under parent (an earlier node, or none for a root) with an identity transform, and
+  // returns its index
+  int addNode(int parent = kNoParent);
+  void clear();
+  inline size_t size() const { return m_parent.size(); }
+  inline int getParent(int node) const { return m_parent[node]; }
+
+  // Local transform, relative to the parent: translation * rotation * scale
+  inline void setTranslation(int node, const glm::vec3 &translation) {
+    m_trs.tx[node] = translation.x;
+    m_trs.ty[node] = translation.y;
+    m_trs.tz[node] = translation.z;
+    markDirty(node);
+  }
+  inline void setRotation(int node, const glm::quat &rotation) {
+    m_trs.qx[node] = rotation.x;
+    m_trs.qy[node] = rotation.y;
+    m_trs.qz[node] = rotation.z;
+    m_trs.qw[node] = rotation.w;
+    markDirty(node);
+  }
+  inline void setScale(int node, const glm::vec3 &scale) {
+    m_trs.sx[node] = scale.x;
+    m_trs.sy[node] = scale.y;
+    m_trs.sz[node] = scale.z;
+    markDirty(node);
+  }
+
+  // Recomputes the world matrices of the dirty nodes and of their descendants
+  void updateWorldMatrices();
+  // As of the last updateWorldMatrices
+  inline const glm::mat4 &getWorldMatrix(int node) const { return m_world[node]; }
+  inline size_t getLastUpdateCount() const { return m_lastUpdateCount; }
+
+private:
+  inline void markDirty(int node) {
+    m_dirty[node] = 1;
+    m_firstDirty = std::min(m_firstDirty, static_cast<size_t>(node));
+  }
+
+  std::vector<int> m_parent;
+  TrsArrays m_trs;
+  std::vector<glm::mat4> m_local;  // cached: a node moved by its parent only keeps it
+  std::vector<glm::mat4> m_world;
+  std::vector<uint8_t> m_dirty;    // local transform changed since the last update
+  std::vector<uint32_t> m_updated; // pass in which the world matrix was last recomputed
+  uint32_t m_pass = 0;
+  size_t m_firstDirty = 0;         // size() when no node is dirty
+  size_t m_lastUpdateCount = 0;
+};
+
+#endif // SCENE_GRAPH_H
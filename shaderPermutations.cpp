@@ -0,0 +1,162 @@
+// ----------------------------------------------------------------------------
+// shaderPermutations.cpp
+//
+// Description: Shader permutations (see shaderPermutations.h)
+// ----------------------------------------------------------------------------
+
+#include "shaderPermutations.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+// Not part of the GL 3.3 core profile generated by glad
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+
+static const char *const kShaderFeatureNames[kNumShaderFeatures] = {"TEXTURED", "TEXTURE_ARRAY", "EMISSIVE", "VIRTUAL_TEXTURE"};
+
+std::string shaderFeatureDefines(uint32_t mask) {
+  std::string defines;
+  for(int bit = 0; bit < kNumShaderFeatures; ++bit) {
+    if(mask & (1u << bit))
+      defines += std::string("#define ") + kShaderFeatureNames[bit] + "\n";
+  }
+  return defines;
+}
+
+std::string injectShaderDefines(const std::string &source, const std::string &defines) {
+  if(defines.empty())
+    return source;
+
+  size_t insertAt = 0;
+  int versionLine = 0;
+  const size_t version = source.find("#version");
+  if(version != std::string::npos) {
+    const size_t endOfLine = source.find('\n', version);
+    insertAt = (endOfLine == std::string::npos) ? source.size() : endOfLine + 1;
+    versionLine = static_cast<int>(std::count(source.begin(), source.begin() + insertAt, '\n'));
+  }
+
+  std::ostringstream out;
+  out << source.substr(0, insertAt);
+  if(insertAt == source.size() && (source.empty() || source.back() != '\n'))
+    out << '\n';
+  out << defines << "#line " << (versionLine + 1) << '\n'; // GLSL numbers lines from 1
+  out << source.substr(insertAt);
+  return out.str();
+}
+
+bool ShaderPermutationCache::enableParallelCompile(GLADloadproc loader) {
+  typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+  GLint numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+  const char *function = nullptr;
+  for(GLint i = 0; i < numExtensions && !function; ++i) {
+    const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+    if(std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0)
+      function = "glMaxShaderCompilerThreadsKHR";
+    else if(std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0)
+      function = "glMaxShaderCompilerThreadsARB";
+  }
+  MaxShaderCompilerThreadsProc maxShaderCompilerThreads = function ? reinterpret_cast<MaxShaderCompilerThreadsProc>(loader(function)) : nullptr;
+  if(!maxShaderCompilerThreads)
+    return m_parallel = false;
+  maxShaderCompilerThreads(0xFFFFFFFFu); // as many threads as the implementation wants
+  return m_parallel = true;
+}
+
+bool ShaderPermutationCache::isComplete(GLuint program) const {
+  if(!m_parallel)
+    return true; // unknown: querying the link status waits for it
+  GLint complete = GL_FALSE;
+  glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+  return complete == GL_TRUE;
+}
+
+void ShaderPermutationCache::finish(uint32_t mask, Entry &entry) {
+  entry.state = (entry.program && m_finish && m_finish(mask, entry.program)) ? kReady : kFailed;
+  if(entry.state == kFailed && entry.program) {
+    glDeleteProgram(entry.program);
+    entry.program = 0; // failures stay cached, so that a broken shader is not rebuilt every frame
+  }
+}
+
+void ShaderPermutationCache::finishReload(uint32_t mask, Entry &entry) {
+  const GLuint program = entry.reloadProgram;
+  entry.reloadProgram = 0;
+  if(!m_finish || !m_finish(mask, program)) {
+    glDeleteProgram(program); // the previous program stays in use
+    return;
+  }
+  if(entry.program)
+    glDeleteProgram(entry.program);
+  entry.program = program;
+  entry.state = kReady;
+}
+
+void ShaderPermutationCache::request(uint32_t mask) {
+  if(m_entries.count(mask))
+    return;
+  Entry &entry = m_entries[mask];
+  entry.program = m_submit ? m_submit(mask, shaderFeatureDefines(mask)) : 0;
+}
+
+void ShaderPermutationCache::poll() {
+  for(auto &entry : m_entries) {
+    if(entry.second.state == kPending && isComplete(entry.second.program))
+      finish(entry.first, entry.second);
+    if(entry.second.reloadProgram && isComplete(entry.second.reloadProgram))
+      finishReload(entry.first, entry.second);
+  }
+}
+
+void ShaderPermutationCache::finishAll() {
+  for(auto &entry : m_entries) {
+    if(entry.second.state == kPending)
+      finish(entry.first, entry.second);
+  }
+}
+
+void ShaderPermutationCache::reloadAll() {
+  if(!m_submit)
+    return;
+  for(auto &entry : m_entries) {
+    if(entry.second.state == kPending)
+      continue; // still compiling its first version, from sources read at request time
+    if(entry.second.reloadProgram)
+      glDeleteProgram(entry.second.reloadProgram); // superseded by the newer sources
+    entry.second.reloadProgram = m_submit(entry.first, shaderFeatureDefines(entry.first));
+  }
+}
+
+uint32_t ShaderPermutationCache::resolve(uint32_t mask) {
+  request(mask);
+  Entry &entry = m_entries[mask];
+  if(entry.state == kPending && (mask == m_fallback || isComplete(entry.program)))
+    finish(mask, entry);
+  if(entry.state == kReady || mask == m_fallback)
+    return mask;
+  return resolve(m_fallback);
+}
+
+GLuint ShaderPermutationCache::getProgram(uint32_t mask) const {
+  const auto it = m_entries.find(mask);
+  return (it != m_entries.end() && it->second.state == kReady) ? it->second.program : 0;
+}
+
+size_t ShaderPermutationCache::pendingCount() const {
+  size_t n = 0;
+  for(const auto &entry : m_entries)
+    n += (entry.second.state == kPending);
+  return n;
+}
+
+void ShaderPermutationCache::clear() {
+  for(const auto &entry : m_entries) {
+    if(entry.second.program)
+      glDeleteProgram(entry.second.program);
+    if(entry.second.reloadProgram)
+      glDeleteProgram(entry.second.reloadProgram);
+  }
+  m_entries.clear();
+}
@@ -0,0 +1,99 @@
+// ----------------------------------------------------------------------------
+// shaderPermutations.h
+//
+// Description: Shader permutations: the body shaders are compiled once per set
+//              of #define features actually used, instead of branching on
+//              uniforms per fragment. Programs are compiled without blocking
+//              (GL_KHR_parallel_shader_compile when available), a fallback
+//              permutation being used until they are ready.
+// ----------------------------------------------------------------------------
+
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Feature bits of a permutation; each one maps to a #define of the same name in the shaders
+enum ShaderFeature : uint32_t {
+  kShaderTextured = 1u << 0,     // TEXTURED: albedo from a GL_TEXTURE_2D
+  kShaderTextureArray = 1u << 1, // TEXTURE_ARRAY: albedo from a layer of the albedo texture array
+  kShaderEmissive = 1u << 2,     // EMISSIVE: light source, output the albedo without shading
+  kShaderVirtualTexture = 1u << 3 // VIRTUAL_TEXTURE: albedo streamed in tiles (see virtualTexture.h)
+};
+const static int kNumShaderFeatures = 4;
+
+// "#define TEXTURED\n..." for the bits set in mask
+std::string shaderFeatureDefines(uint32_t mask);
+
+// Inserts defines right after the #version line of source (or at its start if there is none).
+// A #line directive keeps the compiler messages pointing at the lines of the file.
+std::string injectShaderDefines(const std::string &source, const std::string &defines);
+
+// Programs cached by feature mask. A program goes through two steps: submit creates it and
+// issues its compilation and link without querying any status, so that the driver can work on
+// every requested program at once; finish, called once the link completed, checks it and queries
+// its uniforms.
+class ShaderPermutationCache {
+public:
+  typedef std::function<GLuint(uint32_t mask, const std::string &defines)> SubmitFn; // returns the new program
+  typedef std::function<bool(uint32_t mask, GLuint program)> FinishFn;              // returns false if the program is unusable
+
+  inline void setBuilder(const SubmitFn &submit, const FinishFn &finish) { m_submit = submit; m_finish = finish; }
+
+  // Lets the driver compile on its own threads, and completion be polled, with
+  // GL_KHR_parallel_shader_compile (or the ARB variant). Returns false if unsupported: completion
+  // is then only known by waiting for it.
+  bool enableParallelCompile(GLADloadproc loader);
+
+  // Permutation drawn in place of those still compiling (or broken); it is waited for when needed.
+  inline void setFallback(uint32_t mask) { m_fallback = mask; }
+
+  // Submits the permutation if it has not been yet.
+  void request(uint32_t mask);
+
+  // Finishes the programs whose compilation completed (every pending one without the extension).
+  void poll();
+
+  // Waits for and finishes every pending program.
+  void finishAll();
+
+  // Submits every built permutation again, e.g. after its sources changed. The current programs
+  // stay in use until poll finds the new ones linked; a new program that fails is dropped.
+  void reloadAll();
+
+  // Requests the permutation, and returns it if ready, else the fallback (waited for if needed).
+  uint32_t resolve(uint32_t mask);
+
+  // Program of a finished permutation, 0 if it is not ready or failed.
+  GLuint getProgram(uint32_t mask) const;
+  inline bool contains(uint32_t mask) const { return m_entries.count(mask) > 0; }
+  inline size_t size() const { return m_entries.size(); }
+  size_t pendingCount() const;
+
+  void clear(); // deletes every program
+
+private:
+  enum State { kPending, kReady, kFailed };
+  struct Entry {
+    GLuint program = 0;
+    State state = kPending;
+    GLuint reloadProgram = 0; // replacement being compiled, 0 if none
+  };
+
+  bool isComplete(GLuint program) const;
+  void finish(uint32_t mask, Entry &entry);
+  void finishReload(uint32_t mask, Entry &entry);
+
+  SubmitFn m_submit;
+  FinishFn m_finish;
+  uint32_t m_fallback = 0;
+  bool m_parallel = false;
+  std::unordered_map<uint32_t, Entry> m_entries;
+};
+
+#endif // SHADER_PERMUTATIONS_H
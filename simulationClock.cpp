@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------------
+// simulationClock.cpp
+//
+// Description: Fixed timestep clock with time control (see simulationClock.h)
+// ----------------------------------------------------------------------------
+
+#include "simulationClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+const double SimulationClock::kMinWarp = 1e-3;
+const double SimulationClock::kMaxWarp = 1e6;
+
+const static int kUnmeasuredSteps = 8; // per frame, until the cost of a step is known
+
+void SimulationClock::setWarp(double warp) {
+  m_warp = std::min(std::max(warp, kMinWarp), kMaxWarp);
+}
+
+double SimulationClock::frameInterval(double frameTime) {
+  double interval = m_paused ? 0. : frameTime * m_warp;
+  if(m_stepRequested) {
+    interval += m_nominalStep;
+    m_stepRequested = false;
+  }
+  return interval;
+}
+
+int SimulationClock::advance(double frameTime) {
+  // Time from the previous state to the one to render. Within the last step, the two states in
+  // memory still surround it: no steps, and no change of step size
+  const double pending = m_accumulator + frameInterval(frameTime);
+  if(pending < m_step) {
+    m_accumulator = pending;
+    return 0;
+  }
+
+  // Steps the budget affords, from the measured cost of the last ones (a few until measured)
+  int affordable = std::min(m_maxStepsPerFrame, kUnmeasuredSteps);
+  if(m_stepMs > 0.)
+    affordable = static_cast<int>(std::max(1., std::min(static_cast<double>(m_maxStepsPerFrame), m_budgetMs / m_stepMs)));
+
+  // Accurate steps if they fit, else steps up to the stability limit; what is still beyond is dropped.
+  // The time is counted from one new step before the current state, so that the rendered time goes
+  // on smoothly when the step size changes: the first step replaces the last one.
+  const double beyond = pending - m_step; // past the current state
+  double step = m_nominalStep;
+  if(beyond > (affordable - 1) * step)
+    step = std::min(m_maxStep, std::max(m_nominalStep, beyond / std::max(affordable - 1, 1)));
+  const double owed = beyond + step;
+  const int steps = std::max(1, static_cast<int>(std::min(owed / step, static_cast<double>(affordable))));
+  m_accumulator = owed - steps * step;
+  if(m_accumulator >= step) {
+    m_droppedTime += m_accumulator - std::fmod(m_accumulator, step);
+    m_accumulator = std::fmod(m_accumulator, step);
+  }
+  if(m_accumulator < 0.) // rounding
+    m_accumulator = 0.;
+  m_step = step;
+  m_time += steps * step;
+  m_steps += steps;
+  return steps;
+}
+
+void SimulationClock::reportStepsMs(double ms, int steps) {
+  if(steps <= 0)
+    return;
+  const double perStep = ms / steps;
+  m_stepMs = m_stepMs > 0. ? 0.8 * m_stepMs + 0.2 * perStep : perStep;
+}
+
+void SimulationClock::advanceExact(double frameTime) {
+  m_time += frameInterval(frameTime);
+}
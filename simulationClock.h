@@ -0,0 +1,77 @@
+// ----------------------------------------------------------------------------
+// simulationClock.h
+//
+// Description: Fixed timestep clock decoupling the simulation from the frame
+//              rate, with time control (pause, single step, warp factor).
+//              Frame times, scaled by the warp, are accumulated and paid out
+//              in whole steps; what is left over, as a fraction of a step,
+//              tells how far the rendered state lies between the last two
+//              simulated ones. The steps of a frame are kept within a CPU
+//              budget from their measured cost: past it, the steps grow up to
+//              the stability limit of the integrator, then time is dropped
+//              (the effective warp falls) rather than stalling the frame.
+// ----------------------------------------------------------------------------
+
+#ifndef SIMULATION_CLOCK_H
+#define SIMULATION_CLOCK_H
+
+#include <cstdint>
+
+class SimulationClock {
+public:
+  const static double kMinWarp;
+  const static double kMaxWarp;
+
+  // Accurate step, used whenever the budget allows, and the largest step the integrator stays
+  // stable with, used to keep up with high warps
+  inline void setStep(double step) { m_nominalStep = step; m_step = step; }
+  inline void setMaxStep(double step) { m_maxStep = step; }
+  inline double getNominalStep() const { return m_nominalStep; }
+  // Step of the last frame that simulated some (the two last states are that far apart)
+  inline double getStep() const { return m_step; }
+  inline void setBudgetMs(double ms) { m_budgetMs = ms; }
+  inline void setMaxStepsPerFrame(int steps) { m_maxStepsPerFrame = steps; }
+
+  // Time control
+  inline void setPaused(bool paused) { m_paused = paused; }
+  inline bool isPaused() const { return m_paused; }
+  inline void requestStep() { m_stepRequested = true; } // one nominal step, even while paused
+  void setWarp(double warp);                              // clamped to [kMinWarp, kMaxWarp]
+  inline double getWarp() const { return m_warp; }
+
+  // Adds the time of a frame and returns the number of steps (of getStep()) to simulate before rendering it
+  int advance(double frameTime);
+  // Reports the CPU time the steps of the frame took, from which the steps of the next frames are planned
+  void reportStepsMs(double ms, int steps);
+  // For simulations evaluated at any time (no integration): adds the time of a frame, whole
+  void advanceExact(double frameTime);
+
+  // Fraction of a step from the previous state to the current one at which to render (0 to 1)
+  inline double getAlpha() const { return m_accumulator / m_step; }
+  // Simulated time of the current state, and of the rendered one
+  inline double getTime() const { return m_time; }
+  inline double getRenderTime() const { return m_time - (m_step - m_accumulator); }
+  inline uint64_t getSteps() const { return m_steps; }
+  inline double getDroppedTime() const { return m_droppedTime; }
+
+private:
+  double frameInterval(double frameTime);
+
+  double m_nominalStep = 1. / 120.;
+  double m_maxStep = 8. / 120.;
+  double m_step = 1. / 120.;
+  double m_budgetMs = 8.;
+  int m_maxStepsPerFrame = 10000;
+  double m_stepMs = 0.;     // moving average of the cost of a step, 0 until measured
+
+  bool m_paused = false;
+  bool m_stepRequested = false;
+  double m_warp = 1.;
+
+  double m_accumulator = 0.;
+  double m_time = 0.;
+  uint64_t m_steps = 0;
+  double m_droppedTime = 0.;
+};
+
+#endif // SIMULATION_CLOCK_H
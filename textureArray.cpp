@@ -0,0 +1,63 @@
+// ----------------------------------------------------------------------------
+// textureArray.cpp
+//
+// Description: Albedo texture array (see textureArray.h)
+// ----------------------------------------------------------------------------
+
+#include "textureArray.h"
+#include "mipmapGenerator.h"
+#include "textureCompression.h"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <iostream>
+
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0 // GL_EXT_texture_compression_s3tc
+
+int TextureArrayBuilder::addFile(const std::string &filename) {
+  int width, height, numComponents;
+  if(!stbi_info(filename.c_str(), &width, &height, &numComponents)) {
+    std::cerr << "ERROR: Failed to load texture " << filename << ": " << stbi_failure_reason() << std::endl;
+    return -1;
+  }
+  m_width = std::max(m_width, width);
+  m_height = std::max(m_height, height);
+  m_files.push_back(filename);
+  return static_cast<int>(m_files.size()) - 1;
+}
+
+GLuint TextureArrayBuilder::create(bool mipmaps, bool compressed) {
+  if(m_files.empty())
+    return 0;
+
+  GLint maxLayers = 0, maxSize = 0;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  if(static_cast<GLint>(m_files.size()) > maxLayers) {
+    std::cerr << "ERROR: " << m_files.size() << " texture layers requested, the GPU supports " << maxLayers << std::endl;
+    return 0;
+  }
+  m_width = std::min(m_width, static_cast<int>(maxSize));
+  m_height = std::min(m_height, static_cast<int>(maxSize));
+
+  GLuint texID;
+  glGenTextures(1, &texID);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texID);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  const int numLevels = mipmaps ? mipLevelCount(m_width, m_height) : 1;
+  const GLsizei numLayers = static_cast<GLsizei>(m_files.size());
+  for(int level = 0; level < numLevels; ++level) {
+    const int width = std::max(1, m_width >> level);
+    const int height = std::max(1, m_height >> level);
+    if(compressed)
+      glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, width, height, numLayers, 0, static_cast<GLsizei>(bc1Size(width, height) * numLayers), nullptr);
+    else
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, width, height, numLayers, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  return texID;
+}
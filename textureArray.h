@@ -0,0 +1,39 @@
+// ----------------------------------------------------------------------------
+// textureArray.h
+//
+// Description: Packs the albedo maps of the bodies in one GL_TEXTURE_2D_ARRAY,
+//              so that switching body does not require a texture bind.
+// ----------------------------------------------------------------------------
+
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+
+// Lays out the array from the image headers only; the pixels are streamed in afterwards by the
+// AsyncTextureLoader (see textureLoader.h), so that creating the array never waits for a decode.
+class TextureArrayBuilder {
+public:
+  // Reads the size of an image and reserves its layer; returns the layer index, or -1 if the file cannot be read.
+  int addFile(const std::string &filename);
+
+  inline size_t numLayers() const { return m_files.size(); }
+  inline const std::string &getFile(int layer) const { return m_files[layer]; }
+
+  // Creates the GPU texture array, with undefined content. Every layer takes the size of the
+  // largest image (the loader resamples the others), stored as RGB8 or, with compressed, as BC1,
+  // with the storage of a full mip chain if mipmaps is set. Returns 0 on failure.
+  GLuint create(bool mipmaps, bool compressed);
+  inline int getWidth() const { return m_width; }
+  inline int getHeight() const { return m_height; }
+
+private:
+  std::vector<std::string> m_files;
+  int m_width = 0;
+  int m_height = 0;
+};
+
+#endif // TEXTURE_ARRAY_H
@@ -0,0 +1,180 @@
+// ----------------------------------------------------------------------------
+// textureCompression.cpp
+//
+// Description: BC1 block compression (see textureCompression.h)
+// ----------------------------------------------------------------------------
+
+#include "textureCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+static inline uint16_t packRGB565(float r, float g, float b) {
+  const int r5 = std::min(31, std::max(0, static_cast<int>(r * 31.f / 255.f + 0.5f)));
+  const int g6 = std::min(63, std::max(0, static_cast<int>(g * 63.f / 255.f + 0.5f)));
+  const int b5 = std::min(31, std::max(0, static_cast<int>(b * 31.f / 255.f + 0.5f)));
+  return static_cast<uint16_t>((r5 << 11) | (g6 << 5) | b5);
+}
+
+static inline void unpackRGB565(uint16_t c, int rgb[3]) { // as the decoder expands it
+  const int r5 = c >> 11, g6 = (c >> 5) & 63, b5 = c & 31;
+  rgb[0] = (r5 << 3) | (r5 >> 2);
+  rgb[1] = (g6 << 2) | (g6 >> 4);
+  rgb[2] = (b5 << 3) | (b5 >> 2);
+}
+
+static inline void writeBlock(uint16_t c0, uint16_t c1, uint32_t indices, unsigned char block[8]) {
+  block[0] = static_cast<unsigned char>(c0 & 0xFF);
+  block[1] = static_cast<unsigned char>(c0 >> 8);
+  block[2] = static_cast<unsigned char>(c1 & 0xFF);
+  block[3] = static_cast<unsigned char>(c1 >> 8);
+  for(int i = 0; i < 4; ++i)
+    block[4 + i] = static_cast<unsigned char>(indices >> (8*i));
+}
+
+// Picks the nearest of the 4 colors of the 4-color mode (c0 > c1) for every texel; returns the
+// squared error
+static int assignIndices(const int texels[16][3], uint16_t c0, uint16_t c1, uint32_t &indices) {
+  int palette[4][3];
+  unpackRGB565(c0, palette[0]);
+  unpackRGB565(c1, palette[1]);
+  for(int c = 0; c < 3; ++c) {
+    palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+  }
+  indices = 0;
+  int error = 0;
+  for(int i = 0; i < 16; ++i) {
+    int best = 0, bestDistance = 1 << 30;
+    for(int p = 0; p < 4; ++p) {
+      const int dr = texels[i][0] - palette[p][0], dg = texels[i][1] - palette[p][1], db = texels[i][2] - palette[p][2];
+      const int distance = dr*dr + dg*dg + db*db;
+      if(distance < bestDistance) {
+        bestDistance = distance;
+        best = p;
+      }
+    }
+    indices |= static_cast<uint32_t>(best) << (2*i);
+    error += bestDistance;
+  }
+  return error;
+}
+
+// Orders the endpoints for the 4-color mode; false if they are equal (3-color mode, not used)
+static bool orderEndpoints(uint16_t &c0, uint16_t &c1) {
+  if(c0 < c1)
+    std::swap(c0, c1);
+  return c0 != c1;
+}
+
+// Endpoints minimizing the squared error for fixed indices (least squares on the palette weights)
+static bool refineEndpoints(const int texels[16][3], uint32_t indices, float a[3], float b[3]) {
+  const float weights[4] = {1.f, 0.f, 2.f/3.f, 1.f/3.f}; // share of c0 in the palette colors
+  float aa = 0, bb = 0, ab = 0, ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+  for(int i = 0; i < 16; ++i) {
+    const float w = weights[(indices >> (2*i)) & 3], v = 1.f - w;
+    aa += w*w;
+    bb += v*v;
+    ab += w*v;
+    for(int c = 0; c < 3; ++c) {
+      ax[c] += w * texels[i][c];
+      bx[c] += v * texels[i][c];
+    }
+  }
+  const float det = aa*bb - ab*ab;
+  if(std::fabs(det) < 1e-6f)
+    return false;
+  for(int c = 0; c < 3; ++c) {
+    a[c] = (ax[c]*bb - bx[c]*ab) / det;
+    b[c] = (bx[c]*aa - ax[c]*ab) / det;
+  }
+  return true;
+}
+
+static void compressBlock(const int texels[16][3], unsigned char block[8]) {
+  // Principal axis of the colors (power iteration on the covariance), starting from the diagonal of
+  // their bounding box
+  float mean[3] = {0, 0, 0}, lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+  for(int i = 0; i < 16; ++i) {
+    for(int c = 0; c < 3; ++c) {
+      mean[c] += texels[i][c] / 16.f;
+      lo[c] = std::min(lo[c], static_cast<float>(texels[i][c]));
+      hi[c] = std::max(hi[c], static_cast<float>(texels[i][c]));
+    }
+  }
+  float cov[6] = {0, 0, 0, 0, 0, 0}; // rr rg rb gg gb bb
+  for(int i = 0; i < 16; ++i) {
+    const float r = texels[i][0] - mean[0], g = texels[i][1] - mean[1], b = texels[i][2] - mean[2];
+    cov[0] += r*r; cov[1] += r*g; cov[2] += r*b; cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+  }
+  float axis[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+  for(int iteration = 0; iteration < 4; ++iteration) {
+    const float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+    const float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+    const float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+    const float norm = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+    if(norm < 1e-6f)
+      break; // solid block: keep the bounding box diagonal
+    axis[0] = x / norm; axis[1] = y / norm; axis[2] = z / norm;
+  }
+
+  // Extreme texels along the axis as endpoints
+  int minTexel = 0, maxTexel = 0;
+  float minDot = 1e30f, maxDot = -1e30f;
+  for(int i = 0; i < 16; ++i) {
+    const float d = texels[i][0]*axis[0] + texels[i][1]*axis[1] + texels[i][2]*axis[2];
+    if(d < minDot) { minDot = d; minTexel = i; }
+    if(d > maxDot) { maxDot = d; maxTexel = i; }
+  }
+  uint16_t c0 = packRGB565(texels[maxTexel][0], texels[maxTexel][1], texels[maxTexel][2]);
+  uint16_t c1 = packRGB565(texels[minTexel][0], texels[minTexel][1], texels[minTexel][2]);
+  if(!orderEndpoints(c0, c1)) {
+    writeBlock(c0, c1, 0, block); // one color: every index points to c0
+    return;
+  }
+  uint32_t indices;
+  int error = assignIndices(texels, c0, c1, indices);
+
+  // One least squares pass, kept if it lowers the error
+  float a[3], b[3];
+  if(refineEndpoints(texels, indices, a, b)) {
+    uint16_t r0 = packRGB565(a[0], a[1], a[2]);
+    uint16_t r1 = packRGB565(b[0], b[1], b[2]);
+    uint32_t refinedIndices;
+    if(orderEndpoints(r0, r1)) {
+      const int refinedError = assignIndices(texels, r0, r1, refinedIndices);
+      if(refinedError < error) {
+        c0 = r0;
+        c1 = r1;
+        indices = refinedIndices;
+        error = refinedError;
+      }
+    }
+  }
+  writeBlock(c0, c1, indices, block);
+}
+
+void compressBC1(const unsigned char *pixels, int width, int height, int channels, std::vector<unsigned char> &blocks) {
+  const int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+  blocks.resize(bc1Size(width, height));
+  int texels[16][3];
+  for(int by = 0; by < blocksHigh; ++by) {
+    for(int bx = 0; bx < blocksWide; ++bx) {
+      for(int i = 0; i < 16; ++i) {
+        const int x = std::min(4*bx + (i & 3), width - 1);
+        const int y = std::min(4*by + (i >> 2), height - 1);
+        const unsigned char *texel = pixels + (static_cast<size_t>(y) * width + x) * channels;
+        texels[i][0] = texel[0];
+        texels[i][1] = texel[1];
+        texels[i][2] = texel[2];
+      }
+      compressBlock(texels, &blocks[(static_cast<size_t>(by) * blocksWide + bx) * 8]);
+    }
+  }
+}
+
+void solidBC1Block(unsigned char r, unsigned char g, unsigned char b, unsigned char block[8]) {
+  const uint16_t c = packRGB565(r, g, b);
+  writeBlock(c, c, 0, block);
+}
@@ -0,0 +1,26 @@
+// ----------------------------------------------------------------------------
+// textureCompression.h
+//
+// Description: BC1 (S3TC DXT1) block compression of RGB images: principal
+//              axis endpoints refined by least squares, 8 bytes per 4x4 block.
+// ----------------------------------------------------------------------------
+
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <cstddef>
+#include <vector>
+
+// Size in bytes of a BC1 image
+inline size_t bc1Size(int width, int height) {
+  return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+// Compresses a tightly packed 8-bit image with channels 3 or 4 (alpha is ignored) into BC1 blocks,
+// row of blocks after row of blocks. Partial blocks at the borders replicate the last texels.
+void compressBC1(const unsigned char *pixels, int width, int height, int channels, std::vector<unsigned char> &blocks);
+
+// BC1 block of a single color, e.g. to fill a compressed texture with a placeholder
+void solidBC1Block(unsigned char r, unsigned char g, unsigned char b, unsigned char block[8]);
+
+#endif // TEXTURE_COMPRESSION_H
@@ -0,0 +1,444 @@
+// ----------------------------------------------------------------------------
+// textureLoader.cpp
+//
+// Description: Asynchronous texture loading (see textureLoader.h)
+// ----------------------------------------------------------------------------
+
+#include "textureLoader.h"
+#include "ktx2File.h"
+#include "fileUtils.h"
+#include "parallelJpeg.h"
+#include "textureCompression.h"
+#include "threadPool.h"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// Anisotropic filtering: GL_EXT_texture_filter_anisotropic, core in GL 4.6, not in the 3.3 glad loader
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+
+// S3TC: GL_EXT_texture_compression_s3tc, not in the 3.3 glad loader
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+
+// Compressed textures built on first load, as <name>.<width>x<height>.bc1.ktx2, and decoded images,
+// as <content hash>.raw
+const static char kTextureCacheDirectory[] = "textureCache";
+
+// Highest anisotropy used; enough for spheres seen at grazing angles near their silhouette
+const static float kMaxAnisotropy = 8.f;
+
+// Clears every level of a texture (or of an array layer) to a color by attaching them to a temporary
+// framebuffer: cheap on the GPU, and unlike a glTexSubImage of the color it needs no CPU buffer of
+// the texture size
+static void fillTexture(GLenum target, GLuint texture, GLint layer, int numLevels, const glm::vec3 &color) {
+  GLint previousFramebuffer = 0;
+  GLfloat previousClearColor[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClearColor);
+  const GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+  GLuint framebuffer;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  glDisable(GL_SCISSOR_TEST);
+  glClearColor(color.r, color.g, color.b, 1.f);
+  for(int level = 0; level < numLevels; ++level) {
+    if(target == GL_TEXTURE_2D_ARRAY)
+      glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, level, layer);
+    else
+      glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, texture, level);
+    if(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+      glClear(GL_COLOR_BUFFER_BIT);
+  }
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebuffer);
+  glDeleteFramebuffers(1, &framebuffer);
+
+  glClearColor(previousClearColor[0], previousClearColor[1], previousClearColor[2], previousClearColor[3]);
+  if(scissor)
+    glEnable(GL_SCISSOR_TEST);
+}
+
+// Same for a BC1 texture, which cannot be a framebuffer attachment: the levels are filled with
+// solid blocks, a band of block rows at a time
+static void fillCompressedTexture(GLenum target, GLuint texture, GLint layer, int numLevels, int width, int height, const glm::vec3 &color) {
+  unsigned char block[8];
+  solidBC1Block(static_cast<unsigned char>(color.r * 255 + 0.5f), static_cast<unsigned char>(color.g * 255 + 0.5f), static_cast<unsigned char>(color.b * 255 + 0.5f), block);
+  const size_t rowBytes = bc1Size(width, 1);
+  const int bandRows = static_cast<int>(std::max<size_t>(1, (64 << 10) / rowBytes));
+  std::vector<unsigned char> band(rowBytes * bandRows);
+  for(size_t i = 0; i < band.size(); i += 8)
+    std::memcpy(&band[i], block, 8);
+
+  GLint previousTexture = 0, previousUnpackBuffer = 0;
+  glGetIntegerv(target == GL_TEXTURE_2D_ARRAY ? GL_TEXTURE_BINDING_2D_ARRAY : GL_TEXTURE_BINDING_2D, &previousTexture);
+  glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &previousUnpackBuffer);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(target, texture);
+  for(int level = 0; level < numLevels; ++level) {
+    const int levelWidth = std::max(1, width >> level);
+    const int levelHeight = std::max(1, height >> level);
+    for(int y = 0; y < levelHeight; y += 4 * bandRows) {
+      const int rows = std::min(4 * bandRows, levelHeight - y);
+      const GLsizei bytes = static_cast<GLsizei>(bc1Size(levelWidth, rows));
+      if(target == GL_TEXTURE_2D_ARRAY)
+        glCompressedTexSubImage3D(target, level, 0, y, layer, levelWidth, rows, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, bytes, band.data());
+      else
+        glCompressedTexSubImage2D(target, level, 0, y, levelWidth, rows, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, bytes, band.data());
+    }
+  }
+  glBindTexture(target, previousTexture);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, previousUnpackBuffer);
+}
+
+// Path of the compressed cache entry of an image at a given size; the directories of the image path
+// are folded into the name
+static std::string compressedCachePath(const std::string &filename, int width, int height) {
+  std::string name = filename;
+  for(char &c : name) {
+    if(c == '/' || c == '\\' || c == ':')
+      c = '_';
+  }
+  return std::string(kTextureCacheDirectory) + "/" + name + "." + std::to_string(width) + "x" + std::to_string(height) + ".bc1.ktx2";
+}
+
+// Whole content of a file; false if it cannot be read
+static bool readFile(const std::string &filename, std::vector<unsigned char> &content) {
+  std::FILE *file = std::fopen(filename.c_str(), "rb");
+  if(!file)
+    return false;
+  bool ok = std::fseek(file, 0, SEEK_END) == 0;
+  const long size = ok ? std::ftell(file) : -1;
+  ok = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+  if(ok) {
+    content.resize(size);
+    ok = std::fread(content.data(), 1, content.size(), file) == content.size();
+  }
+  std::fclose(file);
+  return ok;
+}
+
+static GLenum pixelFormat(int channels) {
+  return channels == 4 ? GL_RGBA : GL_RGB;
+}
+
+AsyncTextureLoader::~AsyncTextureLoader() {
+  release();
+}
+
+void AsyncTextureLoader::init(ThreadPool *pool, size_t uploadBytesPerFrame) {
+  m_pool = pool;
+  m_budget = uploadBytesPerFrame;
+  glGenBuffers(1, &m_pbo);
+
+  m_maxAnisotropy = 1.f;
+  m_compressionSupported = false;
+  GLint numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+  for(GLint i = 0; i < numExtensions; ++i) {
+    if(std::strcmp(reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i)), "GL_EXT_texture_filter_anisotropic") == 0) {
+      glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &m_maxAnisotropy);
+      m_maxAnisotropy = std::min(m_maxAnisotropy, kMaxAnisotropy);
+    }
+    if(std::strcmp(reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i)), "GL_EXT_texture_compression_s3tc") == 0)
+      m_compressionSupported = true;
+  }
+  if(m_diskCache)
+    m_cache.init(kTextureCacheDirectory);
+}
+
+void AsyncTextureLoader::configureSampling(GLenum target, GLuint texture, int numLevels) const {
+  GLint previousTexture = 0;
+  glGetIntegerv(target == GL_TEXTURE_2D_ARRAY ? GL_TEXTURE_BINDING_2D_ARRAY : GL_TEXTURE_BINDING_2D, &previousTexture);
+  glBindTexture(target, texture);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR); // trilinear
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+  if(numLevels > 1 && m_maxAnisotropy > 1.f)
+    glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, m_maxAnisotropy);
+  glBindTexture(target, previousTexture);
+}
+
+void AsyncTextureLoader::release() {
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_decodedCv.wait(lock, [this]() { return m_decoding == 0; });
+    m_decoded.clear();
+  }
+  m_uploading.clear();
+  m_pending = 0;
+  if(m_pbo)
+    glDeleteBuffers(1, &m_pbo);
+  m_pbo = 0;
+}
+
+GLuint AsyncTextureLoader::loadTexture(const std::string &filename, const glm::vec3 &placeholder) {
+  int width, height, numComponents;
+  if(!stbi_info(filename.c_str(), &width, &height, &numComponents)) {
+    std::cerr << "ERROR: Failed to load texture " << filename << ": " << stbi_failure_reason() << std::endl;
+    return 0;
+  }
+
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->filename = filename;
+  job->target = GL_TEXTURE_2D;
+  job->width = width;
+  job->height = height;
+  job->channels = (numComponents == 2 || numComponents == 4) ? 4 : 3; // grey images are expanded, alpha is kept
+  job->mipmaps = m_mipmaps;
+  job->compressed = getCompression() && job->channels == 3;
+  const int numLevels = m_mipmaps ? mipLevelCount(width, height) : 1;
+
+  glGenTextures(1, &job->texture); // generate an OpenGL texture container
+  GLint previousTexture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  glBindTexture(GL_TEXTURE_2D, job->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  for(int level = 0; level < numLevels; ++level) {
+    const int levelWidth = std::max(1, width >> level);
+    const int levelHeight = std::max(1, height >> level);
+    if(job->compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, levelWidth, levelHeight, 0, static_cast<GLsizei>(bc1Size(levelWidth, levelHeight)), nullptr);
+    else
+      glTexImage2D(GL_TEXTURE_2D, level, job->channels == 4 ? GL_RGBA8 : GL_RGB8, levelWidth, levelHeight, 0, pixelFormat(job->channels), GL_UNSIGNED_BYTE, nullptr);
+  }
+  glBindTexture(GL_TEXTURE_2D, previousTexture);
+  configureSampling(GL_TEXTURE_2D, job->texture, numLevels);
+
+  if(job->compressed)
+    fillCompressedTexture(GL_TEXTURE_2D, job->texture, 0, numLevels, width, height, placeholder);
+  else
+    fillTexture(GL_TEXTURE_2D, job->texture, 0, numLevels, placeholder);
+  submit(job);
+  return job->texture;
+}
+
+void AsyncTextureLoader::loadLayer(GLuint array, int layer, int width, int height, const std::string &filename, const glm::vec3 &placeholder) {
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->filename = filename;
+  job->target = GL_TEXTURE_2D_ARRAY;
+  job->texture = array;
+  job->layer = layer;
+  job->width = width;
+  job->height = height;
+  job->channels = 3; // the array is RGB8 or BC1
+  job->mipmaps = m_mipmaps;
+  const int numLevels = m_mipmaps ? mipLevelCount(width, height) : 1;
+
+  GLint previousArray = 0, internalFormat = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &previousArray);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, previousArray);
+  job->compressed = internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+  configureSampling(GL_TEXTURE_2D_ARRAY, array, numLevels);
+  if(job->compressed)
+    fillCompressedTexture(GL_TEXTURE_2D_ARRAY, array, layer, numLevels, width, height, placeholder);
+  else
+    fillTexture(GL_TEXTURE_2D_ARRAY, array, layer, numLevels, placeholder);
+  submit(job);
+}
+
+void AsyncTextureLoader::submit(const std::shared_ptr<Job> &job) {
+  ++m_pending;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_decoding;
+  }
+  const auto decodeJob = [this, job]() {
+    const auto start = std::chrono::steady_clock::now();
+    const bool cached = job->compressed ? decodeCompressed(*job) : decodeCached(*job);
+    const uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if(cached) {
+      ++m_cacheLoads;
+      m_cacheLoadMicros += micros;
+    } else {
+      ++m_decodes;
+      m_decodeMicros += micros;
+    }
+    job->level = static_cast<int>(job->levels.size()) - 1;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_decoded.push_back(job);
+    --m_decoding;
+    m_decodedCv.notify_all();
+  };
+  if(m_pool)
+    m_pool->submit(decodeJob);
+  else
+    decodeJob();
+}
+
+void AsyncTextureLoader::decode(Job &job, const std::vector<unsigned char> &encoded) const {
+  // Large JPEGs are decoded in bands by the idle workers; anything else whole on this thread
+  std::vector<unsigned char> bands;
+  int width, height, numComponents;
+  unsigned char *decoded = nullptr;
+  if(!decodeJpegParallel(encoded.data(), encoded.size(), job.channels, m_pool, bands, width, height)) {
+    decoded = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &numComponents, job.channels);
+    if(!decoded) {
+      std::cerr << "ERROR: Failed to load texture " << job.filename << ": " << stbi_failure_reason() << std::endl;
+      return;
+    }
+  }
+  const unsigned char *data = decoded ? decoded : bands.data();
+  job.levels.resize(1);
+  MipLevel &base = job.levels[0];
+  base.width = job.width;
+  base.height = job.height;
+  if(width != job.width || height != job.height)
+    resampleImage(data, width, height, job.channels, base.pixels, job.width, job.height);
+  else
+    base.pixels.assign(data, data + static_cast<size_t>(width) * height * job.channels);
+  stbi_image_free(decoded);
+  if(job.mipmaps)
+    generateMipChain(job.levels, job.channels, true); // albedo maps are sRGB
+}
+
+bool AsyncTextureLoader::decodeCached(Job &job) {
+  std::vector<unsigned char> encoded;
+  if(!readFile(job.filename, encoded)) {
+    std::cerr << "ERROR: Failed to load texture " << job.filename << ": cannot read the file" << std::endl;
+    return false;
+  }
+  // Keyed by content, so that an edited image (or another one under the same name) is decoded again
+  const int numLevels = job.mipmaps ? mipLevelCount(job.width, job.height) : 1;
+  const uint64_t key = DecodedImageCache::computeKey(hashBytes(encoded.data(), encoded.size()), job.width, job.height, job.channels, numLevels);
+  if(m_cache.load(key, job.width, job.height, job.channels, numLevels, job.mapped)) {
+    job.levels = job.mapped.levels;
+    return true;
+  }
+  decode(job, encoded);
+  if(!job.levels.empty())
+    m_cache.store(key, job.levels, job.channels);
+  return false;
+}
+
+bool AsyncTextureLoader::decodeCompressed(Job &job) {
+  const size_t numLevels = job.mipmaps ? mipLevelCount(job.width, job.height) : 1;
+  const std::string path = compressedCachePath(job.filename, job.width, job.height);
+  uint32_t vkFormat;
+  if(m_cache.isEnabled() && isNewerThan(path, job.filename) && readKtx2(path, vkFormat, job.levels) && job.levels[0].width == job.width &&
+     job.levels[0].height == job.height && job.levels.size() >= numLevels) {
+    job.levels.resize(numLevels); // an entry written with mipmaps serves a run without
+    return true;
+  }
+
+  // First load (or a stale entry): build the chain, compress it and store it for the next runs. The
+  // texels are sRGB encoded, but the texture is sampled as UNORM like the uncompressed path.
+  std::vector<unsigned char> encoded;
+  if(!readFile(job.filename, encoded)) {
+    std::cerr << "ERROR: Failed to load texture " << job.filename << ": cannot read the file" << std::endl;
+    return false;
+  }
+  decode(job, encoded);
+  if(job.levels.empty())
+    return false; // decode failed (reported): the placeholder stays
+  std::vector<unsigned char> blocks;
+  for(MipLevel &level : job.levels) {
+    compressBC1(level.pixels.data(), level.width, level.height, job.channels, blocks);
+    level.pixels.swap(blocks);
+  }
+  if(!m_cache.isEnabled())
+    return false;
+  const std::string temporary = temporaryPath(path); // jobs, and other instances, may share an entry
+  if(!writeKtx2(temporary, kVkFormatBC1RGBSrgb, job.levels) || !replaceFile(temporary, path))
+    std::remove(temporary.c_str());
+  return false;
+}
+
+void AsyncTextureLoader::upload(size_t budget) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while(!m_decoded.empty()) {
+      m_uploading.push_back(std::move(m_decoded.front()));
+      m_decoded.pop_front();
+    }
+  }
+  if(m_uploading.empty())
+    return;
+
+  GLint previousAlignment = 4, previous2D = 0, previousArray = 0;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous2D);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &previousArray);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows are tightly packed
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+
+  // Levels are uploaded from the smallest, so that distant bodies are right first, in bands of rows:
+  // at least one row per frame, so that any budget progresses
+  while(!m_uploading.empty() && budget > 0) {
+    Job &job = *m_uploading.front();
+    if(!job.levels.empty()) {
+      MipLevel &level = job.levels[job.level];
+      const size_t rowBytes = job.compressed ? bc1Size(level.width, 1) : static_cast<size_t>(level.width) * job.channels;
+      const int levelRows = job.compressed ? (level.height + 3) / 4 : level.height;
+      const int rows = static_cast<int>(std::min<size_t>(std::max<size_t>(budget / rowBytes, 1), levelRows - job.rowsUploaded));
+      const size_t bytes = rows * rowBytes;
+
+      // Orphaning the buffer lets the driver hand out new storage while the previous band is still being read
+      const unsigned char *pixels = job.mapped.file ? job.mapped.pixels[job.level] : level.pixels.data(); // straight from the mapping when cached
+      const unsigned char *band = pixels + job.rowsUploaded * rowBytes;
+      const void *source = nullptr; // offset in the unpack buffer
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+      void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      if(mapped) {
+        std::memcpy(mapped, band, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      } else { // upload from client memory instead
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        source = band;
+      }
+      glBindTexture(job.target, job.texture);
+      if(job.compressed) {
+        const int y = 4 * job.rowsUploaded;
+        const int height = std::min(4 * rows, level.height - y);
+        if(job.target == GL_TEXTURE_2D_ARRAY)
+          glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, job.level, 0, y, job.layer, level.width, height, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(bytes), source);
+        else
+          glCompressedTexSubImage2D(GL_TEXTURE_2D, job.level, 0, y, level.width, height, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(bytes), source);
+      } else if(job.target == GL_TEXTURE_2D_ARRAY)
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, job.level, 0, job.rowsUploaded, job.layer, level.width, rows, 1, pixelFormat(job.channels), GL_UNSIGNED_BYTE, source);
+      else
+        glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.rowsUploaded, level.width, rows, pixelFormat(job.channels), GL_UNSIGNED_BYTE, source);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+      job.rowsUploaded += rows;
+      budget -= std::min(budget, bytes);
+      if(job.rowsUploaded < levelRows)
+        continue;
+
+      std::vector<unsigned char>().swap(level.pixels); // free the level as soon as it is on the GPU
+      job.rowsUploaded = 0;
+      if(job.target == GL_TEXTURE_2D)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level); // sample only the uploaded levels (array layers share the parameter)
+      if(job.level-- > 0)
+        continue;
+    }
+    m_uploading.pop_front(); // done, or failed to decode: the placeholder stays
+    --m_pending;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, previous2D);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, previousArray);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+}
+
+void AsyncTextureLoader::finishAll() {
+  while(m_pending > 0) {
+    if(m_uploading.empty()) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_decodedCv.wait(lock, [this]() { return !m_decoded.empty(); });
+    }
+    upload(std::numeric_limits<size_t>::max());
+  }
+}
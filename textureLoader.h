@@ -0,0 +1,132 @@
+// ----------------------------------------------------------------------------
+// textureLoader.h
+//
+// Description: Asynchronous texture loading: images are decoded, and their mip
+//              chain generated, on the thread pool, then streamed to the GPU
+//              through a pixel unpack buffer with a byte budget per frame.
+//              Textures show a placeholder color until their pixels arrive.
+//              RGB images are BC1 compressed on first load and kept in a KTX2
+//              cache, so later runs upload the compressed blocks directly;
+//              uncompressed ones are kept decoded in a memory mapped cache.
+// ----------------------------------------------------------------------------
+
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "decodedImageCache.h"
+#include "mipmapGenerator.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+class AsyncTextureLoader {
+public:
+  ~AsyncTextureLoader();
+
+  // pool may be null (images are then decoded on the calling thread); at most uploadBytesPerFrame
+  // bytes are copied to the GPU by each update().
+  void init(ThreadPool *pool, size_t uploadBytesPerFrame);
+  void release(); // waits for the decodes in flight, drops the pending uploads
+
+  inline void setUploadBudget(size_t bytesPerFrame) { m_budget = bytesPerFrame; }
+
+  // Textures loaded afterwards get a full mip chain, filtered as sRGB, and trilinear (anisotropic
+  // when supported) filtering; otherwise a single level with bilinear filtering. On by default.
+  inline void setMipmaps(bool mipmaps) { m_mipmaps = mipmaps; }
+  inline bool getMipmaps() const { return m_mipmaps; }
+
+  // RGB textures loaded afterwards are stored BC1 compressed, when the GPU supports S3TC (known
+  // after init). On by default. Images with alpha stay uncompressed.
+  inline void setCompression(bool compression) { m_compression = compression; }
+  inline bool getCompression() const { return m_compression && m_compressionSupported; }
+
+  // Textures loaded afterwards are read from, and written to, the on-disk caches of decoded and
+  // compressed images (set before init). On by default.
+  inline void setDiskCache(bool diskCache) { m_diskCache = diskCache; }
+
+  // Images taken from the disk caches, and decoded from their files, so far; with the time the
+  // decoding threads spent on each kind (summed over the threads)
+  inline uint64_t getCacheLoads() const { return m_cacheLoads; }
+  inline uint64_t getDecodes() const { return m_decodes; }
+  inline double getCacheLoadMs() const { return m_cacheLoadMicros / 1000.; }
+  inline double getDecodeMs() const { return m_decodeMicros / 1000.; }
+
+  // Sets the filtering of a texture with numLevels levels, and its highest level.
+  void configureSampling(GLenum target, GLuint texture, int numLevels) const;
+
+  // Creates a GL_TEXTURE_2D of the size given by the image header, filled with placeholder, and
+  // queues its decode. Returns 0 if the file cannot be read.
+  GLuint loadTexture(const std::string &filename, const glm::vec3 &placeholder);
+
+  // Fills a layer of an RGB8 or BC1 GL_TEXTURE_2D_ARRAY of the given size with placeholder, and
+  // queues the decode of filename into it (resampled to the layer size if needed). With mipmaps, the
+  // array must have the storage of every level.
+  void loadLayer(GLuint array, int layer, int width, int height, const std::string &filename, const glm::vec3 &placeholder);
+
+  // Uploads decoded images within the per-frame budget; call once per frame on the GL thread.
+  inline void update() { upload(m_budget); }
+
+  // Waits for every decode and uploads everything (for runs that must not show placeholders).
+  void finishAll();
+
+  // Textures whose pixels are not all on the GPU yet.
+  inline size_t pendingCount() const { return m_pending; }
+
+private:
+  struct Job {
+    std::string filename;
+    GLenum target = GL_TEXTURE_2D;
+    GLuint texture = 0;
+    GLint layer = 0;
+    int width = 0;   // size and channels of the texture storage (level 0)
+    int height = 0;
+    int channels = 3;
+    bool mipmaps = true;
+    bool compressed = false;      // BC1 storage: levels hold blocks, rows are rows of blocks
+    std::vector<MipLevel> levels; // at the storage size, empty if the decode failed
+    MappedImage mapped;           // when set, holds the pixels of levels (which only give the sizes)
+    int level = 0;                // level being uploaded: from the smallest up to 0
+    int rowsUploaded = 0;         // rows of that level already uploaded
+  };
+
+  void submit(const std::shared_ptr<Job> &job);
+  void decode(Job &job, const std::vector<unsigned char> &encoded) const;
+  bool decodeCached(Job &job);     // from the decoded image cache, or decode; true if cached
+  bool decodeCompressed(Job &job); // from the KTX2 cache, or decode then compress; true if cached
+  void upload(size_t budget);
+
+  ThreadPool *m_pool = nullptr;
+  size_t m_budget = 0;
+  bool m_mipmaps = true;
+  bool m_compression = true;
+  bool m_compressionSupported = false;
+  bool m_diskCache = true;
+  DecodedImageCache m_cache;
+  float m_maxAnisotropy = 1.f; // 1 without anisotropic filtering support
+  GLuint m_pbo = 0;
+
+  std::mutex m_mutex;
+  std::condition_variable m_decodedCv;
+  std::deque<std::shared_ptr<Job>> m_decoded; // filled by the decoding threads
+  size_t m_decoding = 0;                      // decodes in flight, guarded by m_mutex
+  std::atomic<uint64_t> m_cacheLoads{0};
+  std::atomic<uint64_t> m_decodes{0};
+  std::atomic<uint64_t> m_cacheLoadMicros{0};
+  std::atomic<uint64_t> m_decodeMicros{0};
+
+  std::deque<std::shared_ptr<Job>> m_uploading; // GL thread only
+  size_t m_pending = 0;                         // GL thread only
+};
+
+#endif // TEXTURE_LOADER_H
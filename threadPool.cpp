@@ -0,0 +1,101 @@
+// ----------------------------------------------------------------------------
+// threadPool.cpp
+//
+// Description: Minimal fixed-size worker pool (see threadPool.h)
+// ----------------------------------------------------------------------------
+
+#include "threadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(size_t numThreads) {
+  if(numThreads == 0) {
+    const unsigned int hw = std::thread::hardware_concurrency();
+    numThreads = (hw > 1) ? hw - 1 : 0; // the calling thread also works in parallelFor
+  }
+  m_workers.reserve(numThreads);
+  for(size_t i = 0; i < numThreads; ++i)
+    m_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+  for(std::thread &t : m_workers)
+    t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  if(m_workers.empty()) { // no worker: run inline rather than never
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+  }
+  m_cond.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t minChunk, const std::function<void(size_t, size_t, size_t)> &fn) {
+  if(count == 0)
+    return;
+  minChunk = std::max<size_t>(minChunk, 1);
+  const size_t numChunks = std::min(maxChunks(), (count + minChunk - 1) / minChunk);
+  if(numChunks <= 1) {
+    fn(0, count, 0);
+    return;
+  }
+
+  // Chunks are claimed from a shared counter by the calling thread and by the tasks queued for the
+  // workers: the caller ends up running every chunk no worker has started, so a call made from a
+  // worker (a decode splitting its image, say) completes even when all the others are busy.
+  struct Work {
+    std::atomic<size_t> next{0};
+    size_t done = 0;
+    std::mutex doneMutex;
+    std::condition_variable doneCond;
+  };
+  const std::shared_ptr<Work> work = std::make_shared<Work>(); // outlives the call for tasks that start late
+  const size_t chunkSize = (count + numChunks - 1) / numChunks;
+  const std::function<void(size_t, size_t, size_t)> *body = &fn; // only used while chunks remain, hence during the call
+  const auto runChunks = [work, chunkSize, count, numChunks, body]() {
+    size_t c;
+    while((c = work->next++) < numChunks) {
+      const size_t begin = c * chunkSize;
+      const size_t end = std::min(count, begin + chunkSize);
+      if(begin < end)
+        (*body)(begin, end, c);
+      std::lock_guard<std::mutex> lock(work->doneMutex);
+      if(++work->done == numChunks)
+        work->doneCond.notify_one();
+    }
+  };
+
+  for(size_t c = 1; c < numChunks; ++c)
+    submit(runChunks);
+  runChunks();
+
+  std::unique_lock<std::mutex> lock(work->doneMutex);
+  work->doneCond.wait(lock, [&]() { return work->done == numChunks; });
+}
+
+void ThreadPool::workerLoop() {
+  for(;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+      if(m_stop && m_tasks.empty())
+        return;
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
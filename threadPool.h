@@ -0,0 +1,50 @@
+// ----------------------------------------------------------------------------
+// threadPool.h
+//
+// Description: Minimal fixed-size worker pool used by the CPU-side stages
+//              (culling, simulation, asset decoding) of the solar system.
+// ----------------------------------------------------------------------------
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t numThreads = 0); // 0 uses one worker per hardware thread, minus the calling thread
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  inline size_t size() const { return m_workers.size(); }
+
+  // Queues a task for asynchronous execution on one of the workers.
+  void submit(std::function<void()> task);
+
+  // Splits [0, count) in at most size()+1 contiguous chunks of at least minChunk elements and
+  // runs fn(begin, end, chunkIndex) on them; the calling thread takes part and the call blocks
+  // until every chunk is done. chunkIndex is in [0, maxChunks()) and can index per-chunk outputs.
+  // Can be called from a task running on the pool.
+  void parallelFor(size_t count, size_t minChunk, const std::function<void(size_t, size_t, size_t)> &fn);
+
+  inline size_t maxChunks() const { return m_workers.size() + 1; }
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_stop = false;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,137 @@
+// ----------------------------------------------------------------------------
+// transformBatch.cpp
+//
+// Description: Batched TRS to matrix composition (see transformBatch.h)
+// ----------------------------------------------------------------------------
+
+#include "transformBatch.h"
+
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORM_USE_SSE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_USE_SSE
+#endif
+
+void TrsArrays::resize(size_t count) {
+  for(std::vector<float> *v : {&tx, &ty, &tz, &qx, &qy, &qz})
+    v->resize(count, 0.f);
+  for(std::vector<float> *v : {&qw, &sx, &sy, &sz})
+    v->resize(count, 1.f);
+}
+
+void TrsArrays::clear() {
+  for(std::vector<float> *v : {&tx, &ty, &tz, &qx, &qy, &qz, &qw, &sx, &sy, &sz})
+    v->clear();
+}
+
+// Lane-wise float operations of composeLanes (1 scalar, 4 SSE or 8 AVX lanes); there is no
+// branch, so no mask. store writes the 16 matrix elements of every lane (m[4 * column + row]) as
+// whole matrices.
+struct ScalarOps {
+  typedef float Vec;
+  const static size_t kWidth = 1;
+  static inline Vec set(float v) { return v; }
+  static inline Vec load(const float *p) { return *p; }
+  static inline Vec add(Vec a, Vec b) { return a + b; }
+  static inline Vec sub(Vec a, Vec b) { return a - b; }
+  static inline Vec mul(Vec a, Vec b) { return a * b; }
+  static inline void store(float *out, const Vec (&m)[16], bool) {
+    for(int i = 0; i < 16; ++i)
+      out[i] = m[i];
+  }
+};
+
+#if defined(TRANSFORM_USE_SSE)
+// Transposes 4 registers holding one element of 4 matrices into one column of each matrix
+static inline void storeColumns(float *out, __m128 a, __m128 b, __m128 c, __m128 d, bool stream) {
+  _MM_TRANSPOSE4_PS(a, b, c, d);
+  if(stream) {
+    _mm_stream_ps(out, a);
+    _mm_stream_ps(out + 16, b);
+    _mm_stream_ps(out + 32, c);
+    _mm_stream_ps(out + 48, d);
+  } else {
+    _mm_storeu_ps(out, a);
+    _mm_storeu_ps(out + 16, b);
+    _mm_storeu_ps(out + 32, c);
+    _mm_storeu_ps(out + 48, d);
+  }
+}
+
+static inline void storeMatrices4(float *out, const __m128 (&m)[16], bool stream) {
+  for(int column = 0; column < 4; ++column)
+    storeColumns(out + 4 * column, m[4 * column], m[4 * column + 1], m[4 * column + 2], m[4 * column + 3], stream);
+}
+#endif
+
+#if defined(__AVX__)
+struct SimdOps {
+  typedef __m256 Vec;
+  const static size_t kWidth = 8;
+  static inline Vec set(float v) { return _mm256_set1_ps(v); }
+  static inline Vec load(const float *p) { return _mm256_loadu_ps(p); }
+  static inline Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static inline Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+  static inline Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+  static inline void store(float *out, const Vec (&m)[16], bool stream) {
+    __m128 low[16], high[16];
+    for(int i = 0; i < 16; ++i) {
+      low[i] = _mm256_castps256_ps128(m[i]);
+      high[i] = _mm256_extractf128_ps(m[i], 1);
+    }
+    storeMatrices4(out, low, stream);
+    storeMatrices4(out + 64, high, stream);
+  }
+};
+#elif defined(TRANSFORM_USE_SSE)
+struct SimdOps {
+  typedef __m128 Vec;
+  const static size_t kWidth = 4;
+  static inline Vec set(float v) { return _mm_set1_ps(v); }
+  static inline Vec load(const float *p) { return _mm_loadu_ps(p); }
+  static inline Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+  static inline Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+  static inline Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+  static inline void store(float *out, const Vec (&m)[16], bool stream) { storeMatrices4(out, m, stream); }
+};
+#endif
+
+// Composes Ops::kWidth transforms from index i
+template <class Ops>
+static inline void composeLanes(const TrsArrays &trs, size_t i, float *out, bool stream) {
+  typedef typename Ops::Vec Vec;
+  const Vec x = Ops::load(&trs.qx[i]), y = Ops::load(&trs.qy[i]), z = Ops::load(&trs.qz[i]), w = Ops::load(&trs.qw[i]);
+  const Vec two = Ops::set(2.f), one = Ops::set(1.f), zero = Ops::set(0.f);
+  const Vec x2 = Ops::mul(x, two), y2 = Ops::mul(y, two), z2 = Ops::mul(z, two);
+  const Vec xx = Ops::mul(x, x2), yy = Ops::mul(y, y2), zz = Ops::mul(z, z2);
+  const Vec xy = Ops::mul(x, y2), xz = Ops::mul(x, z2), yz = Ops::mul(y, z2);
+  const Vec wx = Ops::mul(w, x2), wy = Ops::mul(w, y2), wz = Ops::mul(w, z2);
+  const Vec sx = Ops::load(&trs.sx[i]), sy = Ops::load(&trs.sy[i]), sz = Ops::load(&trs.sz[i]);
+
+  // Rotation matrix of the quaternion (as glm::mat4_cast), column c scaled by the scale along c
+  const Vec m[16] = {
+    Ops::mul(Ops::sub(one, Ops::add(yy, zz)), sx), Ops::mul(Ops::add(xy, wz), sx), Ops::mul(Ops::sub(xz, wy), sx), zero,
+    Ops::mul(Ops::sub(xy, wz), sy), Ops::mul(Ops::sub(one, Ops::add(xx, zz)), sy), Ops::mul(Ops::add(yz, wx), sy), zero,
+    Ops::mul(Ops::add(xz, wy), sz), Ops::mul(Ops::sub(yz, wx), sz), Ops::mul(Ops::sub(one, Ops::add(xx, yy)), sz), zero,
+    Ops::load(&trs.tx[i]), Ops::load(&trs.ty[i]), Ops::load(&trs.tz[i]), one
+  };
+  Ops::store(out, m, stream);
+}
+
+void composeTrs(const TrsArrays &trs, size_t begin, size_t end, float *matrices, bool stream) {
+  if(reinterpret_cast<uintptr_t>(matrices) & 15)
+    stream = false; // _mm_stream_ps faults on unaligned addresses, and every matrix is as misaligned as the first
+  size_t i = begin;
+#if defined(TRANSFORM_USE_SSE)
+  for(; i + SimdOps::kWidth <= end; i += SimdOps::kWidth)
+    composeLanes<SimdOps>(trs, i, matrices + 16 * (i - begin), stream);
+  if(stream)
+    _mm_sfence(); // the streamed stores are weakly ordered: make them visible before the buffer is used
+#endif
+  for(; i < end; ++i)
+    composeLanes<ScalarOps>(trs, i, matrices + 16 * (i - begin), stream);
+}
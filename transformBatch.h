@@ -0,0 +1,36 @@
+// ----------------------------------------------------------------------------
+// transformBatch.h
+//
+// Description: Batched composition of translation * rotation * scale into 4x4
+//              matrices. The inputs are structure-of-arrays, so that SSE (4
+//              transforms per iteration) or AVX (8) lanes each take one
+//              transform; the matrices are transposed back to glm's layout on
+//              the way out, and can be streamed straight into mapped buffers.
+// ----------------------------------------------------------------------------
+
+#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#include <cstddef>
+#include <vector>
+
+// Translations, rotations (unit quaternions) and scales, one array per component
+struct TrsArrays {
+  std::vector<float> tx, ty, tz;
+  std::vector<float> qx, qy, qz, qw;
+  std::vector<float> sx, sy, sz;
+
+  // New transforms are identities
+  void resize(size_t count);
+  void clear();
+  inline size_t size() const { return tx.size(); }
+};
+
+// Writes the matrices of transforms [begin, end) to matrices, 16 floats per transform in column-major
+// order (glm::mat4). With stream, the stores bypass the caches (non-temporal, whole 64-byte matrices),
+// which suits write-combined memory such as a mapped GL buffer. Streaming needs matrices 16-byte
+// aligned, which a mapped pointer is not guaranteed to be before GL 4.2: unaligned, the stores are
+// regular ones.
+void composeTrs(const TrsArrays &trs, size_t begin, size_t end, float *matrices, bool stream = false);
+
+#endif // TRANSFORM_BATCH_H
@@ -0,0 +1,237 @@
+// ----------------------------------------------------------------------------
+// videoRecorder.cpp
+//
+// Description: Y4M video recorder (see videoRecorder.h)
+// ----------------------------------------------------------------------------
+
+#include "videoRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RECORDER_USE_SSE
+#endif
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#define popen _popen
+#define pclose _pclose
+#define PIPE_WRITE_MODE "wb"
+#else
+#define PIPE_WRITE_MODE "w" // POSIX pipes have no text mode
+#endif
+
+// BT.601 limited range, 8-bit fixed point:
+//   Y = ((66 R + 129 G + 25 B + 128) >> 8) + 16
+//   U = ((-38 R - 74 G + 112 B + 128) >> 8) + 128
+//   V = ((112 R - 94 G - 18 B + 128) >> 8) + 128
+static inline unsigned char lumaScalar(int r, int g, int b) {
+  return static_cast<unsigned char>(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+}
+static inline unsigned char chromaUScalar(int r, int g, int b) {
+  return static_cast<unsigned char>(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+}
+static inline unsigned char chromaVScalar(int r, int g, int b) {
+  return static_cast<unsigned char>(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+}
+
+#ifdef RECORDER_USE_SSE
+// Splits 8 RGBA pixels into three vectors of 8 unsigned 16-bit channels
+static inline void loadRGB(const unsigned char *p, __m128i &r, __m128i &g, __m128i &b) {
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+  r = _mm_packs_epi32(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+  g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 8), mask), _mm_and_si128(_mm_srli_epi32(a1, 8), mask));
+  b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 16), mask), _mm_and_si128(_mm_srli_epi32(a1, 16), mask));
+}
+
+// 66 R + 129 G + 25 B + 128 is below 2^16: unsigned 16-bit arithmetic cannot overflow
+static inline __m128i luma(const __m128i &r, const __m128i &g, const __m128i &b) {
+  __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+  y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+  y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+// Sums horizontal pairs of the two rows: 8 pixels of 2 rows -> 4 sums of 2x2 blocks (32-bit)
+static inline __m128i blockSums(const __m128i &top, const __m128i &bottom) {
+  return _mm_madd_epi16(_mm_add_epi16(top, bottom), _mm_set1_epi16(1));
+}
+
+// |weighted sums| stay below 2^15 for 8-bit averages: signed 16-bit arithmetic is exact
+static inline __m128i chroma(const __m128i &r, const __m128i &g, const __m128i &b, short cr, short cg, short cb) {
+  __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)), _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+  c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+  c = _mm_srai_epi16(_mm_add_epi16(c, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(c, _mm_set1_epi16(128));
+}
+#endif
+
+void convertRGBAToI420(const unsigned char *rgba, int width, int height, bool bottomUp, unsigned char *y, unsigned char *u, unsigned char *v) {
+  const size_t stride = static_cast<size_t>(width) * 4;
+  const int chromaWidth = (width + 1) / 2;
+  const auto row = [&](int j) { return rgba + (bottomUp ? static_cast<size_t>(height - 1 - j) : static_cast<size_t>(j)) * stride; };
+
+  for(int j = 0; j < height; j += 2) {
+    const unsigned char *top = row(j);
+    const unsigned char *bottom = row(std::min(j + 1, height - 1));
+    unsigned char *yTop = y + static_cast<size_t>(j) * width;
+    unsigned char *yBottom = y + static_cast<size_t>(std::min(j + 1, height - 1)) * width; // rewritten identically on odd heights
+    unsigned char *uRow = u + static_cast<size_t>(j / 2) * chromaWidth;
+    unsigned char *vRow = v + static_cast<size_t>(j / 2) * chromaWidth;
+    int i = 0;
+
+#ifdef RECORDER_USE_SSE
+    for(; i + 16 <= width; i += 16) {
+      __m128i rT0, gT0, bT0, rT1, gT1, bT1, rB0, gB0, bB0, rB1, gB1, bB1;
+      loadRGB(top + i*4, rT0, gT0, bT0);
+      loadRGB(top + i*4 + 32, rT1, gT1, bT1);
+      loadRGB(bottom + i*4, rB0, gB0, bB0);
+      loadRGB(bottom + i*4 + 32, rB1, gB1, bB1);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(yTop + i), _mm_packus_epi16(luma(rT0, gT0, bT0), luma(rT1, gT1, bT1)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(yBottom + i), _mm_packus_epi16(luma(rB0, gB0, bB0), luma(rB1, gB1, bB1)));
+
+      // Rounded 2x2 averages of the 8 chroma blocks
+      const __m128i two = _mm_set1_epi16(2);
+      const __m128i r = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(blockSums(rT0, rB0), blockSums(rT1, rB1)), two), 2);
+      const __m128i g = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(blockSums(gT0, gB0), blockSums(gT1, gB1)), two), 2);
+      const __m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(blockSums(bT0, bB0), blockSums(bT1, bB1)), two), 2);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(uRow + i/2), _mm_packus_epi16(chroma(r, g, b, -38, -74, 112), _mm_setzero_si128()));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(vRow + i/2), _mm_packus_epi16(chroma(r, g, b, 112, -94, -18), _mm_setzero_si128()));
+    }
+#endif
+
+    for(; i < width; i += 2) { // remainder (or everything without SIMD)
+      const int i1 = std::min(i + 1, width - 1);
+      const unsigned char *p[4] = {top + i*4, top + i1*4, bottom + i*4, bottom + i1*4};
+      yTop[i] = lumaScalar(p[0][0], p[0][1], p[0][2]);
+      yTop[i1] = lumaScalar(p[1][0], p[1][1], p[1][2]);
+      yBottom[i] = lumaScalar(p[2][0], p[2][1], p[2][2]);
+      yBottom[i1] = lumaScalar(p[3][0], p[3][1], p[3][2]);
+      const int r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+      const int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+      const int b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+      uRow[i/2] = chromaUScalar(r, g, b);
+      vRow[i/2] = chromaVScalar(r, g, b);
+    }
+  }
+}
+
+Y4mRecorder::~Y4mRecorder() {
+  close();
+}
+
+bool Y4mRecorder::open(const std::string &path, int width, int height, int fps, size_t queueCapacity) {
+  close();
+  if(path == "-") {
+    m_file = stdout;
+#if defined(_WIN32)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  } else if(!path.empty() && path[0] == '|') {
+    m_file = popen(path.c_str() + 1, PIPE_WRITE_MODE);
+    m_isPipe = true;
+  } else {
+    m_file = std::fopen(path.c_str(), "wb");
+  }
+  if(!m_file) {
+    std::cerr << "ERROR: Failed to open video output " << path << std::endl;
+    m_isPipe = false;
+    return false;
+  }
+
+  m_width = width;
+  m_height = height;
+  m_capacity = std::max<size_t>(queueCapacity, 1);
+  m_closing = false;
+  m_framesWritten = 0;
+  m_framesDropped = 0;
+  std::fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+  m_writer = std::thread(&Y4mRecorder::writerLoop, this);
+  return true;
+}
+
+void Y4mRecorder::close() {
+  if(!m_file)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closing = true;
+  }
+  m_frameReady.notify_all();
+  m_writer.join();
+
+  std::fflush(m_file);
+  if(m_isPipe)
+    pclose(m_file);
+  else if(m_file != stdout)
+    std::fclose(m_file);
+  m_file = nullptr;
+  m_isPipe = false;
+  m_queue.clear();
+  m_freeFrames.clear();
+}
+
+bool Y4mRecorder::pushFrame(const unsigned char *rgba, bool bottomUp, bool waitIfFull) {
+  if(!m_file)
+    return false;
+  Frame frame;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_queue.size() >= m_capacity) {
+      if(!waitIfFull) {
+        ++m_framesDropped;
+        return false;
+      }
+      m_slotFree.wait(lock, [this]() { return m_queue.size() < m_capacity; });
+    }
+    if(!m_freeFrames.empty()) {
+      frame = std::move(m_freeFrames.back());
+      m_freeFrames.pop_back();
+    }
+  }
+
+  // The copy happens outside of the lock, the writer keeps converting meanwhile
+  frame.rgba.assign(rgba, rgba + static_cast<size_t>(m_width) * m_height * 4);
+  frame.bottomUp = bottomUp;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(std::move(frame));
+  }
+  m_frameReady.notify_one();
+  return true;
+}
+
+void Y4mRecorder::writerLoop() {
+  const size_t lumaSize = static_cast<size_t>(m_width) * m_height;
+  const size_t chromaSize = static_cast<size_t>((m_width + 1) / 2) * ((m_height + 1) / 2);
+  std::vector<unsigned char> yuv(lumaSize + 2*chromaSize);
+
+  for(;;) {
+    Frame frame;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_frameReady.wait(lock, [this]() { return m_closing || !m_queue.empty(); });
+      if(m_queue.empty())
+        return; // closing and drained
+      frame = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+    m_slotFree.notify_one();
+
+    convertRGBAToI420(frame.rgba.data(), m_width, m_height, frame.bottomUp, yuv.data(), yuv.data() + lumaSize, yuv.data() + lumaSize + chromaSize);
+    std::fputs("FRAME\n", m_file);
+    if(std::fwrite(yuv.data(), 1, yuv.size(), m_file) != yuv.size())
+      std::cerr << "ERROR: Failed to write video frame" << std::endl;
+    ++m_framesWritten;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_freeFrames.push_back(std::move(frame));
+  }
+}
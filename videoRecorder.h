@@ -0,0 +1,71 @@
+// ----------------------------------------------------------------------------
+// videoRecorder.h
+//
+// Description: Streams rendered frames to a raw YUV4MPEG2 (Y4M) video. The RGB
+//              to YUV 4:2:0 conversion and the writes happen on a background
+//              thread fed through a bounded queue.
+// ----------------------------------------------------------------------------
+
+#ifndef VIDEO_RECORDER_H
+#define VIDEO_RECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Converts an RGBA8 image to planar YUV 4:2:0 (BT.601, limited range). Chroma is the average of
+// each 2x2 block. Rows are read bottom-up when bottomUp is set (OpenGL readback order).
+// y is width*height bytes, u and v are ((width+1)/2)*((height+1)/2) bytes each.
+void convertRGBAToI420(const unsigned char *rgba, int width, int height, bool bottomUp, unsigned char *y, unsigned char *u, unsigned char *v);
+
+class Y4mRecorder {
+public:
+  ~Y4mRecorder();
+
+  // path is a file name, "-" for the standard output or "|command" to pipe into a command
+  // (e.g., "|ffmpeg -i - out.mp4"). queueCapacity bounds the frames waiting for the writer.
+  bool open(const std::string &path, int width, int height, int fps, size_t queueCapacity = 8);
+  void close(); // writes the queued frames, then stops the writer thread
+
+  inline bool isOpen() const { return m_file != nullptr; }
+
+  // Copies an RGBA8 frame of the opened size into the queue. When the queue is full, waits for the
+  // writer if waitIfFull is set, otherwise drops the frame and returns false.
+  bool pushFrame(const unsigned char *rgba, bool bottomUp, bool waitIfFull);
+
+  inline uint64_t getFramesWritten() const { return m_framesWritten; }
+  inline uint64_t getFramesDropped() const { return m_framesDropped; }
+
+private:
+  struct Frame {
+    std::vector<unsigned char> rgba;
+    bool bottomUp = true;
+  };
+  void writerLoop();
+
+  FILE *m_file = nullptr;
+  bool m_isPipe = false;
+  int m_width = 0;
+  int m_height = 0;
+  size_t m_capacity = 0;
+
+  std::thread m_writer;
+  std::mutex m_mutex;
+  std::condition_variable m_frameReady; // signals the writer
+  std::condition_variable m_slotFree;   // signals the producer
+  std::deque<Frame> m_queue;
+  std::vector<Frame> m_freeFrames;       // recycled buffers, to avoid per-frame allocations
+  bool m_closing = false;
+
+  std::atomic<uint64_t> m_framesWritten{0}; // updated by the writer thread
+  uint64_t m_framesDropped = 0;
+};
+
+#endif // VIDEO_RECORDER_H
@@ -0,0 +1,535 @@
+// ----------------------------------------------------------------------------
+// virtualTexture.cpp
+//
+// Description: Virtual texturing (see virtualTexture.h)
+// ----------------------------------------------------------------------------
+
+#include "virtualTexture.h"
+#include "fileUtils.h"
+#include "mipmapGenerator.h"
+#include "parallelJpeg.h"
+#include "threadPool.h"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#if defined(_WIN32)
+#define seekFile(file, offset) _fseeki64(file, static_cast<__int64>(offset), SEEK_SET)
+#else
+#define seekFile(file, offset) fseeko(file, static_cast<off_t>(offset), SEEK_SET)
+#endif
+
+const static uint32_t kPyramidMagic = 0x54565353; // "SSVT"
+const static uint32_t kPyramidVersion = 1;
+
+// Tiles read at once at most: enough to keep the pool busy, few enough that the requests stay
+// close to the latest feedback
+const static size_t kMaxReadsInFlight = 32;
+
+// Tiles are identified as in the feedback buffer: level in the top 4 bits, then 14 bits of x and y
+// (a level of 15 marks the pixels without any virtually textured surface)
+static inline uint32_t tileKey(uint32_t level, uint32_t x, uint32_t y) {
+  return (level << 28) | (x << 14) | y;
+}
+
+static inline uint32_t tileLevel(uint32_t tile) { return tile >> 28; }
+static inline uint32_t tileX(uint32_t tile) { return (tile >> 14) & 0x3FFF; }
+static inline uint32_t tileY(uint32_t tile) { return tile & 0x3FFF; }
+
+static uint32_t nextPowerOfTwo(uint32_t n) {
+  uint32_t p = 1;
+  while(p < n)
+    p *= 2;
+  return p;
+}
+
+bool buildTilePyramid(const std::string &image, const std::string &pyramid, int tileSize, int border, ThreadPool *pool) {
+  std::vector<unsigned char> encoded, bands;
+  if(std::FILE *source = std::fopen(image.c_str(), "rb")) {
+    std::fseek(source, 0, SEEK_END);
+    encoded.resize(std::max(0L, std::ftell(source)));
+    std::fseek(source, 0, SEEK_SET);
+    if(std::fread(encoded.data(), 1, encoded.size(), source) != encoded.size())
+      encoded.clear();
+    std::fclose(source);
+  }
+  int width = 0, height = 0, numComponents = 0;
+  if(encoded.empty() || !stbi_info_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &numComponents)) {
+    std::cerr << "ERROR: Failed to load texture " << image << ": " << (encoded.empty() ? "cannot read the file" : stbi_failure_reason()) << std::endl;
+    return false;
+  }
+  unsigned char *decoded = nullptr;
+  if(!decodeJpegParallel(encoded.data(), encoded.size(), 3, pool, bands, width, height)) {
+    // stb_image decodes into a single buffer of at most INT_MAX bytes: larger images only go through
+    // the parallel decoder
+    if(static_cast<uint64_t>(width) * height * 3 > static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+      std::cerr << "ERROR: " << image << " (" << width << "x" << height << ") is too large to be decoded whole: use a baseline JPEG with "
+                << "restart markers (jpegtran -restart 1), which is decoded in bands" << std::endl;
+      return false;
+    }
+    decoded = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &numComponents, 3);
+    if(!decoded) {
+      std::cerr << "ERROR: Failed to load texture " << image << ": " << stbi_failure_reason() << std::endl;
+      return false;
+    }
+  }
+  std::vector<unsigned char>().swap(encoded);
+  const unsigned char *data = decoded ? decoded : bands.data();
+  TilePyramidHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kPyramidMagic;
+  header.version = kPyramidVersion;
+  header.tileSize = tileSize;
+  header.border = border;
+  header.tilesX = std::min(nextPowerOfTwo((width + tileSize - 1) / tileSize), 1u << 14);
+  header.tilesY = std::min(nextPowerOfTwo((height + tileSize - 1) / tileSize), 1u << 14);
+  header.numLevels = 1;
+  for(uint32_t tiles = std::min(header.tilesX, header.tilesY); tiles > 1; tiles /= 2)
+    ++header.numLevels;
+
+  std::vector<MipLevel> levels(1);
+  levels[0].width = header.tilesX * tileSize;
+  levels[0].height = header.tilesY * tileSize;
+  // Level 0 takes over the bands of the parallel decoder, without a copy; the decoded image is released
+  // before the mips are built
+  if(levels[0].width != width || levels[0].height != height)
+    resampleImage(data, width, height, 3, levels[0].pixels, levels[0].width, levels[0].height);
+  else if(decoded)
+    levels[0].pixels.assign(decoded, decoded + static_cast<size_t>(width) * height * 3);
+  else
+    levels[0].pixels.swap(bands);
+  stbi_image_free(decoded);
+  std::vector<unsigned char>().swap(bands);
+  generateMipChain(levels, 3, true); // albedo maps are sRGB
+
+  // Written to a temporary file then renamed, so that an interrupted build is never opened
+  const std::string temporary = temporaryPath(pyramid);
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if(!file) {
+    std::cerr << "ERROR: cannot write the tile pyramid " << temporary << std::endl;
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  const int pageSize = tileSize + 2 * border;
+  std::vector<unsigned char> tile(static_cast<size_t>(pageSize) * pageSize * 3);
+  for(uint32_t level = 0; level < header.numLevels && ok; ++level) {
+    const MipLevel &source = levels[level];
+    for(uint32_t ty = 0; ty < (header.tilesY >> level) && ok; ++ty) {
+      for(uint32_t tx = 0; tx < (header.tilesX >> level) && ok; ++tx) {
+        for(int j = 0; j < pageSize; ++j) {
+          const int y = std::min(std::max(static_cast<int>(ty) * tileSize - border + j, 0), source.height - 1);
+          for(int i = 0; i < pageSize; ++i) {
+            const int x = (static_cast<int>(tx) * tileSize - border + i + source.width) % source.width;
+            std::memcpy(&tile[(static_cast<size_t>(j) * pageSize + i) * 3], &source.pixels[(static_cast<size_t>(y) * source.width + x) * 3], 3);
+          }
+        }
+        ok = std::fwrite(tile.data(), 1, tile.size(), file) == tile.size();
+      }
+    }
+  }
+  if(std::fclose(file) != 0 || !ok) {
+    std::remove(temporary.c_str());
+    std::cerr << "ERROR: cannot write the tile pyramid " << temporary << std::endl;
+    return false;
+  }
+  if(!replaceFile(temporary, pyramid)) {
+    std::remove(temporary.c_str());
+    std::cerr << "ERROR: cannot replace the tile pyramid " << pyramid << std::endl;
+    return false;
+  }
+  return true;
+}
+
+VirtualTexture::~VirtualTexture() {
+  release();
+}
+
+bool VirtualTexture::init(const std::string &image, const std::string &pyramid, ThreadPool *pool, int cachePages) {
+  release();
+  if(!isNewerThan(pyramid, image)) {
+    std::cout << "Building the tile pyramid of " << image << "..." << std::endl;
+    const auto start = std::chrono::steady_clock::now();
+    if(!buildTilePyramid(image, pyramid, 128, 4, pool))
+      return false;
+    std::cout << "Tile pyramid " << pyramid << " built in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+  }
+
+  m_file = std::fopen(pyramid.c_str(), "rb");
+  if(!m_file || std::fread(&m_header, sizeof(m_header), 1, m_file) != 1 || m_header.magic != kPyramidMagic || m_header.version != kPyramidVersion ||
+     m_header.numLevels == 0 || m_header.numLevels > 15 || m_header.tilesX > (1u << 14) || m_header.tilesY > (1u << 14)) {
+    std::cerr << "ERROR: invalid tile pyramid " << pyramid << std::endl;
+    release();
+    return false;
+  }
+  const uint32_t coarsest = m_header.numLevels - 1;
+  const size_t numPinned = static_cast<size_t>(m_header.tilesX >> coarsest) * (m_header.tilesY >> coarsest);
+  m_pool = pool;
+  m_pagesPerSide = cachePages;
+  m_pageSize = m_header.tileSize + 2 * m_header.border;
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  m_pagesPerSide = std::min(std::min(m_pagesPerSide, static_cast<int>(maxSize / m_pageSize)), 256); // page coordinates are bytes in the indirection
+  if(numPinned > static_cast<size_t>(m_pagesPerSide * m_pagesPerSide) / 2) {
+    std::cerr << "ERROR: a virtual texture cache of " << m_pagesPerSide << "x" << m_pagesPerSide << " pages cannot hold the " << numPinned << " tiles of the coarsest level" << std::endl;
+    release();
+    return false;
+  }
+
+  m_levelFirstTile.resize(m_header.numLevels);
+  m_tilePages.resize(m_header.numLevels);
+  m_indirectionLevels.resize(m_header.numLevels);
+  uint64_t firstTile = 0;
+  for(uint32_t level = 0; level < m_header.numLevels; ++level) {
+    const size_t numTiles = static_cast<size_t>(m_header.tilesX >> level) * (m_header.tilesY >> level);
+    m_levelFirstTile[level] = firstTile;
+    firstTile += numTiles;
+    m_tilePages[level].assign(numTiles, -1);
+    m_indirectionLevels[level].resize(numTiles * 4);
+  }
+
+  GLint previousTexture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  // Pages are only read where a tile was uploaded: the storage is left undefined
+  glGenTextures(1, &m_physical);
+  glBindTexture(GL_TEXTURE_2D, m_physical);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_pagesPerSide * m_pageSize, m_pagesPerSide * m_pageSize, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  // One texel per tile, one level per pyramid level; integer textures are fetched, never filtered
+  glGenTextures(1, &m_indirection);
+  glBindTexture(GL_TEXTURE_2D, m_indirection);
+  for(uint32_t level = 0; level < m_header.numLevels; ++level)
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, m_header.tilesX >> level, m_header.tilesY >> level, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, coarsest);
+  glBindTexture(GL_TEXTURE_2D, previousTexture);
+
+  m_pages.assign(static_cast<size_t>(m_pagesPerSide) * m_pagesPerSide, Page());
+  for(int page = static_cast<int>(m_pages.size()) - 1; page >= 0; --page)
+    m_freePages.push_back(page);
+
+  // The coarsest level is the fallback of every tile
+  std::vector<unsigned char> texels;
+  for(uint32_t y = 0; y < (m_header.tilesY >> coarsest); ++y) {
+    for(uint32_t x = 0; x < (m_header.tilesX >> coarsest); ++x) {
+      if(!readTile(tileKey(coarsest, x, y), texels)) {
+        std::cerr << "ERROR: truncated tile pyramid " << pyramid << std::endl;
+        release();
+        return false;
+      }
+      const int page = allocatePage();
+      m_pages[page].tile = tileKey(coarsest, x, y);
+      m_pages[page].pinned = true;
+      m_tilePages[coarsest][y * (m_header.tilesX >> coarsest) + x] = page;
+      ++m_residentCount;
+      uploadTile(page, texels);
+    }
+  }
+  updateIndirection();
+  m_readback.setConsumer([this](const unsigned char *pixels, int width, int height, uint64_t) { consumeFeedback(pixels, width, height); });
+  return true;
+}
+
+void VirtualTexture::release() {
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_loadedCv.wait(lock, [this]() { return m_reading == 0; });
+    m_loaded.clear();
+  }
+  m_readback.release();
+  if(m_feedbackFramebuffer) {
+    glDeleteFramebuffers(1, &m_feedbackFramebuffer);
+    glDeleteRenderbuffers(1, &m_feedbackColor);
+    glDeleteRenderbuffers(1, &m_feedbackDepth);
+  }
+  m_feedbackFramebuffer = m_feedbackColor = m_feedbackDepth = 0;
+  m_feedbackWidth = m_feedbackHeight = 0;
+  if(m_physical) {
+    glDeleteTextures(1, &m_physical);
+    glDeleteTextures(1, &m_indirection);
+  }
+  m_physical = m_indirection = 0;
+  if(m_file)
+    std::fclose(m_file);
+  m_file = nullptr;
+  m_pages.clear();
+  m_freePages.clear();
+  m_lru.clear();
+  m_tilePages.clear();
+  m_indirectionLevels.clear();
+  m_levelFirstTile.clear();
+  m_requested.clear();
+  m_wanted.clear();
+  m_residentCount = 0;
+  m_levelBias = 0;
+}
+
+size_t VirtualTexture::cacheBytes() const {
+  size_t bytes = m_pages.size() * m_pageSize * m_pageSize * 3;
+  for(const std::vector<unsigned char> &level : m_indirectionLevels)
+    bytes += level.size();
+  return bytes;
+}
+
+bool VirtualTexture::readTile(uint32_t tile, std::vector<unsigned char> &texels) {
+  const uint32_t level = tileLevel(tile);
+  const uint64_t index = m_levelFirstTile[level] + static_cast<uint64_t>(tileY(tile)) * (m_header.tilesX >> level) + tileX(tile);
+  texels.resize(static_cast<size_t>(m_pageSize) * m_pageSize * 3);
+  std::lock_guard<std::mutex> lock(m_fileMutex);
+  return seekFile(m_file, sizeof(TilePyramidHeader) + index * texels.size()) == 0 && std::fread(texels.data(), 1, texels.size(), m_file) == texels.size();
+}
+
+void VirtualTexture::setProgramUniforms(GLuint program, int physicalUnit, int indirectionUnit) const {
+  GLint previous;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "vtPhysical"), physicalUnit);
+  glUniform1i(glGetUniformLocation(program, "vtIndirection"), indirectionUnit);
+  glUniform2f(glGetUniformLocation(program, "vtTiles"), static_cast<float>(m_header.tilesX), static_cast<float>(m_header.tilesY));
+  glUniform1f(glGetUniformLocation(program, "vtTileSize"), static_cast<float>(m_header.tileSize));
+  glUniform1f(glGetUniformLocation(program, "vtBorder"), static_cast<float>(m_header.border));
+  glUniform1f(glGetUniformLocation(program, "vtPhysicalScale"), 1.f / (m_pagesPerSide * m_pageSize));
+  glUniform1i(glGetUniformLocation(program, "vtMaxLevel"), static_cast<GLint>(m_header.numLevels) - 1);
+  glUniform1f(glGetUniformLocation(program, "vtFeedbackBias"), std::log2(static_cast<float>(kFeedbackDivisor)));
+  glUseProgram(previous);
+}
+
+void VirtualTexture::bindTextures(int physicalUnit, int indirectionUnit) const {
+  glActiveTexture(GL_TEXTURE0 + physicalUnit);
+  glBindTexture(GL_TEXTURE_2D, m_physical);
+  glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+  glBindTexture(GL_TEXTURE_2D, m_indirection);
+}
+
+void VirtualTexture::beginFeedback(int viewportWidth, int viewportHeight) {
+  const int width = std::max(1, viewportWidth / kFeedbackDivisor);
+  const int height = std::max(1, viewportHeight / kFeedbackDivisor);
+  if(width != m_feedbackWidth || height != m_feedbackHeight) {
+    if(!m_feedbackFramebuffer) {
+      glGenFramebuffers(1, &m_feedbackFramebuffer);
+      glGenRenderbuffers(1, &m_feedbackColor);
+      glGenRenderbuffers(1, &m_feedbackDepth);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    GLint previous = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_feedbackFramebuffer);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_feedbackColor);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_feedbackDepth);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
+    m_feedbackWidth = width;
+    m_feedbackHeight = height;
+    m_readback.init(width, height, 2); // a frame or two of latency is invisible: the coarser tiles fill in meanwhile
+  }
+
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previousFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, m_previousClearColor);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_feedbackFramebuffer);
+  glViewport(0, 0, m_feedbackWidth, m_feedbackHeight);
+  glClearColor(1.f, 1.f, 1.f, 1.f); // level 15: no tile
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback() {
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_previousFramebuffer);
+  glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+  glClearColor(m_previousClearColor[0], m_previousClearColor[1], m_previousClearColor[2], m_previousClearColor[3]);
+  m_readback.enqueue(m_feedbackFramebuffer, m_feedbackFrame);
+}
+
+void VirtualTexture::consumeFeedback(const unsigned char *pixels, int width, int height) {
+  ++m_feedbackFrame;
+  std::vector<uint32_t> seen(static_cast<size_t>(width) * height);
+  for(size_t i = 0; i < seen.size(); ++i)
+    seen[i] = (pixels[4*i] << 24) | (pixels[4*i + 1] << 16) | (pixels[4*i + 2] << 8) | pixels[4*i + 3];
+  std::sort(seen.begin(), seen.end());
+  seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+
+  // A tile and its ancestors, which are drawn while it loads, are kept in the cache
+  std::unordered_set<uint32_t> visited;
+  m_wanted.clear();
+  for(uint32_t tile : seen) {
+    uint32_t level = tileLevel(tile), x = tileX(tile), y = tileY(tile);
+    if(level >= m_header.numLevels || x >= (m_header.tilesX >> level) || y >= (m_header.tilesY >> level))
+      continue; // background
+    const uint32_t biased = std::min(level + m_levelBias, m_header.numLevels - 1);
+    x >>= biased - level;
+    y >>= biased - level;
+    level = biased;
+    for(; level < m_header.numLevels; ++level, x /= 2, y /= 2) {
+      const uint32_t key = tileKey(level, x, y);
+      if(!visited.insert(key).second)
+        break; // the rest of the chain is done
+      const int page = m_tilePages[level][y * (m_header.tilesX >> level) + x];
+      if(page < 0) {
+        m_wanted.push_back(key);
+      } else if(!m_pages[page].pinned) {
+        m_pages[page].lastSeen = m_feedbackFrame;
+        m_lru.splice(m_lru.begin(), m_lru, m_pages[page].lruPosition);
+      }
+    }
+  }
+  if(m_levelBias > 0 && visited.size() < m_pages.size() / 4)
+    --m_levelBias; // the finer level would probably fit again
+
+  // Coarse tiles first: they cover more of the screen, and are the fallback of the finer ones
+  std::sort(m_wanted.begin(), m_wanted.end(), [](uint32_t a, uint32_t b) { return tileLevel(a) > tileLevel(b); });
+}
+
+void VirtualTexture::requestTiles() {
+  for(uint32_t tile : m_wanted) {
+    if(m_requested.size() >= kMaxReadsInFlight)
+      break;
+    if(!m_requested.insert(tile).second)
+      continue;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ++m_reading;
+    }
+    const auto read = [this, tile]() {
+      LoadedTile loaded;
+      loaded.tile = tile;
+      if(!readTile(tile, loaded.texels))
+        loaded.texels.clear();
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_loaded.push_back(std::move(loaded));
+      --m_reading;
+      m_loadedCv.notify_all();
+    };
+    if(m_pool)
+      m_pool->submit(read);
+    else
+      read();
+  }
+}
+
+int VirtualTexture::allocatePage() {
+  if(!m_freePages.empty()) {
+    const int page = m_freePages.back();
+    m_freePages.pop_back();
+    return page;
+  }
+  if(m_lru.empty())
+    return -1;
+  const int page = m_lru.back();
+  if(m_pages[page].lastSeen >= m_feedbackFrame)
+    return -1; // every page holds a tile seen in the latest feedback: evicting one would thrash
+  const uint32_t tile = m_pages[page].tile;
+  const uint32_t level = tileLevel(tile);
+  m_tilePages[level][tileY(tile) * (m_header.tilesX >> level) + tileX(tile)] = -1;
+  --m_residentCount;
+  m_lru.pop_back();
+  m_pages[page].tile = kNoTile;
+  m_indirectionDirty = true;
+  ++m_tilesEvicted;
+  return page;
+}
+
+void VirtualTexture::uploadTile(int page, const std::vector<unsigned char> &texels) {
+  GLint previousAlignment = 4, previousTexture = 0, previousUnpackBuffer = 0;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &previousUnpackBuffer);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, m_physical);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, (page % m_pagesPerSide) * m_pageSize, (page / m_pagesPerSide) * m_pageSize, m_pageSize, m_pageSize, GL_RGB, GL_UNSIGNED_BYTE, texels.data());
+  glBindTexture(GL_TEXTURE_2D, previousTexture);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, previousUnpackBuffer);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+}
+
+void VirtualTexture::update() {
+  if(!m_physical)
+    return;
+  m_readback.poll();
+  requestTiles();
+
+  std::vector<LoadedTile> loaded;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while(!m_loaded.empty() && static_cast<int>(loaded.size()) < m_tilesPerFrame) {
+      loaded.push_back(std::move(m_loaded.front()));
+      m_loaded.pop_front();
+    }
+  }
+  for(LoadedTile &tile : loaded) {
+    m_requested.erase(tile.tile);
+    const uint32_t level = tileLevel(tile.tile);
+    int &tilePage = m_tilePages[level][tileY(tile.tile) * (m_header.tilesX >> level) + tileX(tile.tile)];
+    if(tile.texels.empty()) {
+      std::cerr << "ERROR: cannot read tile " << tileX(tile.tile) << "," << tileY(tile.tile) << " of level " << level << std::endl;
+      continue;
+    }
+    if(tilePage >= 0)
+      continue;
+    const int page = allocatePage();
+    if(page < 0) {
+      // The cache is full of visible tiles: ask for coarser ones rather than reading tiles that cannot be kept
+      m_levelBias = std::min(m_levelBias + 1, static_cast<int>(m_header.numLevels) - 1);
+      m_wanted.clear();
+      continue;
+    }
+    uploadTile(page, tile.texels);
+    m_pages[page].tile = tile.tile;
+    m_pages[page].lastSeen = m_feedbackFrame;
+    m_lru.push_front(page);
+    m_pages[page].lruPosition = m_lru.begin();
+    tilePage = page;
+    ++m_residentCount;
+    ++m_tilesLoaded;
+    m_indirectionDirty = true;
+  }
+  if(m_indirectionDirty)
+    updateIndirection();
+}
+
+void VirtualTexture::updateIndirection() {
+  // From the coarsest level, which is always resident, down: a missing tile takes its parent's entry
+  GLint previousAlignment = 4, previousTexture = 0, previousUnpackBuffer = 0;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &previousUnpackBuffer);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, m_indirection);
+  for(int level = static_cast<int>(m_header.numLevels) - 1; level >= 0; --level) {
+    const uint32_t width = m_header.tilesX >> level, height = m_header.tilesY >> level;
+    const std::vector<int> &pages = m_tilePages[level];
+    unsigned char *entries = m_indirectionLevels[level].data();
+    for(uint32_t y = 0; y < height; ++y) {
+      for(uint32_t x = 0; x < width; ++x) {
+        unsigned char *entry = entries + 4 * (y * width + x);
+        const int page = pages[y * width + x];
+        if(page >= 0) {
+          entry[0] = static_cast<unsigned char>(page % m_pagesPerSide);
+          entry[1] = static_cast<unsigned char>(page / m_pagesPerSide);
+          entry[2] = static_cast<unsigned char>(level);
+          entry[3] = 0;
+        } else {
+          std::memcpy(entry, &m_indirectionLevels[level + 1][4 * ((y / 2) * (width / 2) + x / 2)], 4);
+        }
+      }
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries);
+  }
+  glBindTexture(GL_TEXTURE_2D, previousTexture);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, previousUnpackBuffer);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+  m_indirectionDirty = false;
+}
@@ -0,0 +1,151 @@
+// ----------------------------------------------------------------------------
+// virtualTexture.h
+//
+// Description: Virtual texturing for albedo maps too large to keep in memory:
+//              a tile pyramid on disk, a low resolution feedback pass telling
+//              which tiles are seen at which level, tiles read on the thread
+//              pool into a fixed-size physical cache (LRU eviction), and an
+//              indirection texture mapping every tile to its cache page or,
+//              until it arrives, to its closest resident ancestor.
+// ----------------------------------------------------------------------------
+
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "pixelReadback.h"
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class ThreadPool;
+
+// Tile pyramid file: a header, then every tile of level 0, 1, ... in rows, each stored as
+// (tileSize + 2 border)^2 RGB8 texels. The border repeats the neighboring tiles (wrapping around
+// horizontally, clamped vertically) so that bilinear filtering in the cache never crosses pages.
+struct TilePyramidHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t tileSize;  // texels of a tile side, without its border
+  uint32_t border;
+  uint32_t tilesX;    // tiles of level 0, powers of two
+  uint32_t tilesY;
+  uint32_t numLevels; // down to the level where the shortest side is one tile
+  uint32_t reserved;
+};
+
+// Cuts an image, resampled to power-of-two tile counts, and its sRGB mip chain into a tile pyramid.
+// The image is decoded whole (in parallel on pool if it is a JPEG with restart markers): this is the
+// offline step, only the runtime is bounded in memory.
+bool buildTilePyramid(const std::string &image, const std::string &pyramid, int tileSize, int border, ThreadPool *pool);
+
+class VirtualTexture {
+public:
+  ~VirtualTexture();
+
+  // Opens a pyramid (building it from image first if it is missing or older), and creates a
+  // physical cache of cachePages x cachePages pages. The coarsest level is loaded right away and
+  // stays resident. Returns false if the pyramid cannot be used.
+  bool init(const std::string &image, const std::string &pyramid, ThreadPool *pool, int cachePages);
+  void release(); // waits for the reads in flight
+  inline bool isValid() const { return m_physical != 0; }
+
+  inline void setUploadBudget(int tilesPerFrame) { m_tilesPerFrame = tilesPerFrame; }
+
+  // Sets the constant uniforms of a program sampling the virtual texture (see fragmentShader.glsl)
+  // or writing its feedback (vtFeedbackShader.glsl); samplers use the given texture units.
+  void setProgramUniforms(GLuint program, int physicalUnit, int indirectionUnit) const;
+  void bindTextures(int physicalUnit, int indirectionUnit) const;
+
+  // Feedback pass: beginFeedback binds a framebuffer of 1/kFeedbackDivisor of the viewport size,
+  // where the caller draws the virtually textured meshes with the feedback program; endFeedback
+  // restores the previous framebuffer and reads the result back asynchronously.
+  void beginFeedback(int viewportWidth, int viewportHeight);
+  void endFeedback();
+
+  // Once per frame: turns the feedback read back so far into tile requests, uploads the tiles read
+  // within the per-frame budget, and refreshes the indirection texture if pages changed.
+  void update();
+
+  inline size_t residentCount() const { return m_residentCount; }
+  inline size_t pageCount() const { return m_pages.size(); }
+  inline size_t pendingCount() const { return m_requested.size(); }
+  inline uint64_t getTilesLoaded() const { return m_tilesLoaded; }
+  inline uint64_t getTilesEvicted() const { return m_tilesEvicted; }
+  inline int getLevelBias() const { return m_levelBias; }
+  size_t cacheBytes() const; // GPU memory of the physical cache and the indirection texture
+
+  const static int kFeedbackDivisor = 8;
+
+private:
+  struct Page {
+    uint32_t tile = kNoTile;
+    bool pinned = false;                  // coarsest level: never evicted
+    uint64_t lastSeen = 0;                // feedback frame that last asked for the tile
+    std::list<int>::iterator lruPosition; // in m_lru unless pinned or free
+  };
+  struct LoadedTile {
+    uint32_t tile;
+    std::vector<unsigned char> texels; // empty if the read failed
+  };
+  const static uint32_t kNoTile = 0xFFFFFFFF;
+
+  bool readTile(uint32_t tile, std::vector<unsigned char> &texels);
+  void consumeFeedback(const unsigned char *pixels, int width, int height);
+  void requestTiles();
+  int allocatePage();
+  void uploadTile(int page, const std::vector<unsigned char> &texels);
+  void updateIndirection();
+
+  TilePyramidHeader m_header;
+  std::vector<uint64_t> m_levelFirstTile; // index in the file of the first tile of every level
+  std::FILE *m_file = nullptr;
+  std::mutex m_fileMutex;
+  ThreadPool *m_pool = nullptr;
+  int m_pagesPerSide = 0;
+  int m_pageSize = 0; // texels of a page side, border included
+  int m_tilesPerFrame = 8;
+
+  GLuint m_physical = 0;
+  GLuint m_indirection = 0;
+  std::vector<std::vector<unsigned char>> m_indirectionLevels; // RGBA8UI: page x, page y, level of the resident tile
+  bool m_indirectionDirty = false;
+
+  std::vector<Page> m_pages;
+  std::vector<int> m_freePages;
+  std::list<int> m_lru; // most recently seen first
+  std::vector<std::vector<int>> m_tilePages; // page of every tile of every level, -1 if not resident
+  size_t m_residentCount = 0;
+  std::unordered_set<uint32_t> m_requested;
+  std::vector<uint32_t> m_wanted; // tiles of the last feedback that are not resident
+  uint64_t m_feedbackFrame = 0;
+  int m_levelBias = 0; // levels added to the feedback while the cache cannot hold every visible tile
+
+  GLuint m_feedbackFramebuffer = 0;
+  GLuint m_feedbackColor = 0;
+  GLuint m_feedbackDepth = 0;
+  int m_feedbackWidth = 0;
+  int m_feedbackHeight = 0;
+  GLint m_previousFramebuffer = 0;
+  GLint m_previousViewport[4];
+  GLfloat m_previousClearColor[4];
+  PixelReadback m_readback;
+
+  std::mutex m_mutex;
+  std::condition_variable m_loadedCv;
+  std::deque<LoadedTile> m_loaded; // filled by the reading threads
+  size_t m_reading = 0;            // reads in flight, guarded by m_mutex
+
+  uint64_t m_tilesLoaded = 0;
+  uint64_t m_tilesEvicted = 0;
+};
+
+#endif // VIRTUAL_TEXTURE_H
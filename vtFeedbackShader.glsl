@@ -0,0 +1,21 @@
+#version 330 core	     // Minimal GL version support expected from the GPU
+// Virtual texture feedback: writes the tile, and its level, needed by each pixel (see virtualTexture.h)
+
+uniform vec2 vtTiles;        // tiles of the finest level
+uniform float vtTileSize;
+uniform int vtMaxLevel;
+uniform float vtFeedbackBias; // log2 of the ratio between the screen and the feedback resolutions
+
+in vec2 fTexCoord;
+out vec4 color;
+
+void main() {
+	vec2 texel = fTexCoord * vtTiles * vtTileSize;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	int level = clamp(int(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - vtFeedbackBias + 0.5)), 0, vtMaxLevel);
+	ivec2 tiles = ivec2(vtTiles) >> level;
+	uvec2 tile = uvec2(clamp(ivec2(fTexCoord * vec2(tiles)), ivec2(0), tiles - 1));
+
+	uint key = (uint(level) << 28) | (tile.x << 14) | tile.y; // level, x, y in 4, 14 and 14 bits
+	color = vec4((key >> 24) & 255u, (key >> 16) & 255u, (key >> 8) & 255u, key & 255u) / 255.0;
+}